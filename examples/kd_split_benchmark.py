@@ -0,0 +1,63 @@
+import time
+import logging
+import numpy as np
+
+import tectosaur as tct
+from tectosaur.mesh.mesh_gen import make_sphere
+from tectosaur.fmm.tsfmm import TSFMM, get_traversal_module, make_tree
+
+tct.logger.setLevel(logging.INFO)
+
+# Compares the octree with the kd-tree split policies on a long, narrow,
+# dipping fault and on a sphere.
+
+def dipping_fault(nx, ny):
+    corners = [[-10.0, 0, 0], [-10.0, 0.7, -0.7], [10.0, 0.7, -0.7], [10.0, 0, 0]]
+    return tct.make_rect(nx, ny, corners)
+
+meshes = [
+    ('dipping fault', dipping_fault(400, 20)),
+    ('sphere', make_sphere((0.0, 0.0, 0.0), 1.0, 5))
+]
+
+builders = [
+    ('octree', 'build_compact'),
+    ('kdtree', 'build'),
+    ('kdtree', 'build_median'),
+    ('kdtree', 'build_widest'),
+    ('kdtree', 'build_cost'),
+]
+
+def timed(f):
+    start = time.time()
+    out = f()
+    return out, time.time() - start
+
+pts_per_cell = 100
+mac = 2.5
+for mesh_name, m in meshes:
+    print('{}: {} tris'.format(mesh_name, m[1].shape[0]))
+    x = np.random.rand(m[1].shape[0] * 9)
+    for tree_type, tree_builder in builders:
+        tree, build_time = timed(
+            lambda: make_tree(m, pts_per_cell, tree_builder, tree_type)
+        )
+        module = get_traversal_module(tree_type)
+        interactions, traversal_time = timed(
+            lambda: module.fmmmm_interactions(tree, tree, 1.0, mac, 0, True)
+        )
+        fmm = TSFMM(
+            m, m, params = [1.0, 0.25], order = 2, quad_order = 2,
+            float_type = np.float32, K_name = 'elasticRT3',
+            mac = mac, max_pts_per_cell = pts_per_cell,
+            n_workers_per_block = 128,
+            tree_type = tree_type, tree_builder = tree_builder
+        )
+        fmm.dot(x)
+        _, dot_time = timed(lambda: fmm.dot(x))
+        print('    {:>6s}.{:<13s} height: {:3d}  build: {:.4f}s  traversal: {:.4f}s  '
+            'matvec: {:.4f}s'.format(
+                tree_type, tree_builder, tree.max_height,
+                build_time, traversal_time, dot_time
+            )
+        )
@@ -0,0 +1,55 @@
+import time
+import logging
+import concurrent.futures
+import numpy as np
+
+import tectosaur as tct
+
+tct.logger.setLevel(logging.INFO)
+
+# Measures how much of the nearfield sparse product RegularizedSparseIntegralOp
+# hides behind the farfield by comparing its matvec with running the two
+# pieces back to back. It also times two threads calling dot on two operators,
+# whose nearfield products shouldn't wait for each other.
+
+n = 100
+corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+m = tct.make_rect(n, n, corners)
+
+def build_op():
+    return tct.RegularizedSparseIntegralOp(
+        8, 8, 8, 2, 5, 2.5, 'elasticRH3', 'elasticRH3', [1.0, 0.25],
+        m[0], m[1], np.float32,
+        farfield_op_type = tct.FMMFarfieldOp(mac = 2.5, pts_per_cell = 100, order = 4)
+    )
+op = build_op()
+op2 = build_op()
+x = np.random.rand(op.shape[1])
+
+def timed(f, n_runs = 5):
+    f()
+    start = time.time()
+    for i in range(n_runs):
+        out = f()
+    return out, (time.time() - start) / n_runs
+
+y_seq, seq_time = timed(lambda: op.nearfield.dot(x) + op.farfield.dot(x))
+y, overlap_time = timed(lambda: op.dot(x))
+_, near_time = timed(lambda: op.nearfield.dot(x))
+_, far_time = timed(lambda: op.farfield.dot(x))
+
+pool = concurrent.futures.ThreadPoolExecutor(max_workers = 2)
+def both():
+    futures = [pool.submit(o.dot, x) for o in [op, op2]]
+    return [f.result() for f in futures]
+_, both_time = timed(both)
+
+print('{} tris'.format(m[1].shape[0]))
+print('nearfield: {:.4f}s  farfield: {:.4f}s'.format(near_time, far_time))
+print('sequential: {:.4f}s  overlapped: {:.4f}s  speedup: {:.2f}'.format(
+    seq_time, overlap_time, seq_time / overlap_time
+))
+print('two operators from two threads: {:.4f}s'.format(both_time))
+print('relative difference: {:.2e}'.format(
+    np.linalg.norm(y - y_seq) / np.linalg.norm(y_seq)
+))
@@ -0,0 +1,30 @@
+import time
+import numpy as np
+
+import tectosaur.mesh.mesh_gen as mesh_gen
+from tectosaur.mesh.find_near_adj import fast_find_nearfield, get_tri_centroids_rs
+
+# Times the nearfield query, which is dominated by the leaf-leaf filtering,
+# for meshes of increasing size. leaf_filter_lanes is the number of balls
+# tested per vector instruction (1 if the CPU has neither AVX2 nor AVX-512).
+
+def run(n, leaf_size, n_runs = 3):
+    corners = [[-1, -1, 0], [1, -1, 0], [1, 1, 0], [-1, 1, 0]]
+    pts, tris = mesh_gen.make_rect(n, n, corners)
+    centroids, rs = get_tri_centroids_rs(pts, tris)
+    best = np.inf
+    for i in range(n_runs):
+        start = time.time()
+        pairs = fast_find_nearfield.get_nearfield(
+            centroids, rs, centroids, rs, 2.0, leaf_size
+        )
+        best = min(best, time.time() - start)
+    print('{:8d} tris, leaf size {:3d}: {:.3f}s, {:.2e} pairs/s'.format(
+        tris.shape[0], leaf_size, best, pairs.shape[0] / best
+    ))
+
+if __name__ == '__main__':
+    print('leaf_filter_lanes =', fast_find_nearfield.leaf_filter_lanes)
+    for n in [100, 300, 1000]:
+        for leaf_size in [20, 50, 100]:
+            run(n, leaf_size)
@@ -0,0 +1,55 @@
+import os
+import sys
+import time
+import subprocess
+import numpy as np
+
+# Strong scaling of the nearfield query on a clustered mesh: a finely refined
+# fault inside coarse topography, so most of the close pairs come from a small
+# part of the domain. The thread count is fixed when OpenMP starts up, so each
+# measurement runs in its own process:
+#     python nearfield_query_scaling.py            runs the sweep
+#     python nearfield_query_scaling.py run        times one query
+
+thread_counts = [1, 2, 4, 8, 16, 32, 64]
+
+def refined_fault_mesh():
+    import tectosaur.mesh.mesh_gen as mesh_gen
+    from tectosaur.mesh.modify import concat
+    surf = mesh_gen.make_rect(100, 100, [
+        [-10, -10, 0], [-10, 10, 0], [10, 10, 0], [10, -10, 0]
+    ])
+    fault = mesh_gen.make_rect(800, 400, [
+        [-1, 0, 0], [-1, 0, -1], [1, 0, -1], [1, 0, 0]
+    ])
+    return concat(surf, fault)
+
+def run():
+    from tectosaur.mesh.find_near_adj import fast_find_nearfield, get_tri_centroids_rs
+
+    pts, tris = refined_fault_mesh()
+    centroids, rs = get_tri_centroids_rs(pts, tris)
+    fast_find_nearfield.get_nearfield(centroids, rs, centroids, rs, 2.0, 50)
+    start = time.time()
+    fast_find_nearfield.get_nearfield(centroids, rs, centroids, rs, 2.0, 50)
+    print(time.time() - start)
+
+def sweep():
+    base = None
+    for n_threads in thread_counts:
+        env = dict(os.environ, OMP_NUM_THREADS = str(n_threads))
+        out = subprocess.check_output(
+            [sys.executable, __file__, 'run'], env = env
+        )
+        runtime = float(out.decode().split()[-1])
+        if base is None:
+            base = runtime
+        print('{:3d} threads: {:.3f}s, speedup: {:.2f}'.format(
+            n_threads, runtime, base / runtime
+        ))
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1 and sys.argv[1] == 'run':
+        run()
+    else:
+        sweep()
@@ -0,0 +1,47 @@
+import os
+import sys
+import time
+import subprocess
+import numpy as np
+
+# Strong scaling of the dual tree traversal. The thread count is fixed when
+# OpenMP starts up, so each measurement runs in its own process:
+#     python traversal_scaling.py            runs the sweep
+#     python traversal_scaling.py run        times one traversal
+
+thread_counts = [1, 2, 4, 8, 16, 32, 64]
+
+def run():
+    from tectosaur.fmm.cfg import get_dim_module
+    module = get_dim_module(3).octree
+
+    n = 1000000
+    pts = np.random.rand(n, 3)
+    pts[:, 2] *= 0.01
+    Rs = np.full(n, 0.001)
+    tree = module.Tree.build_compact(pts, Rs, 50)
+
+    module.fmmmm_interactions(tree, tree, 1.0, 2.0, 0, True)
+    start = time.time()
+    module.fmmmm_interactions(tree, tree, 1.0, 2.0, 0, True)
+    print(time.time() - start)
+
+def sweep():
+    base = None
+    for n_threads in thread_counts:
+        env = dict(os.environ, OMP_NUM_THREADS = str(n_threads))
+        out = subprocess.check_output(
+            [sys.executable, __file__, 'run'], env = env
+        )
+        runtime = float(out.decode().split()[-1])
+        if base is None:
+            base = runtime
+        print('{:3d} threads: {:.3f}s, speedup: {:.2f}'.format(
+            n_threads, runtime, base / runtime
+        ))
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1 and sys.argv[1] == 'run':
+        run()
+    else:
+        sweep()
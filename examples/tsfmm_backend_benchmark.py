@@ -0,0 +1,43 @@
+import time
+import logging
+import numpy as np
+
+import tectosaur as tct
+import tectosaur.util.gpu as gpu
+from tectosaur.fmm.tsfmm import TSFMM
+
+tct.logger.setLevel(logging.INFO)
+
+# Compares the matrix-vector product time of the native C++ CPU backend of
+# TSFMM with the GPU backend. On a machine without a GPU, run this with pocl
+# as the OpenCL platform to compare the two CPU implementations.
+
+n = 200
+corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+m = tct.make_rect(n, n, corners)
+x = np.random.rand(m[1].shape[0] * 9)
+
+def timed(f):
+    start = time.time()
+    out = f()
+    return out, time.time() - start
+
+gpu_name = 'opencl' if gpu.ocl_backend else 'cuda'
+print('{} tris'.format(m[1].shape[0]))
+for K_name in ['elasticU3', 'elasticRT3', 'elasticRA3', 'elasticRH3']:
+    outs = []
+    for backend in ['gpu', 'cpu']:
+        fmm = TSFMM(
+            m, m, params = [1.0, 0.25], order = 4, quad_order = 2,
+            float_type = np.float32, K_name = K_name,
+            mac = 2.5, max_pts_per_cell = 80,
+            n_workers_per_block = 128, backend = backend
+        )
+        fmm.dot(x)
+        out, dot_time = timed(lambda: fmm.dot(x))
+        outs.append(out)
+        print('    {:<11s} {:<6s} matvec: {:.4f}s'.format(
+            K_name, gpu_name if backend == 'gpu' else 'cpu', dot_time
+        ))
+    diff = np.linalg.norm(outs[0] - outs[1]) / np.linalg.norm(outs[0])
+    print('    {:<11s} relative difference: {:.2e}'.format(K_name, diff))
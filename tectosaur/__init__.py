@@ -27,6 +27,7 @@ from tectosaur.ops.sparse_integral_op import RegularizedSparseIntegralOp
 from tectosaur.ops.sparse_farfield_op import (
     TriToTriDirectFarfieldOp,
     FMMFarfieldOp)
+from tectosaur.ops.fmm_tuning import tune_fmm, TunedFMMFarfieldOp
 from tectosaur.ops.dense_integral_op import RegularizedDenseIntegralOp
 from tectosaur.interior import InteriorOp
 
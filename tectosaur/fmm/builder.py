@@ -71,16 +71,11 @@ class FMM:
         gd['src_pts'] = self.float_gpu(src_m[0])
         gd['src_tris'] = self.int_gpu(src_m[1][self.src_tree.orig_idxs])
 
-        obs_tree_nodes = self.obs_tree.nodes
-        src_tree_nodes = self.src_tree.nodes
-
         for name, tree in [('src', self.src_tree), ('obs', self.obs_tree)]:
             gd[name + '_n_C'] = self.float_gpu(tree.node_centers)
             gd[name + '_n_R'] = self.float_gpu(tree.node_Rs)
-
-        for name, tree in [('src', src_tree_nodes), ('obs', obs_tree_nodes)]:
-            gd[name + '_n_start'] = self.int_gpu(np.array([n.start for n in tree]))
-            gd[name + '_n_end'] = self.int_gpu(np.array([n.end for n in tree]))
+            gd[name + '_n_start'] = self.int_gpu(tree.node_starts)
+            gd[name + '_n_end'] = self.int_gpu(tree.node_ends)
 
     def interactions_to_gpu(self):
         op_names = ['p2p', 'p2m', 'p2l', 'm2p', 'm2m', 'm2l', 'l2p', 'l2l']
@@ -111,16 +106,12 @@ class FMM:
             for level in range(len(self.interactions.l2l))
         ]
 
-        u2e_UT, u2e_E, u2e_V = build_c2e(
-            self.src_tree, self.cfg.outer_r, self.cfg.inner_r, self.cfg
-        )
+        u2e_UT, u2e_E, u2e_V = build_c2e(self.cfg.outer_r, self.cfg.inner_r, self.cfg)
         gd['u2e_V'] = self.float_gpu(u2e_V)
         gd['u2e_E'] = self.float_gpu(u2e_E)
         gd['u2e_UT'] = self.float_gpu(u2e_UT)
 
-        d2e_UT, d2e_E, d2e_V = build_c2e(
-            self.obs_tree, self.cfg.inner_r, self.cfg.outer_r, self.cfg
-        )
+        d2e_UT, d2e_E, d2e_V = build_c2e(self.cfg.inner_r, self.cfg.outer_r, self.cfg)
         gd['d2e_V'] = self.float_gpu(d2e_V)
         gd['d2e_E'] = self.float_gpu(d2e_E)
         gd['d2e_UT'] = self.float_gpu(d2e_UT)
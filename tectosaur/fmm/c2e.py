@@ -1,9 +1,7 @@
 import attr
 import numpy as np
-from multiprocessing import Pool
-import cloudpickle
 
-import tectosaur.util.gpu as gpu
+import tectosaur.util.disk_cache as disk_cache
 from tectosaur.mesh.modify import concat
 from tectosaur.ops.dense_integral_op import FarfieldTriMatrix
 from tectosaur.util.timer import Timer
@@ -25,11 +23,52 @@ def reg_lstsq_inverse(M, alpha):
     inv_eig = eig / (eig ** 2 + alpha ** 2)
     return (VT.T * inv_eig).dot(U.T)
 
-def caller(data):
-    f = cloudpickle.loads(data)
-    return f()
+# The singular values of the equivalent to check operator decay rapidly, so
+# the regularized inverse only needs the leading part of the SVD. The sketch
+# size is doubled until the smallest singular value it captures is below
+# rtol times the largest, falling back to the full SVD if the sketch would be
+# as large as the matrix. Singular values below rtol * the largest are dropped.
+def truncated_svd(M, rtol, start_rank = 64, n_oversample = 10, seed = 0):
+    rng = np.random.RandomState(seed)
+    n = min(M.shape)
+    rank = start_rank
+    while rank + n_oversample < n:
+        Y = M.dot(rng.randn(M.shape[1], rank + n_oversample))
+        Q, _ = np.linalg.qr(Y)
+        # One power iteration sharpens the captured subspace. Q is
+        # orthonormalized after each product: applying M M^T at once would
+        # square the spectrum and lose the directions with singular values
+        # below about sqrt(machine epsilon) times the largest, which is far
+        # above the rtol the operators are truncated at.
+        Q, _ = np.linalg.qr(M.T.dot(Q))
+        Q, _ = np.linalg.qr(M.dot(Q))
+        U_small, eig, VT = np.linalg.svd(Q.T.dot(M), full_matrices = False)
+        if eig[-1] < rtol * eig[0]:
+            U = Q.dot(U_small)
+            break
+        rank *= 2
+    else:
+        U, eig, VT = np.linalg.svd(M, full_matrices = False)
+    keep = eig >= rtol * eig[0]
+    return U[:, keep], eig[keep], VT[keep]
+
+def build_c2e(check_r, equiv_r, cfg, svd_rtol = 1e-13):
+    """
+    Returns (UT, E, V), the truncated SVD of the equivalent to check operator
+    for the unit sphere. The kernels are homogeneous, so c2e_kernel2 rescales
+    the singular values by R ** (scale_type + 4) for a node of radius R and
+    the same operator serves every level. The operator only depends on the
+    kernel, its parameters, the surface and the radii, so it's stored in the
+    disk cache and computed once.
+    """
+    key = disk_cache.hash_key(
+        cfg.K.name, cfg.params, cfg.surf[0], cfg.surf[1],
+        check_r, equiv_r, svd_rtol
+    )
+    arrays = disk_cache.load_arrays('c2e', key)
+    if arrays is not None:
+        return arrays['UT'], arrays['E'], arrays['V']
 
-def build_c2e(tree, check_r, equiv_r, cfg):
     t = Timer()
 
     assembler = FarfieldTriMatrix(cfg.K.name, cfg.params, 4, np.float64)
@@ -48,7 +87,9 @@ def build_c2e(tree, check_r, equiv_r, cfg):
     equiv_to_check = mat.reshape((nrows, ncols))
     t.report('build e2cs')
 
-    U, eig, VT = np.linalg.svd(equiv_to_check)
+    U, eig, VT = truncated_svd(equiv_to_check, svd_rtol)
     out = (U.T.copy(), eig.copy(), VT.T.copy())
     t.report('svd')
+
+    disk_cache.save_arrays('c2e', key, dict(UT = out[0], E = out[1], V = out[2]))
     return out
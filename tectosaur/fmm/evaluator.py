@@ -119,7 +119,8 @@ class FMMEvaluator:
         name = d_or_u + '2e'
         src_obs = 'obs' if d_or_u == 'd' else 'src'
         n_nodes = gd[name + '_obs_n_idxs'][level].shape[0]
-        n_c2e_rows = gd[name + '_UT'].shape[0]
+        n_c2e_rows = gd[name + '_V'].shape[0]
+        n_c2e_rank = gd[name + '_E'].shape[0]
 
         block_size = 16
         n_node_blocks = int(np.ceil(n_nodes / block_size))
@@ -128,7 +129,7 @@ class FMMEvaluator:
         self.call_kernel(
             name, op1,
             self.c2e_scratch, in_arr,
-            np.int32(n_nodes), np.int32(n_c2e_rows),
+            np.int32(n_nodes), np.int32(n_c2e_rows), np.int32(n_c2e_rank),
             gd[name + '_obs_n_idxs'][level], gd[name + '_UT'],
             grid = (n_node_blocks, n_c2e_row_blocks, 1),
             block = (block_size, block_size, 1)
@@ -137,7 +138,7 @@ class FMMEvaluator:
         self.call_kernel(
             name, op2,
             out_arr, self.c2e_scratch,
-            np.int32(n_nodes), np.int32(n_c2e_rows),
+            np.int32(n_nodes), np.int32(n_c2e_rows), np.int32(n_c2e_rank),
             gd[name + '_obs_n_idxs'][level], gd[src_obs + '_n_R'],
             np.float32(self.fmm.cfg.alpha),
             gd[name + '_V'], gd[name + '_E'],
@@ -2,18 +2,30 @@
 #include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <limits>
 
 template <size_t dim>
 KDTree<dim> build_kdtree(std::array<double,dim>* in_balls, double* in_R,
         size_t n_balls, size_t n_per_cell) 
+{
+    return build_kdtree_split(in_balls, in_R, n_balls, n_per_cell, KDSplit::center_of_mass);
+}
+
+template <size_t dim>
+KDTree<dim> build_kdtree_split(std::array<double,dim>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell, KDSplit split) 
 {
     auto balls_idxs = combine_balls_idxs(in_balls, in_R, n_balls);
     auto bounds = root_tree_bounds(balls_idxs.data(), n_balls);
 
-    KDTree<dim> out;
-    add_node(out, 0, n_balls, 0, n_per_cell, 0, bounds, balls_idxs);
+    std::vector<KDNode<dim>> nodes;
+    nodes.push_back({0, n_balls, bounds, n_balls <= n_per_cell, 0, 0, 0, {}, 0});
+    if (!nodes[0].is_leaf) {
+        add_children(nodes, 0, n_per_cell, split, balls_idxs);
+    }
 
-    out.max_height = out.nodes[0].height;
+    KDTree<dim> out;
+    set_nodes(out, std::move(nodes));
 
     out.balls.resize(n_balls);
     out.orig_idxs.resize(n_balls);
@@ -26,38 +38,157 @@ KDTree<dim> build_kdtree(std::array<double,dim>* in_balls, double* in_R,
 }
 
 template <size_t dim>
-size_t add_node(KDTree<dim>& tree, size_t start, size_t end, int split_dim, size_t n_per_cell,
-        int depth, Ball<dim> bounds, std::vector<BallWithIdx<dim>>& temp_balls) 
+int widest_dim(BallWithIdx<dim>* start, BallWithIdx<dim>* end) {
+    std::array<double,dim> min_c, max_c;
+    min_c.fill(std::numeric_limits<double>::max());
+    max_c.fill(std::numeric_limits<double>::lowest());
+    for (auto* b = start; b != end; b++) {
+        for (size_t d = 0; d < dim; d++) {
+            min_c[d] = std::min(min_c[d], b->ball.center[d]);
+            max_c[d] = std::max(max_c[d], b->ball.center[d]);
+        }
+    }
+    int out = 0;
+    for (size_t d = 1; d < dim; d++) {
+        if (max_c[d] - min_c[d] > max_c[out] - min_c[out]) {
+            out = d;
+        }
+    }
+    return out;
+}
+
+template <size_t dim>
+BallWithIdx<dim>* median_split(BallWithIdx<dim>* start, BallWithIdx<dim>* end,
+    int split_dim) 
+{
+    auto mid = start + (end - start) / 2;
+    std::nth_element(start, mid, end,
+        [&] (const BallWithIdx<dim>& a, const BallWithIdx<dim>& b) {
+            return a.ball.center[split_dim] < b.ball.center[split_dim];
+        }
+    );
+    return mid;
+}
+
+template <size_t dim>
+struct Box {
+    std::array<double,dim> min_c;
+    std::array<double,dim> max_c;
+
+    Box() {
+        min_c.fill(std::numeric_limits<double>::max());
+        max_c.fill(std::numeric_limits<double>::lowest());
+    }
+
+    void add(const Ball<dim>& b) {
+        for (size_t d = 0; d < dim; d++) {
+            min_c[d] = std::min(min_c[d], b.center[d] - b.R);
+            max_c[d] = std::max(max_c[d], b.center[d] + b.R);
+        }
+    }
+
+    double half_diag2() const {
+        double out = 0.0;
+        for (size_t d = 0; d < dim; d++) {
+            auto w = (max_c[d] - min_c[d]) / 2.0;
+            out += w * w;
+        }
+        return out;
+    }
+};
+
+template <size_t dim>
+BallWithIdx<dim>* cost_split(BallWithIdx<dim>* start, BallWithIdx<dim>* end) {
+    int split_dim = widest_dim(start, end);
+    std::sort(start, end,
+        [&] (const BallWithIdx<dim>& a, const BallWithIdx<dim>& b) {
+            return a.ball.center[split_dim] < b.ball.center[split_dim];
+        }
+    );
+
+    size_t n = end - start;
+    std::vector<double> right_cost(n + 1, 0.0);
+    Box<dim> right_box;
+    for (size_t i = n - 1; i >= 1; i--) {
+        right_box.add(start[i].ball);
+        right_cost[i] = (n - i) * right_box.half_diag2();
+    }
+
+    size_t best = n / 2;
+    double best_cost = std::numeric_limits<double>::max();
+    Box<dim> left_box;
+    for (size_t i = 1; i < n; i++) {
+        left_box.add(start[i - 1].ball);
+        auto cost = i * left_box.half_diag2() + right_cost[i];
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = i;
+        }
+    }
+    return start + best;
+}
+
+template <size_t dim>
+BallWithIdx<dim>* kd_split(const KDNode<dim>& parent, KDSplit split,
+    BallWithIdx<dim>* start, BallWithIdx<dim>* end)
 {
-    bool is_leaf = end - start <= n_per_cell; 
-    auto n_idx = tree.nodes.size();
-    tree.nodes.push_back({start, end, bounds, is_leaf, 0, depth, n_idx, {}});
-    if (!is_leaf) {
-        auto split_pt = std::partition(
-            temp_balls.data() + start, temp_balls.data() + end,
-            [&] (const BallWithIdx<dim>& v) {
-                return v.ball.center[split_dim] < bounds.center[split_dim]; 
-            }
-        );
-        auto split_idx = static_cast<size_t>(split_pt - temp_balls.data());
-        std::array<size_t,3> splits = {start, split_idx, end};
-
-        int max_child_height = 0;
-        for (size_t which_half = 0; which_half < 2; which_half++) {
-            auto child_start = splits[which_half];
-            auto child_end = splits[which_half + 1];
-            auto child_n_balls = child_end - child_start;
-            auto child_bounds = child_tree_bounds(&temp_balls[child_start], child_n_balls, bounds);
-            auto child_node_idx = add_node(
-                tree, child_start, child_end, (split_dim + 1) % dim,
-                n_per_cell, depth + 1, child_bounds, temp_balls
+    switch (split) {
+        case KDSplit::median:
+            return median_split(start, end, parent.depth % dim);
+        case KDSplit::widest:
+            return median_split(start, end, widest_dim(start, end));
+        case KDSplit::cost:
+            return cost_split(start, end);
+        case KDSplit::center_of_mass:
+        default: {
+            int split_dim = parent.depth % dim;
+            return std::partition(start, end,
+                [&] (const BallWithIdx<dim>& v) {
+                    return v.ball.center[split_dim] < parent.bounds.center[split_dim]; 
+                }
             );
-            tree.nodes[n_idx].children[which_half] = child_node_idx;
-            max_child_height = std::max(max_child_height, tree.nodes[child_node_idx].height);
         }
-        tree.nodes[n_idx].height = max_child_height + 1;
     }
-    return n_idx;
+}
+
+// Both children of a node are created together so that they are stored
+// contiguously.
+template <size_t dim>
+void add_children(std::vector<KDNode<dim>>& nodes, size_t n_idx, size_t n_per_cell,
+        KDSplit split, std::vector<BallWithIdx<dim>>& temp_balls) 
+{
+    auto parent = nodes[n_idx];
+    auto split_pt = kd_split(
+        parent, split, temp_balls.data() + parent.start, temp_balls.data() + parent.end
+    );
+    auto split_idx = static_cast<size_t>(split_pt - temp_balls.data());
+    std::array<size_t,3> splits = {parent.start, split_idx, parent.end};
+
+    auto first_child = nodes.size();
+    for (size_t which_half = 0; which_half < 2; which_half++) {
+        auto child_start = splits[which_half];
+        auto child_end = splits[which_half + 1];
+        auto child_n_balls = child_end - child_start;
+        auto child_bounds = child_tree_bounds(&temp_balls[child_start], child_n_balls, parent.bounds);
+        bool child_is_leaf = child_n_balls <= n_per_cell;
+        auto child_idx = first_child + which_half;
+        nodes.push_back({
+            child_start, child_end, child_bounds, child_is_leaf,
+            0, parent.depth + 1, child_idx, {}, 0
+        });
+        nodes[n_idx].children[which_half] = child_idx;
+    }
+    nodes[n_idx].n_children = 2;
+
+    int max_child_height = 0;
+    for (size_t which_half = 0; which_half < 2; which_half++) {
+        auto child_idx = first_child + which_half;
+        if (!nodes[child_idx].is_leaf) {
+            add_children(nodes, child_idx, n_per_cell, split, temp_balls);
+        }
+        max_child_height = std::max(max_child_height, nodes[child_idx].height);
+    }
+    nodes[n_idx].height = max_child_height + 1;
 }
 
 template struct KDTree<2>;
@@ -66,3 +197,7 @@ template KDTree<2> build_kdtree(std::array<double,2>* in_balls, double* in_R,
         size_t n_balls, size_t n_per_cell);
 template KDTree<3> build_kdtree(std::array<double,3>* in_balls, double* in_R,
         size_t n_balls, size_t n_per_cell);
+template KDTree<2> build_kdtree_split(std::array<double,2>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell, KDSplit split);
+template KDTree<3> build_kdtree_split(std::array<double,3>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell, KDSplit split);
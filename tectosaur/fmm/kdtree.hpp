@@ -4,6 +4,8 @@
 #include <vector>
 #include "tree_helpers.hpp"
 
+// The node type used while building. A finished tree stores its nodes in
+// NodeArrays.
 template <size_t dim>
 struct KDNode {
     size_t start;
@@ -13,13 +15,35 @@ struct KDNode {
     int height;
     int depth;
     size_t idx;
+    // Only the first n_children entries are used. They are always contiguous
+    // node indices starting at children[0].
     std::array<size_t,2> children;
+    size_t n_children;
 };
 
 template <size_t dim>
 std::array<int,2> kd_partition(const Ball<dim>& bounds, int split_dim,
     BallWithIdx<dim>* start, BallWithIdx<dim>* end);
 
+// How the balls of a node are divided between its two children.
+enum class KDSplit {
+    // Cycle through the dimensions and split at the center of mass.
+    center_of_mass,
+    // Cycle through the dimensions and split at the median ball, so that the
+    // tree is balanced.
+    median,
+    // Split at the median ball along the dimension in which the ball centers
+    // are most spread out.
+    widest,
+    // Along the widest dimension, choose the split that minimizes
+    // n_left * R_left^2 + n_right * R_right^2, where R is the half diagonal of
+    // a child's bounding box. For balls spread over a surface, the number of
+    // nodes close enough to need direct p2p interactions with a child grows
+    // with its area, so this estimates the p2p work that the split leaves
+    // behind.
+    cost
+};
+
 template <size_t dim>
 struct KDTree;
 
@@ -27,18 +51,23 @@ template <size_t dim>
 KDTree<dim> build_kdtree(std::array<double,dim>* in_pts, double* in_R,
     size_t n_balls, size_t n_per_cell);
 
+template <size_t dim>
+KDTree<dim> build_kdtree_split(std::array<double,dim>* in_pts, double* in_R,
+    size_t n_balls, size_t n_per_cell, KDSplit split);
+
 template <size_t _dim>
 struct KDTree {
     constexpr static size_t dim = _dim;
     constexpr static size_t split = 2;
     constexpr static auto build_fnc = build_kdtree<dim>;
-    using Node = KDNode<dim>;
+    using Node = TreeNode<dim>;
 
     std::vector<Ball<dim>> balls;
     std::vector<size_t> orig_idxs;
 
     int max_height;
-    std::vector<KDNode<dim>> nodes;
+    NodeArrays<dim> nodes;
 
-    const KDNode<dim>& root() const { return nodes.front(); }
+    Node node(size_t i) const { return get_node(nodes, i); }
+    Node root() const { return node(0); }
 };
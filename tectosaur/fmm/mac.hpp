@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "tree_helpers.hpp"
+
+// Multipole acceptance criteria (MACs) decide which pairs of nodes the
+// traversal approximates. Nodes are given as the node arrays of their tree
+// and an index. A MAC policy provides:
+//   accept(obs, obs_n, src, src_n): whether the interaction between the
+//       nodes can be approximated.
+//   accept_ball(obs_b, src, src_n): whether a single obs ball is far enough
+//       from src_n for an m2p interaction. interactions_valid uses this to
+//       check m2p lists, which are stored for the obs leaves below the
+//       accepted node. It must hold for every ball of an obs node that passes
+//       accept.
+//   split_src(obs, obs_n, src, src_n): whether to split the src node instead
+//       of the obs node when the pair isn't accepted. Called only if at least
+//       one of the two nodes has children.
+// The policies are templated on the tree type so that each tree module gets
+// its own Python classes.
+
+// By default, split the larger node.
+struct SplitLarger {
+    template <size_t dim>
+    bool split_src(const NodeArrays<dim>& obs, size_t obs_n,
+        const NodeArrays<dim>& src, size_t src_n) const
+    {
+        return ((obs.Rs[obs_n] < src.Rs[src_n]) && !src.is_leaf(src_n)) || obs.is_leaf(obs_n);
+    }
+};
+
+// If outer_r * r_src + inner_r * r_obs is less than the separation, then
+// the relevant check surfaces for the two interacting cells don't
+// intersect.
+// That means it should be safe to perform approximate interactions. I add
+// a small safety factor just in case!
+template <size_t dim>
+bool well_separated(const Ball<dim>& obs_b, const Ball<dim>& src_b,
+    double inner_r, double outer_r)
+{
+    double safety_factor = 0.98;
+    auto sep = hypot(sub(obs_b.center, src_b.center));
+    return outer_r * src_b.R + inner_r * obs_b.R < safety_factor * sep;
+}
+
+template <typename TreeT>
+struct BallMAC: public SplitLarger {
+    using Nodes = NodeArrays<TreeT::dim>;
+    using BallT = Ball<TreeT::dim>;
+
+    double inner_r;
+    double outer_r;
+
+    BallMAC(double inner_r, double outer_r): inner_r(inner_r), outer_r(outer_r) {}
+
+    bool accept(const Nodes& obs, size_t obs_n, const Nodes& src, size_t src_n) const {
+        return well_separated(obs.bounds(obs_n), src.bounds(src_n), inner_r, outer_r);
+    }
+
+    // With inner_r >= 1, this holds for every ball inside an accepted obs node.
+    bool accept_ball(const BallT& obs_b, const Nodes& src, size_t src_n) const {
+        auto sep = hypot(sub(obs_b.center, src.centers[src_n]));
+        return outer_r * src.Rs[src_n] < sep - obs_b.R;
+    }
+};
+
+template <size_t dim>
+struct AABB {
+    std::array<double,dim> min;
+    std::array<double,dim> max;
+};
+
+template <size_t dim>
+double dist_to_box(const std::array<double,dim>& pt, const AABB<dim>& box) {
+    double out = 0;
+    for (size_t d = 0; d < dim; d++) {
+        double gap = std::max({box.min[d] - pt[d], pt[d] - box.max[d], 0.0});
+        out += gap * gap;
+    }
+    return std::sqrt(out);
+}
+
+// The axis aligned bounding box of the balls of every node. Empty nodes get
+// an inverted box, which is infinitely far from every point.
+template <typename TreeT>
+std::vector<AABB<TreeT::dim>> node_boxes(const TreeT& tree) {
+    constexpr size_t dim = TreeT::dim;
+    const double inf = std::numeric_limits<double>::infinity();
+    AABB<dim> empty;
+    empty.min.fill(inf);
+    empty.max.fill(-inf);
+    auto& nodes = tree.nodes;
+    std::vector<AABB<dim>> out(nodes.size(), empty);
+
+    // Children always come after their parent.
+    for (size_t n = nodes.size(); n-- > 0;) {
+        auto& box = out[n];
+        if (nodes.is_leaf(n)) {
+            for (size_t j = nodes.starts[n]; j < nodes.ends[n]; j++) {
+                auto& b = tree.balls[j];
+                for (size_t d = 0; d < dim; d++) {
+                    box.min[d] = std::min(box.min[d], b.center[d] - b.R);
+                    box.max[d] = std::max(box.max[d], b.center[d] + b.R);
+                }
+            }
+        } else {
+            for (size_t c = 0; c < nodes.n_children[n]; c++) {
+                auto& child = out[nodes.first_child[n] + c];
+                for (size_t d = 0; d < dim; d++) {
+                    box.min[d] = std::min(box.min[d], child.min[d]);
+                    box.max[d] = std::max(box.max[d], child.max[d]);
+                }
+            }
+        }
+    }
+    return out;
+}
+
+// The same check surfaces as BallMAC, but they only need to avoid the
+// bounding box of the other node's balls rather than its bounding sphere.
+// The node spheres of an octree are much larger than their contents when the
+// balls lie on a surface, so this accepts many more pairs. The boxes are
+// computed on construction, so the MAC must be rebuilt after a refit.
+template <typename TreeT>
+struct BoxMAC: public SplitLarger {
+    using Nodes = NodeArrays<TreeT::dim>;
+    using BallT = Ball<TreeT::dim>;
+
+    std::vector<AABB<TreeT::dim>> obs_boxes;
+    std::vector<AABB<TreeT::dim>> src_boxes;
+    double inner_r;
+    double outer_r;
+
+    BoxMAC(const TreeT& obs_tree, const TreeT& src_tree,
+            double inner_r, double outer_r):
+        obs_boxes(node_boxes(obs_tree)),
+        src_boxes(node_boxes(src_tree)),
+        inner_r(inner_r),
+        outer_r(outer_r)
+    {}
+
+    bool accept(const Nodes& obs, size_t obs_n, const Nodes& src, size_t src_n) const {
+        double safety_factor = 0.98;
+        auto obs_sep = dist_to_box(src.centers[src_n], obs_boxes[obs_n]);
+        auto src_sep = dist_to_box(obs.centers[obs_n], src_boxes[src_n]);
+        return outer_r * src.Rs[src_n] < safety_factor * obs_sep
+            && inner_r * obs.Rs[obs_n] < safety_factor * src_sep;
+    }
+
+    // Every obs ball is inside the obs box, so it's at least as far from the
+    // src center as the box.
+    bool accept_ball(const BallT& obs_b, const Nodes& src, size_t src_n) const {
+        auto sep = hypot(sub(obs_b.center, src.centers[src_n]));
+        return outer_r * src.Rs[src_n] < sep - obs_b.R;
+    }
+};
+
+// The Barnes-Hut opening criterion in its dual tree form: the pair is
+// accepted if the sum of the node radii is less than theta times the
+// distance between the node centers. Smaller theta is more accurate.
+template <typename TreeT>
+struct ThetaMAC: public SplitLarger {
+    using Nodes = NodeArrays<TreeT::dim>;
+    using BallT = Ball<TreeT::dim>;
+
+    double theta;
+
+    ThetaMAC(double theta): theta(theta) {}
+
+    bool accept(const Nodes& obs, size_t obs_n, const Nodes& src, size_t src_n) const {
+        auto sep = hypot(sub(obs.centers[obs_n], src.centers[src_n]));
+        return obs.Rs[obs_n] + src.Rs[src_n] < theta * sep;
+    }
+
+    // For theta <= 1, this holds for every ball inside an accepted obs node.
+    bool accept_ball(const BallT& obs_b, const Nodes& src, size_t src_n) const {
+        auto sep = hypot(sub(obs_b.center, src.centers[src_n]));
+        return obs_b.R + src.Rs[src_n] < theta * sep;
+    }
+};
+
+// Accepts a pair if the standard truncation bound for an order p expansion
+// of a 1/r potential,
+//     M / (sep - R_obs - R_src) * ((R_obs + R_src) / sep)^(p + 1),
+// is less than tol relative to the potential of all of the sources at the
+// radius of the src tree. M is the source moment magnitude of the src node.
+// The source densities aren't known when the traversal runs, so M is the sum
+// of R^2 over the node's balls, proportional to the area of the triangles
+// they bound. The moments are computed on construction, so the MAC must be
+// rebuilt after a refit.
+template <typename TreeT>
+struct ErrorMAC: public SplitLarger {
+    using Nodes = NodeArrays<TreeT::dim>;
+    using BallT = Ball<TreeT::dim>;
+
+    std::vector<double> src_moments;
+    size_t order;
+    double tol;
+    double scale;
+
+    ErrorMAC(const TreeT& /*obs_tree*/, const TreeT& src_tree, size_t order, double tol):
+        src_moments(src_tree.nodes.size(), 0.0),
+        order(order),
+        tol(tol)
+    {
+        auto& nodes = src_tree.nodes;
+        // Children always come after their parent.
+        for (size_t n = nodes.size(); n-- > 0;) {
+            double M = 0;
+            if (nodes.is_leaf(n)) {
+                for (size_t j = nodes.starts[n]; j < nodes.ends[n]; j++) {
+                    M += src_tree.balls[j].R * src_tree.balls[j].R;
+                }
+            } else {
+                for (size_t c = 0; c < nodes.n_children[n]; c++) {
+                    M += src_moments[nodes.first_child[n] + c];
+                }
+            }
+            src_moments[n] = M;
+        }
+        scale = src_moments[0] / nodes.Rs[0];
+    }
+
+    bool accept_radii(double obs_R, const Nodes& src, size_t src_n, double sep) const {
+        double R = obs_R + src.Rs[src_n];
+        if (R >= sep) {
+            return false;
+        }
+        double err = src_moments[src_n] / (sep - R) * std::pow(R / sep, order + 1);
+        return err < tol * scale;
+    }
+
+    bool accept(const Nodes& obs, size_t obs_n, const Nodes& src, size_t src_n) const {
+        auto sep = hypot(sub(obs.centers[obs_n], src.centers[src_n]));
+        return accept_radii(obs.Rs[obs_n], src, src_n, sep);
+    }
+
+    // The bound only shrinks for a smaller obs ball inside the obs node.
+    bool accept_ball(const BallT& obs_b, const Nodes& src, size_t src_n) const {
+        auto sep = hypot(sub(obs_b.center, src.centers[src_n]));
+        return accept_radii(obs_b.R, src, src_n, sep);
+    }
+};
@@ -1,4 +1,7 @@
 #include "octree.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 
 template <size_t dim>
 std::array<int,OctreeNode<dim>::split+1> octree_partition(
@@ -23,6 +26,30 @@ std::array<int,OctreeNode<dim>::split+1> octree_partition(
     return splits;
 }
 
+// A stable counting sort into a caller-provided scratch buffer. The output
+// ordering is identical to octree_partition, but nothing is allocated.
+template <size_t dim>
+std::array<int,OctreeNode<dim>::split+1> octree_partition_inplace(
+        const Ball<dim>& bounds, BallWithIdx<dim>* start, BallWithIdx<dim>* end,
+        BallWithIdx<dim>* scratch)
+{
+    std::array<int,OctreeNode<dim>::split+1> splits{};
+    for (auto* entry = start; entry < end; entry++) {
+        splits[find_containing_subcell(bounds, entry->ball.center) + 1]++;
+    }
+    for (size_t subcell_idx = 0; subcell_idx < OctreeNode<dim>::split; subcell_idx++) {
+        splits[subcell_idx + 1] += splits[subcell_idx];
+    }
+
+    auto next = splits;
+    for (auto* entry = start; entry < end; entry++) {
+        scratch[next[find_containing_subcell(bounds, entry->ball.center)]++] = *entry;
+    }
+    std::copy(scratch, scratch + (end - start), start);
+
+    return splits;
+}
+
 
 template <size_t dim>
 Octree<dim> build_octree(std::array<double,dim>* in_balls, double* in_R,
@@ -32,10 +59,14 @@ Octree<dim> build_octree(std::array<double,dim>* in_balls, double* in_R,
 
     auto bounds = root_tree_bounds(balls_idxs.data(), n_balls);
 
-    Octree<dim> out;
-    add_node(out, 0, n_balls, n_per_cell, 0, bounds, balls_idxs);
+    std::vector<OctreeNode<dim>> nodes;
+    nodes.push_back({0, n_balls, bounds, n_balls <= n_per_cell, 0, 0, 0, {}, 0});
+    if (!nodes[0].is_leaf) {
+        add_children(nodes, 0, n_per_cell, balls_idxs);
+    }
 
-    out.max_height = out.nodes[0].height;
+    Octree<dim> out;
+    set_nodes(out, std::move(nodes));
 
     out.balls.resize(n_balls);
     out.orig_idxs.resize(n_balls);
@@ -47,32 +78,348 @@ Octree<dim> build_octree(std::array<double,dim>* in_balls, double* in_R,
     return out;
 }
 
+// All the children of a node are created together so that they are stored
+// contiguously, starting at children[0]. Then, each child is split in turn.
 template <size_t dim>
-size_t add_node(Octree<dim>& tree, size_t start, size_t end, 
-    size_t n_per_cell, int depth, Ball<dim> bounds,
+void add_children(std::vector<OctreeNode<dim>>& nodes, size_t n_idx, size_t n_per_cell,
     std::vector<BallWithIdx<dim>>& temp_balls)
 {
-    bool is_leaf = end - start <= n_per_cell; 
-    auto n_idx = tree.nodes.size();
-    tree.nodes.push_back({start, end, bounds, is_leaf, 0, depth, n_idx, {}});
-    if (!is_leaf) {
-        auto splits = octree_partition(bounds, temp_balls.data() + start, temp_balls.data() + end);
-        int max_child_height = 0;
-        for (size_t octant = 0; octant < OctreeNode<dim>::split; octant++) {
-            auto child_start = start + splits[octant];
-            auto child_end = start + splits[octant + 1];
-            auto child_n_balls = child_end - child_start;
-            auto child_bounds = child_tree_bounds(&temp_balls[child_start], child_n_balls, bounds);
-            auto child_node_idx = add_node(
-                tree, child_start, child_end,
-                n_per_cell, depth + 1, child_bounds, temp_balls
-            );
-            tree.nodes[n_idx].children[octant] = child_node_idx;
-            max_child_height = std::max(max_child_height, tree.nodes[child_node_idx].height);
+    auto parent = nodes[n_idx];
+    auto splits = octree_partition(
+        parent.bounds, temp_balls.data() + parent.start, temp_balls.data() + parent.end
+    );
+
+    auto first_child = nodes.size();
+    for (size_t octant = 0; octant < OctreeNode<dim>::split; octant++) {
+        auto child_start = parent.start + splits[octant];
+        auto child_end = parent.start + splits[octant + 1];
+        auto child_n_balls = child_end - child_start;
+        auto child_bounds = child_tree_bounds(&temp_balls[child_start], child_n_balls, parent.bounds);
+        bool child_is_leaf = child_n_balls <= n_per_cell;
+        auto child_idx = first_child + octant;
+        nodes.push_back({
+            child_start, child_end, child_bounds, child_is_leaf,
+            0, parent.depth + 1, child_idx, {}, 0
+        });
+        nodes[n_idx].children[octant] = child_idx;
+    }
+    nodes[n_idx].n_children = OctreeNode<dim>::split;
+
+    int max_child_height = 0;
+    for (size_t octant = 0; octant < OctreeNode<dim>::split; octant++) {
+        auto child_idx = first_child + octant;
+        if (!nodes[child_idx].is_leaf) {
+            add_children(nodes, child_idx, n_per_cell, temp_balls);
+        }
+        max_child_height = std::max(max_child_height, nodes[child_idx].height);
+    }
+    nodes[n_idx].height = max_child_height + 1;
+}
+
+// Nodes with fewer balls than this build their whole subtree serially.
+constexpr size_t octree_task_min_balls = 4096;
+
+// With compact = true, children that contain no balls are not created, so
+// a node may have anywhere from 1 to split children.
+template <size_t dim>
+void add_children_parallel(std::vector<OctreeNode<dim>>& nodes, size_t n_idx,
+    size_t n_per_cell, bool compact, BallWithIdx<dim>* balls, BallWithIdx<dim>* scratch)
+{
+    constexpr size_t split = OctreeNode<dim>::split;
+
+    auto parent = nodes[n_idx];
+    auto splits = octree_partition_inplace(
+        parent.bounds, balls + parent.start, balls + parent.end, scratch + parent.start
+    );
+
+    auto first_child = nodes.size();
+    size_t n_children = 0;
+    for (size_t octant = 0; octant < split; octant++) {
+        auto child_start = parent.start + splits[octant];
+        auto child_end = parent.start + splits[octant + 1];
+        auto child_n_balls = child_end - child_start;
+        if (compact && child_n_balls == 0) {
+            continue;
+        }
+        auto child_bounds = child_tree_bounds(balls + child_start, child_n_balls, parent.bounds);
+        bool child_is_leaf = child_n_balls <= n_per_cell;
+        auto child_idx = first_child + n_children;
+        nodes.push_back({
+            child_start, child_end, child_bounds, child_is_leaf,
+            0, parent.depth + 1, child_idx, {}, 0
+        });
+        nodes[n_idx].children[n_children] = child_idx;
+        n_children++;
+    }
+    nodes[n_idx].n_children = n_children;
+
+    int max_child_height = 0;
+    if (parent.end - parent.start < octree_task_min_balls) {
+        for (size_t c = 0; c < n_children; c++) {
+            auto child_idx = first_child + c;
+            if (!nodes[child_idx].is_leaf) {
+                add_children_parallel(nodes, child_idx, n_per_cell, compact, balls, scratch);
+            }
+            max_child_height = std::max(max_child_height, nodes[child_idx].height);
+        }
+    } else {
+        // The descendants of each child are built as a separate task into
+        // their own node list, with the child itself at local index 0. The
+        // subtrees are then spliced in child order, which gives the same
+        // node ordering as add_children.
+        std::array<std::vector<OctreeNode<dim>>,split> subtrees;
+        for (size_t c = 0; c < n_children; c++) {
+            auto child = nodes[first_child + c];
+            if (child.is_leaf) {
+                continue;
+            }
+#pragma omp task shared(subtrees) firstprivate(child)
+            {
+                child.idx = 0;
+                subtrees[c].push_back(child);
+                add_children_parallel(subtrees[c], 0, n_per_cell, compact, balls, scratch);
+            }
+        }
+#pragma omp taskwait
+
+        for (size_t c = 0; c < n_children; c++) {
+            auto child_idx = first_child + c;
+            auto& subtree = subtrees[c];
+            if (subtree.size() > 0) {
+                auto offset = nodes.size() - 1;
+                auto to_global = [&] (size_t local_idx) {
+                    return (local_idx == 0) ? child_idx : offset + local_idx;
+                };
+                for (size_t local_idx = 1; local_idx < subtree.size(); local_idx++) {
+                    auto n = subtree[local_idx];
+                    n.idx = to_global(local_idx);
+                    for (size_t i = 0; i < n.n_children; i++) {
+                        n.children[i] = to_global(n.children[i]);
+                    }
+                    nodes.push_back(n);
+                }
+                nodes[child_idx].height = subtree[0].height;
+                nodes[child_idx].n_children = subtree[0].n_children;
+                for (size_t i = 0; i < subtree[0].n_children; i++) {
+                    nodes[child_idx].children[i] = to_global(subtree[0].children[i]);
+                }
+            }
+            max_child_height = std::max(max_child_height, nodes[child_idx].height);
+        }
+    }
+    nodes[n_idx].height = max_child_height + 1;
+}
+
+template <size_t dim>
+Octree<dim> build_octree_parallel_helper(std::array<double,dim>* in_balls, double* in_R,
+    size_t n_balls, size_t n_per_cell, bool compact) 
+{
+    auto balls_idxs = combine_balls_idxs(in_balls, in_R, n_balls);
+    std::vector<BallWithIdx<dim>> scratch(n_balls);
+
+    auto bounds = root_tree_bounds(balls_idxs.data(), n_balls);
+
+    std::vector<OctreeNode<dim>> nodes;
+    nodes.push_back({0, n_balls, bounds, n_balls <= n_per_cell, 0, 0, 0, {}, 0});
+    if (!nodes[0].is_leaf) {
+#pragma omp parallel
+#pragma omp single
+        add_children_parallel(
+            nodes, 0, n_per_cell, compact, balls_idxs.data(), scratch.data()
+        );
+    }
+
+    Octree<dim> out;
+    set_nodes(out, std::move(nodes));
+
+    out.balls.resize(n_balls);
+    out.orig_idxs.resize(n_balls);
+#pragma omp parallel for
+    for (size_t i = 0; i < n_balls; i++) {
+        out.balls[i] = balls_idxs[i].ball;
+        out.orig_idxs[i] = balls_idxs[i].orig_idx;
+    }
+
+    return out;
+}
+
+template <size_t dim>
+Octree<dim> build_octree_parallel(std::array<double,dim>* in_balls, double* in_R,
+    size_t n_balls, size_t n_per_cell) 
+{
+    return build_octree_parallel_helper(in_balls, in_R, n_balls, n_per_cell, false);
+}
+
+template <size_t dim>
+Octree<dim> build_octree_compact(std::array<double,dim>* in_balls, double* in_R,
+    size_t n_balls, size_t n_per_cell) 
+{
+    return build_octree_parallel_helper(in_balls, in_R, n_balls, n_per_cell, true);
+}
+
+// The number of bits of each quantized coordinate. All dim coordinates are
+// interleaved into a single 64 bit Morton key.
+template <size_t dim>
+constexpr int morton_bits() { return 63 / dim; }
+
+template <size_t dim>
+uint64_t morton_key(const std::array<double,dim>& pt,
+    const std::array<double,dim>& box_min, double box_width)
+{
+    constexpr int bits = morton_bits<dim>();
+    constexpr uint64_t max_q = (uint64_t(1) << bits) - 1;
+    std::array<uint64_t,dim> q;
+    for (size_t d = 0; d < dim; d++) {
+        double scaled = (pt[d] - box_min[d]) / box_width * static_cast<double>(max_q + 1);
+        q[d] = std::min(max_q, static_cast<uint64_t>(std::max(0.0, scaled)));
+    }
+    // Dimension 0 is the most significant bit in each group of dim bits, the
+    // same convention used by find_containing_subcell.
+    uint64_t key = 0;
+    for (int b = bits - 1; b >= 0; b--) {
+        for (size_t d = 0; d < dim; d++) {
+            key = (key << 1) | ((q[d] >> b) & 1);
+        }
+    }
+    return key;
+}
+
+template <size_t dim>
+struct KeyedBall {
+    uint64_t key;
+    BallWithIdx<dim> ball;
+};
+
+// Least significant digit radix sort, 8 bits per pass. Each pass is a stable
+// counting sort, so the whole sort is O(n_bits / 8 * N).
+template <size_t dim>
+void radix_sort_by_key(std::vector<KeyedBall<dim>>& entries) {
+    constexpr int digit_bits = 8;
+    constexpr size_t n_buckets = 1 << digit_bits;
+    constexpr int n_passes = (morton_bits<dim>() * dim + digit_bits - 1) / digit_bits;
+
+    std::vector<KeyedBall<dim>> scratch(entries.size());
+    for (int pass = 0; pass < n_passes; pass++) {
+        int shift = pass * digit_bits;
+        std::array<size_t,n_buckets + 1> offsets{};
+        for (auto& e: entries) {
+            offsets[((e.key >> shift) & (n_buckets - 1)) + 1]++;
+        }
+        for (size_t i = 0; i < n_buckets; i++) {
+            offsets[i + 1] += offsets[i];
+        }
+        for (auto& e: entries) {
+            scratch[offsets[(e.key >> shift) & (n_buckets - 1)]++] = e;
+        }
+        std::swap(entries, scratch);
+    }
+}
+
+template <size_t dim>
+void add_children_morton(std::vector<OctreeNode<dim>>& nodes, size_t n_idx, size_t n_per_cell,
+    const std::vector<uint64_t>& keys, std::vector<BallWithIdx<dim>>& temp_balls)
+{
+    constexpr int bits = morton_bits<dim>();
+    constexpr size_t split = OctreeNode<dim>::split;
+
+    auto parent = nodes[n_idx];
+
+    // All the keys in this node share their leading depth * dim bits, so
+    // the next dim bits are sorted and identify the octant.
+    int shift = (bits - 1 - parent.depth) * dim;
+    auto first_child = nodes.size();
+    auto child_start = parent.start;
+    for (size_t octant = 0; octant < split; octant++) {
+        auto child_end = static_cast<size_t>(std::partition_point(
+            keys.begin() + child_start, keys.begin() + parent.end,
+            [&] (uint64_t k) { return ((k >> shift) & (split - 1)) <= octant; }
+        ) - keys.begin());
+        auto child_n_balls = child_end - child_start;
+        auto child_bounds = child_tree_bounds(&temp_balls[child_start], child_n_balls, parent.bounds);
+        // Once all the key bits are used up, the remaining balls share a grid
+        // cell and can't be separated any further.
+        bool child_is_leaf = child_n_balls <= n_per_cell || parent.depth + 1 >= bits;
+        auto child_idx = first_child + octant;
+        nodes.push_back({
+            child_start, child_end, child_bounds, child_is_leaf,
+            0, parent.depth + 1, child_idx, {}, 0
+        });
+        nodes[n_idx].children[octant] = child_idx;
+        child_start = child_end;
+    }
+    nodes[n_idx].n_children = split;
+
+    int max_child_height = 0;
+    for (size_t octant = 0; octant < split; octant++) {
+        auto child_idx = first_child + octant;
+        if (!nodes[child_idx].is_leaf) {
+            add_children_morton(nodes, child_idx, n_per_cell, keys, temp_balls);
+        }
+        max_child_height = std::max(max_child_height, nodes[child_idx].height);
+    }
+    nodes[n_idx].height = max_child_height + 1;
+}
+
+template <size_t dim>
+Octree<dim> build_octree_morton(std::array<double,dim>* in_balls, double* in_R,
+    size_t n_balls, size_t n_per_cell) 
+{
+    std::array<double,dim> box_min;
+    std::array<double,dim> box_max;
+    for (size_t d = 0; d < dim; d++) {
+        box_min[d] = std::numeric_limits<double>::max();
+        box_max[d] = std::numeric_limits<double>::lowest();
+    }
+    for (size_t i = 0; i < n_balls; i++) {
+        for (size_t d = 0; d < dim; d++) {
+            box_min[d] = std::min(box_min[d], in_balls[i][d]);
+            box_max[d] = std::max(box_max[d], in_balls[i][d]);
         }
-        tree.nodes[n_idx].height = max_child_height + 1;
     }
-    return n_idx;
+    double box_width = 0.0;
+    for (size_t d = 0; d < dim; d++) {
+        box_width = std::max(box_width, box_max[d] - box_min[d]);
+    }
+    if (box_width == 0.0) {
+        box_width = 1.0;
+    }
+
+    std::vector<KeyedBall<dim>> keyed(n_balls);
+#pragma omp parallel for
+    for (size_t i = 0; i < n_balls; i++) {
+        keyed[i] = {
+            morton_key(in_balls[i], box_min, box_width),
+            {{in_balls[i], in_R[i]}, i}
+        };
+    }
+    radix_sort_by_key(keyed);
+
+    std::vector<uint64_t> keys(n_balls);
+    std::vector<BallWithIdx<dim>> balls_idxs(n_balls);
+    for (size_t i = 0; i < n_balls; i++) {
+        keys[i] = keyed[i].key;
+        balls_idxs[i] = keyed[i].ball;
+    }
+
+    auto bounds = root_tree_bounds(balls_idxs.data(), n_balls);
+
+    std::vector<OctreeNode<dim>> nodes;
+    nodes.push_back({0, n_balls, bounds, n_balls <= n_per_cell, 0, 0, 0, {}, 0});
+    if (!nodes[0].is_leaf) {
+        add_children_morton(nodes, 0, n_per_cell, keys, balls_idxs);
+    }
+
+    Octree<dim> out;
+    set_nodes(out, std::move(nodes));
+
+    out.balls.resize(n_balls);
+    out.orig_idxs.resize(n_balls);
+    for (size_t i = 0; i < n_balls; i++) {
+        out.balls[i] = balls_idxs[i].ball;
+        out.orig_idxs[i] = balls_idxs[i].orig_idx;
+    }
+
+    return out;
 }
 
 template struct Octree<2>;
@@ -82,3 +429,15 @@ template Octree<2> build_octree(std::array<double,2>* in_balls, double* in_R,
         size_t n_balls, size_t n_per_cell);
 template Octree<3> build_octree(std::array<double,3>* in_balls, double* in_R,
         size_t n_balls, size_t n_per_cell);
+template Octree<2> build_octree_parallel(std::array<double,2>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell);
+template Octree<3> build_octree_parallel(std::array<double,3>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell);
+template Octree<2> build_octree_morton(std::array<double,2>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell);
+template Octree<3> build_octree_morton(std::array<double,3>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell);
+template Octree<2> build_octree_compact(std::array<double,2>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell);
+template Octree<3> build_octree_compact(std::array<double,3>* in_balls, double* in_R,
+        size_t n_balls, size_t n_per_cell);
@@ -4,6 +4,8 @@
 #include <vector>
 #include "tree_helpers.hpp"
 
+// The node type used while building. A finished tree stores its nodes in
+// NodeArrays.
 template <size_t dim>
 struct OctreeNode {
     static const size_t split = 2<<(dim-1);
@@ -15,13 +17,21 @@ struct OctreeNode {
     int height;
     int depth;
     size_t idx;
+    // Only the first n_children entries are used. They are always contiguous
+    // node indices starting at children[0].
     std::array<size_t,split> children;
+    size_t n_children;
 };
 
 template <size_t dim>
 std::array<int,OctreeNode<dim>::split+1> octree_partition(
         const Ball<dim>& bounds, BallWithIdx<dim>* start, BallWithIdx<dim>* end);
 
+template <size_t dim>
+std::array<int,OctreeNode<dim>::split+1> octree_partition_inplace(
+        const Ball<dim>& bounds, BallWithIdx<dim>* start, BallWithIdx<dim>* end,
+        BallWithIdx<dim>* scratch);
+
 template <size_t dim>
 Ball<dim> bounding_ball(BallWithIdx<dim>* balls, size_t n_balls);
 
@@ -32,18 +42,40 @@ template <size_t dim>
 Octree<dim> build_octree(std::array<double,dim>* in_balls, double* in_R,
     size_t n_balls, size_t n_per_cell);
 
+// Produces exactly the same tree as build_octree, but partitions in place and
+// builds the upper levels of the tree as parallel tasks.
+template <size_t dim>
+Octree<dim> build_octree_parallel(std::array<double,dim>* in_balls, double* in_R,
+    size_t n_balls, size_t n_per_cell);
+
+// Like build_octree_parallel, but empty octants are not stored. Each node's
+// non-empty children are the contiguous range [children[0],
+// children[0] + n_children).
+template <size_t dim>
+Octree<dim> build_octree_compact(std::array<double,dim>* in_balls, double* in_R,
+    size_t n_balls, size_t n_per_cell);
+
+// A linear octree: ball centers are quantized to a grid covering the root box,
+// radix sorted by Morton key and the nodes are formed from shared key
+// prefixes. The node bounds are the same center of mass balls as in
+// build_octree.
+template <size_t dim>
+Octree<dim> build_octree_morton(std::array<double,dim>* in_balls, double* in_R,
+    size_t n_balls, size_t n_per_cell);
+
 template <size_t _dim>
 struct Octree {
     constexpr static size_t dim = _dim;
     constexpr static size_t split = 2 << (dim - 1);
-    constexpr static auto build_fnc = build_octree<dim>;
-    using Node = OctreeNode<dim>;
+    constexpr static auto build_fnc = build_octree_parallel<dim>;
+    using Node = TreeNode<dim>;
 
     std::vector<Ball<dim>> balls;
     std::vector<size_t> orig_idxs;
 
     int max_height;
-    std::vector<OctreeNode<dim>> nodes;
+    NodeArrays<dim> nodes;
 
-    const OctreeNode<dim>& root() const { return nodes.front(); }
+    Node node(size_t i) const { return get_node(nodes, i); }
+    Node root() const { return node(0); }
 };
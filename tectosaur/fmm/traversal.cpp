@@ -1,256 +1,500 @@
 #include "traversal.hpp"
 #include "octree.hpp"
 #include "kdtree.hpp"
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+template <typename I>
+void check_index_range(size_t n, const char* what = "interactions") {
+    if (n > size_t(std::numeric_limits<I>::max())) {
+        throw std::runtime_error(
+            std::string("Too many ") + what +
+            " for the index type of the interaction lists."
+        );
+    }
+}
 
-struct InteractionLists {
-    std::vector<std::vector<size_t>> p2m;
-    std::vector<std::vector<std::vector<size_t>>> m2m;
-    std::vector<std::vector<std::vector<size_t>>> u2e;
+// The lists store node indices, so every node of both trees needs to fit in
+// the index type, not just the number of entries.
+template <typename I, typename TreeT>
+void check_node_index_range(const TreeT& obs_tree, const TreeT& src_tree) {
+    check_index_range<I>(std::max(obs_tree.nodes.size(), src_tree.nodes.size()), "nodes");
+}
 
-    std::vector<std::vector<size_t>> l2p;
-    std::vector<std::vector<std::vector<size_t>>> l2l;
-    std::vector<std::vector<std::vector<size_t>>> d2e;
+// Collects a CompressedInteractionList from two runs of the same
+// deterministic traversal, without any per-node vectors. In the counting
+// pass, add only counts the interactions of each obs node. finish_counting
+// then allocates the list and turns the counts into write offsets, so the
+// filling pass writes every interaction directly into place.
+template <typename I>
+struct ListBuilder {
+    bool counting = true;
+    std::vector<size_t> next;
+    CompressedInteractionListT<I> list;
+
+    ListBuilder(size_t n_obs_nodes): next(n_obs_nodes, 0) {}
+
+    void add(size_t obs_idx, size_t src_idx) {
+        if (counting) {
+            next[obs_idx]++;
+        } else {
+            list.src_n_idxs[next[obs_idx]++] = src_idx;
+        }
+    }
 
-    std::vector<std::vector<size_t>> p2p; 
-    std::vector<std::vector<size_t>> m2p; 
-    std::vector<std::vector<size_t>> p2l; 
-    std::vector<std::vector<size_t>> m2l; 
+    void finish_counting() {
+        size_t total = 0;
+        size_t nonempty = 0;
+        for (size_t i = 0; i < next.size(); i++) {
+            if (next[i] > 0) {
+                nonempty++;
+            }
+            total += next[i];
+        }
+        check_index_range<I>(total);
+
+        list.obs_n_idxs.resize(nonempty);
+        list.obs_src_starts.resize(nonempty + 1);
+        list.obs_src_starts[0] = 0;
+        size_t row = 0;
+        for (size_t i = 0; i < next.size(); i++) {
+            if (next[i] == 0) {
+                continue;
+            }
+            list.obs_n_idxs[row] = i;
+            list.obs_src_starts[row + 1] = list.obs_src_starts[row] + next[i];
+            next[i] = list.obs_src_starts[row];
+            row++;
+        }
+        list.src_n_idxs.resize(list.obs_src_starts.back());
+        counting = false;
+    }
 };
 
-CompressedInteractionList compress(const std::vector<std::vector<size_t>>& list) {
-    CompressedInteractionList out;
+template <typename I>
+struct TraversalLists {
+    ListBuilder<I> p2p;
+    ListBuilder<I> m2p;
+    ListBuilder<I> p2l;
+    ListBuilder<I> m2l;
+
+    TraversalLists(size_t n_obs_nodes):
+        p2p(n_obs_nodes), m2p(n_obs_nodes), p2l(n_obs_nodes), m2l(n_obs_nodes)
+    {}
+
+    void finish_counting() {
+        p2p.finish_counting();
+        m2p.finish_counting();
+        p2l.finish_counting();
+        m2l.finish_counting();
+    }
+};
 
-    int nonempty = 0;
-    for (size_t i = 0; i < list.size(); i++) {
-        if (list[i].size() > 0) {
-            nonempty++;
-        }
+// Builds a list with a row for each of the given obs nodes that has at least
+// one source. f(n_idx, add) must call add(src_idx) for each source of node
+// n_idx. It is called twice per node, once to count and once to fill.
+template <typename I, typename F>
+CompressedInteractionListT<I> rows_list(const std::vector<size_t>& n_idxs, const F& f) {
+    CompressedInteractionListT<I> out;
+    std::vector<size_t> counts(n_idxs.size(), 0);
+    for (size_t i = 0; i < n_idxs.size(); i++) {
+        f(n_idxs[i], [&] (size_t) { counts[i]++; });
     }
 
-    out.obs_n_idxs.resize(nonempty);
-    out.obs_src_starts.resize(nonempty + 1);
-    out.obs_src_starts[0] = 0;
-    size_t next = 0;
-    for (size_t i = 0; i < list.size(); i++) {
-        if (list[i].size() == 0) {
+    size_t total = 0;
+    for (auto c: counts) {
+        total += c;
+    }
+    check_index_range<I>(total);
+
+    out.obs_src_starts.push_back(0);
+    for (size_t i = 0; i < n_idxs.size(); i++) {
+        if (counts[i] == 0) {
             continue;
         }
-        out.obs_n_idxs[next] = i;
-        out.obs_src_starts[next + 1] = out.obs_src_starts[next] + list[i].size();
-        next++;
+        out.obs_n_idxs.push_back(n_idxs[i]);
+        out.obs_src_starts.push_back(out.obs_src_starts.back() + counts[i]);
     }
 
     out.src_n_idxs.resize(out.obs_src_starts.back());
-    next = 0;
-    for (size_t i = 0; i < list.size(); i++) {
-        for (size_t j = 0; j < list[i].size(); j++) {
-            out.src_n_idxs[next] = list[i][j];
-            next++;
-        }
+    size_t next = 0;
+    for (size_t i = 0; i < n_idxs.size(); i++) {
+        f(n_idxs[i], [&] (size_t src_idx) { out.src_n_idxs[next++] = src_idx; });
     }
-
     return out;
 }
 
 template <typename TreeT>
-InteractionLists init_interaction_lists(const TreeT& obs_tree, const TreeT& src_tree) {
-    InteractionLists lists;
-
-    lists.m2m.resize(src_tree.max_height + 1);
-    lists.u2e.resize(src_tree.max_height + 1);
-    for (int i = 0; i < src_tree.max_height + 1; i++) {
-        lists.m2m[i].resize(src_tree.nodes.size());
-        lists.u2e[i].resize(src_tree.nodes.size());
+std::vector<std::vector<size_t>> nodes_by_depth(const TreeT& tree) {
+    std::vector<std::vector<size_t>> out(tree.max_height + 1);
+    for (size_t n = 0; n < tree.nodes.size(); n++) {
+        out[tree.nodes.depths[n]].push_back(n);
     }
-    lists.l2l.resize(obs_tree.max_height + 1);
-    lists.d2e.resize(obs_tree.max_height + 1);
-    for (int i = 0; i < obs_tree.max_height + 1; i++) {
-        lists.l2l[i].resize(obs_tree.nodes.size());
-        lists.d2e[i].resize(obs_tree.nodes.size());
+    return out;
+}
+
+template <typename TreeT>
+std::vector<size_t> leaves_of(const TreeT& tree) {
+    std::vector<size_t> out;
+    for (size_t n = 0; n < tree.nodes.size(); n++) {
+        if (tree.nodes.is_leaf(n)) {
+            out.push_back(n);
+        }
     }
+    return out;
+}
 
-    lists.p2m.resize(src_tree.nodes.size());
-    lists.l2p.resize(obs_tree.nodes.size());
-    lists.p2p.resize(obs_tree.nodes.size());
-    lists.m2p.resize(obs_tree.nodes.size());
-    lists.p2l.resize(obs_tree.nodes.size());
-    lists.m2l.resize(obs_tree.nodes.size());
+// The upward pass lists are indexed by level = max_height - depth.
+template <typename TreeT, typename I>
+void up_collect(const TreeT& src_tree, InteractionsT<I>& out) {
+    auto& nodes = src_tree.nodes;
+    auto by_depth = nodes_by_depth(src_tree);
+    out.m2m.resize(src_tree.max_height + 1);
+    out.u2e.resize(src_tree.max_height + 1);
+    for (int depth = 0; depth <= src_tree.max_height; depth++) {
+        auto level = src_tree.max_height - depth;
+        auto& n_idxs = by_depth[depth];
+        out.u2e[level] = rows_list<I>(n_idxs,
+            [&] (size_t n_idx, const auto& add) { add(n_idx); }
+        );
+        out.m2m[level] = rows_list<I>(n_idxs,
+            [&] (size_t n_idx, const auto& add) {
+                for (size_t i = 0; i < nodes.n_children[n_idx]; i++) {
+                    add(nodes.first_child[n_idx] + i);
+                }
+            }
+        );
+    }
 
-    return lists;
+    out.p2m = rows_list<I>(leaves_of(src_tree),
+        [&] (size_t n_idx, const auto& add) { add(n_idx); }
+    );
 }
 
-Interactions compress_interaction_lists(const InteractionLists& lists) {
-    Interactions out;
-    out.m2m.resize(lists.m2m.size());
-    out.u2e.resize(lists.m2m.size());
-    for (size_t i = 0; i < lists.m2m.size(); i++) {
-        out.m2m[i] = compress(lists.m2m[i]);
-        out.u2e[i] = compress(lists.u2e[i]);
+// The downward pass lists are indexed by depth. Each l2l row is a child
+// node, with its parent as the source.
+template <typename TreeT, typename I>
+void down_collect(const TreeT& obs_tree, InteractionsT<I>& out) {
+    auto& nodes = obs_tree.nodes;
+    auto by_depth = nodes_by_depth(obs_tree);
+    std::vector<size_t> parents(nodes.size(), 0);
+    for (size_t n = 0; n < nodes.size(); n++) {
+        for (size_t i = 0; i < nodes.n_children[n]; i++) {
+            parents[nodes.first_child[n] + i] = n;
+        }
     }
 
-    out.l2l.resize(lists.l2l.size());
-    out.d2e.resize(lists.l2l.size());
-    for (size_t i = 0; i < lists.l2l.size(); i++) {
-        out.l2l[i] = compress(lists.l2l[i]);
-        out.d2e[i] = compress(lists.d2e[i]);
+    out.l2l.resize(obs_tree.max_height + 1);
+    out.d2e.resize(obs_tree.max_height + 1);
+    for (int depth = 0; depth <= obs_tree.max_height; depth++) {
+        auto& n_idxs = by_depth[depth];
+        out.d2e[depth] = rows_list<I>(n_idxs,
+            [&] (size_t n_idx, const auto& add) { add(n_idx); }
+        );
+        // The root has no parent, so l2l[0] is empty.
+        out.l2l[depth] = rows_list<I>(
+            (depth == 0) ? std::vector<size_t>{} : n_idxs,
+            [&] (size_t n_idx, const auto& add) { add(parents[n_idx]); }
+        );
     }
 
-    out.p2m = compress(lists.p2m);
-    out.l2p = compress(lists.l2p);
-    out.p2p = compress(lists.p2p);
-    out.m2p = compress(lists.m2p);
-    out.p2l = compress(lists.p2l);
-    out.m2l = compress(lists.m2l);
-    return out;
+    out.l2p = rows_list<I>(leaves_of(obs_tree),
+        [&] (size_t n_idx, const auto& add) { add(n_idx); }
+    );
 }
 
-
-template <typename TreeT, typename F>
-void for_all_leaves_of(const TreeT& t, const typename TreeT::Node& n, const F& f) {
-    if (n.is_leaf) {
+template <size_t dim, typename F>
+void for_all_leaves_of(const NodeArrays<dim>& nodes, size_t n, const F& f) {
+    if (nodes.is_leaf(n)) {
         f(n);
         return;
     }
-    for (size_t i = 0; i < n.children.size(); i++) {
-        for_all_leaves_of(t, t.nodes[n.children[i]], f);
+    for (size_t i = 0; i < nodes.n_children[n]; i++) {
+        for_all_leaves_of(nodes, nodes.first_child[n] + i, f);
     }
 }
 
+// If there aren't enough src or obs to justify using the approximation,
+// then add_far_interaction does a p2p direct calculation between the nodes.
 template <typename TreeT>
+bool far_pair_is_p2p(const TreeT& obs_tree, const TreeT& src_tree,
+        size_t obs_n, size_t src_n, size_t order)
+{
+    return src_tree.nodes.n_balls(src_n) < order && obs_tree.nodes.n_balls(obs_n) < order;
+}
+
+// Records the interaction of a pair of nodes that passed the acceptance test.
+template <typename TreeT, typename ListsT>
+void add_far_interaction(const TreeT& obs_tree, const TreeT& src_tree,
+        ListsT& lists, size_t obs_n, size_t src_n, size_t order, bool treecode)
+{
+    size_t n_src = src_tree.nodes.n_balls(src_n);
+    size_t n_obs = obs_tree.nodes.n_balls(obs_n);
+
+    if (n_src == 0 || n_obs == 0) {
+        return;
+    }
+
+    bool small_src = n_src < order;
+    bool small_obs = n_obs < order;
+
+    if (far_pair_is_p2p(obs_tree, src_tree, obs_n, src_n, order)) {
+        for_all_leaves_of(obs_tree.nodes, obs_n,
+            [&] (size_t leaf_obs_n) { lists.p2p.add(leaf_obs_n, src_n); }
+        );
+    } else if (small_obs || treecode) {
+        for_all_leaves_of(obs_tree.nodes, obs_n,
+            [&] (size_t leaf_obs_n) { lists.m2p.add(leaf_obs_n, src_n); }
+        );
+    } else if (small_src) {
+        lists.p2l.add(obs_n, src_n);
+    } else {
+        lists.m2l.add(obs_n, src_n);
+    }
+}
+
+// Obs nodes with fewer balls than this are traversed serially.
+constexpr size_t traversal_task_min_obs = 2048;
+
+template <typename TreeT, typename ListsT, typename MAC>
 void traverse(const TreeT& obs_tree, const TreeT& src_tree,
-        InteractionLists& interaction_lists,
-        const typename TreeT::Node& obs_n, const typename TreeT::Node& src_n,
-        double inner_r, double outer_r, size_t order, bool treecode) 
+        ListsT& lists, size_t obs_n, size_t src_n,
+        const MAC& mac, size_t order, bool treecode)
 {
-    auto r_src = src_n.bounds.R;
-    auto r_obs = obs_n.bounds.R;
-    auto sep = hypot(sub(obs_n.bounds.center, src_n.bounds.center));
-
-    // If outer_r * r_src + inner_r * r_obs is less than the separation, then
-    // the relevant check surfaces for the two interacting cells don't
-    // intersect.
-    // That means it should be safe to perform approximate interactions. I add
-    // a small safety factor just in case!
-    double safety_factor = 0.98;
-
-    if (outer_r * r_src + inner_r * r_obs < safety_factor * sep) {
-        // If there aren't enough src or obs to justify using the approximation,
-        // then just do a p2p direct calculation between the nodes.
-        size_t n_src = src_n.end - src_n.start;
-        size_t n_obs = obs_n.end - obs_n.start;
-
-        if (n_src == 0 || n_obs == 0) {
-            return;
-        }
+    auto& obs = obs_tree.nodes;
+    auto& src = src_tree.nodes;
+    if (mac.accept(obs, obs_n, src, src_n)) {
+        add_far_interaction(obs_tree, src_tree, lists, obs_n, src_n, order, treecode);
+        return;
+    }
 
-        bool small_src = n_src < order;
-        bool small_obs = n_obs < order;
+    if (src.is_leaf(src_n) && obs.is_leaf(obs_n)) {
+        lists.p2p.add(obs_n, src_n);
+        return;
+    }
 
-        if (small_src && small_obs) {
-            for_all_leaves_of(obs_tree, obs_n,
-                [&] (const typename TreeT::Node& leaf_obs_n) {
-                    interaction_lists.p2p[leaf_obs_n.idx].push_back(src_n.idx);
-                }
+    if (mac.split_src(obs, obs_n, src, src_n)) {
+        for (size_t i = 0; i < src.n_children[src_n]; i++) {
+            traverse(
+                obs_tree, src_tree, lists,
+                obs_n, src.first_child[src_n] + i,
+                mac, order, treecode
             );
-        } else if (small_obs || treecode) {
-            for_all_leaves_of(obs_tree, obs_n,
-                [&] (const typename TreeT::Node& leaf_obs_n) {
-                    interaction_lists.m2p[leaf_obs_n.idx].push_back(src_n.idx);
-                }
+        }
+    } else if (obs.n_balls(obs_n) < traversal_task_min_obs) {
+        for (size_t i = 0; i < obs.n_children[obs_n]; i++) {
+            traverse(
+                obs_tree, src_tree, lists,
+                obs.first_child[obs_n] + i, src_n,
+                mac, order, treecode
             );
-        } else if (small_src) {
-            interaction_lists.p2l[obs_n.idx].push_back(src_n.idx);
-        } else {
-            interaction_lists.m2l[obs_n.idx].push_back(src_n.idx);
+        }
+    } else {
+        // Every interaction is stored in the list of an obs node, so tasks
+        // for different obs children never write to the same list. Waiting
+        // for the tasks before returning keeps the order of each list the
+        // same as in a serial traversal.
+        for (size_t i = 0; i < obs.n_children[obs_n]; i++) {
+#pragma omp task default(shared) firstprivate(i)
+            traverse(
+                obs_tree, src_tree, lists,
+                obs.first_child[obs_n] + i, src_n,
+                mac, order, treecode
+            );
+        }
+#pragma omp taskwait
+    }
+}
+
+// Traverses the unordered pairs of nodes of a single tree. Each pair of
+// distinct nodes is visited once, with a and b in disjoint subtrees. A pair
+// is only approximated if it passes the acceptance test in both directions,
+// and then the far interactions are recorded in both directions. p2p blocks
+// between distinct nodes are recorded once, in the row of one of the two
+// nodes, and must be applied in both directions by the evaluator. That also
+// holds for the p2p blocks that stand in for an accepted pair of nodes that
+// are both too small for the expansions, so those are only recorded for
+// (a, b).
+template <typename TreeT, typename ListsT, typename MAC>
+void traverse_symmetric(const TreeT& tree, ListsT& lists, size_t a, size_t b,
+        const MAC& mac, size_t order, bool treecode)
+{
+    auto& nodes = tree.nodes;
+    if (a == b) {
+        if (nodes.is_leaf(a)) {
+            lists.p2p.add(a, a);
+            return;
+        }
+        auto first = nodes.first_child[a];
+        for (size_t i = 0; i < nodes.n_children[a]; i++) {
+            for (size_t j = i; j < nodes.n_children[a]; j++) {
+                traverse_symmetric(
+                    tree, lists, first + i, first + j,
+                    mac, order, treecode
+                );
+            }
         }
         return;
     }
 
-    if (src_n.is_leaf && obs_n.is_leaf) {
-        interaction_lists.p2p[obs_n.idx].push_back(src_n.idx);
+    if (mac.accept(nodes, a, nodes, b) && mac.accept(nodes, b, nodes, a)) {
+        add_far_interaction(tree, tree, lists, a, b, order, treecode);
+        if (!far_pair_is_p2p(tree, tree, b, a, order)) {
+            add_far_interaction(tree, tree, lists, b, a, order, treecode);
+        }
         return;
     }
 
-    bool split_src = ((r_obs < r_src) && !src_n.is_leaf) || obs_n.is_leaf;
-    if (split_src) {
-        for (size_t i = 0; i < TreeT::split; i++) {
-            traverse(
-                obs_tree, src_tree, interaction_lists,
-                obs_n, src_tree.nodes[src_n.children[i]],
-                inner_r, outer_r, order, treecode
+    if (nodes.is_leaf(a) && nodes.is_leaf(b)) {
+        lists.p2p.add(a, b);
+        return;
+    }
+
+    if (mac.split_src(nodes, a, nodes, b)) {
+        for (size_t i = 0; i < nodes.n_children[b]; i++) {
+            traverse_symmetric(
+                tree, lists, a, nodes.first_child[b] + i,
+                mac, order, treecode
             );
         }
     } else {
-        for (size_t i = 0; i < TreeT::split; i++) {
-            traverse(
-                obs_tree, src_tree, interaction_lists,
-                obs_tree.nodes[obs_n.children[i]], src_n,
-                inner_r, outer_r, order, treecode
+        for (size_t i = 0; i < nodes.n_children[a]; i++) {
+            traverse_symmetric(
+                tree, lists, nodes.first_child[a] + i, b,
+                mac, order, treecode
             );
         }
     }
 }
 
-template <typename TreeT>
-void up_collect(const TreeT& src_tree, InteractionLists& interaction_lists, 
-        const typename TreeT::Node& src_n) 
+template <typename TreeT, typename I, typename MAC>
+InteractionsT<I> fmmmm_interactions(const TreeT& obs_tree, const TreeT& src_tree,
+    const MAC& mac, size_t order, bool treecode)
 {
-    auto level = src_tree.max_height - src_n.depth;
-    interaction_lists.u2e[level][src_n.idx].push_back(src_n.idx);
-    if (src_n.is_leaf) {
-        interaction_lists.p2m[src_n.idx].push_back(src_n.idx);
-    } else {
-        for (size_t i = 0; i < TreeT::split; i++) {
-            auto child_n = src_tree.nodes[src_n.children[i]];
-            up_collect(src_tree, interaction_lists, child_n);
-            interaction_lists.m2m[level][src_n.idx].push_back(child_n.idx);
+    check_node_index_range<I>(obs_tree, src_tree);
+    InteractionsT<I> out;
+    up_collect(src_tree, out);
+    down_collect(obs_tree, out);
+
+    // The traversal runs twice: once to count the interactions of each obs
+    // node and once to write them into the preallocated lists.
+    TraversalLists<I> lists(obs_tree.nodes.size());
+    for (int pass = 0; pass < 2; pass++) {
+#pragma omp parallel
+#pragma omp single
+        traverse(
+            obs_tree, src_tree, lists,
+            0, 0, mac, order, treecode
+        );
+        if (pass == 0) {
+            lists.finish_counting();
         }
     }
+
+    out.p2p = std::move(lists.p2p.list);
+    out.m2p = std::move(lists.m2p.list);
+    out.p2l = std::move(lists.p2l.list);
+    out.m2l = std::move(lists.m2l.list);
+    return out;
 }
 
-template <typename TreeT>
-void down_collect(const TreeT& obs_tree, InteractionLists& interaction_lists, 
-        const typename TreeT::Node& obs_n) 
+template <typename TreeT, typename I, typename MAC>
+InteractionsT<I> fmmmm_interactions_symmetric(const TreeT& tree,
+    const MAC& mac, size_t order, bool treecode)
 {
-    interaction_lists.d2e[obs_n.depth][obs_n.idx].push_back(obs_n.idx);
-    if (obs_n.is_leaf) {
-        interaction_lists.l2p[obs_n.idx].push_back(obs_n.idx);
-    } else {
-        for (size_t i = 0; i < TreeT::split; i++) {
-            auto child_n = obs_tree.nodes[obs_n.children[i]];
-            down_collect(obs_tree, interaction_lists, child_n);
-            interaction_lists.l2l[child_n.depth][child_n.idx].push_back(obs_n.idx);
+    check_node_index_range<I>(tree, tree);
+    InteractionsT<I> out;
+    up_collect(tree, out);
+    down_collect(tree, out);
+
+    // Far interactions from a single visit write to the lists of both nodes,
+    // so unlike the asymmetric traversal, this one runs serially.
+    TraversalLists<I> lists(tree.nodes.size());
+    for (int pass = 0; pass < 2; pass++) {
+        traverse_symmetric(
+            tree, lists, 0, 0, mac, order, treecode
+        );
+        if (pass == 0) {
+            lists.finish_counting();
         }
     }
+
+    out.p2p = std::move(lists.p2p.list);
+    out.m2p = std::move(lists.m2p.list);
+    out.p2l = std::move(lists.p2l.list);
+    out.m2l = std::move(lists.m2l.list);
+    return out;
 }
 
-template <typename TreeT>
-Interactions fmmmm_interactions(const TreeT& obs_tree, const TreeT& src_tree,
-    double inner_r, double outer_r, size_t order, bool treecode)
+template <typename TreeT, typename I, typename MAC>
+bool node_pairs_valid(const CompressedInteractionListT<I>& list,
+    const TreeT& obs_tree, const TreeT& src_tree, const MAC& mac) 
 {
-    auto interaction_lists = init_interaction_lists(obs_tree, src_tree);
-
-    up_collect(src_tree, interaction_lists, src_tree.root());
-    down_collect(obs_tree, interaction_lists, obs_tree.root());
-    traverse(
-        obs_tree, src_tree, interaction_lists,
-        obs_tree.root(), src_tree.root(),
-        inner_r, outer_r, order, treecode
-    );
+    bool valid = true;
+#pragma omp parallel for reduction(&&:valid)
+    for (size_t i = 0; i < list.obs_n_idxs.size(); i++) {
+        size_t obs_n = list.obs_n_idxs[i];
+        for (size_t j = list.obs_src_starts[i]; j < size_t(list.obs_src_starts[i + 1]); j++) {
+            size_t src_n = list.src_n_idxs[j];
+            valid = valid && mac.accept(obs_tree.nodes, obs_n, src_tree.nodes, src_n);
+        }
+    }
+    return valid;
+}
 
-    return compress_interaction_lists(interaction_lists);
+// m2p pairs are stored for the obs leaves below the node that passed the
+// acceptance test, so instead check every obs ball with accept_ball.
+template <typename TreeT, typename I, typename MAC>
+bool m2p_pairs_valid(const CompressedInteractionListT<I>& list,
+    const TreeT& obs_tree, const TreeT& src_tree, const MAC& mac) 
+{
+    auto& obs = obs_tree.nodes;
+    bool valid = true;
+#pragma omp parallel for reduction(&&:valid)
+    for (size_t i = 0; i < list.obs_n_idxs.size(); i++) {
+        size_t obs_n = list.obs_n_idxs[i];
+        for (size_t j = list.obs_src_starts[i]; j < size_t(list.obs_src_starts[i + 1]); j++) {
+            size_t src_n = list.src_n_idxs[j];
+            for (size_t k = obs.starts[obs_n]; k < obs.ends[obs_n]; k++) {
+                valid = valid && mac.accept_ball(obs_tree.balls[k], src_tree.nodes, src_n);
+            }
+        }
+    }
+    return valid;
+}
+
+template <typename TreeT, typename I, typename MAC>
+bool interactions_valid(const InteractionsT<I>& interactions,
+    const TreeT& obs_tree, const TreeT& src_tree, const MAC& mac)
+{
+    return node_pairs_valid(interactions.m2l, obs_tree, src_tree, mac)
+        && node_pairs_valid(interactions.p2l, obs_tree, src_tree, mac)
+        && m2p_pairs_valid(interactions.m2p, obs_tree, src_tree, mac);
 }
 
-template 
-Interactions fmmmm_interactions(const Octree<2>& obs_tree, const Octree<2>& src_tree,
-    double inner_r, double outer_r, size_t order, bool treecode);
-template 
-Interactions fmmmm_interactions(const Octree<3>& obs_tree, const Octree<3>& src_tree,
-    double inner_r, double outer_r, size_t order, bool treecode);
-
-template 
-Interactions fmmmm_interactions(const KDTree<2>& obs_tree, const KDTree<2>& src_tree,
-    double inner_r, double outer_r, size_t order, bool treecode);
-template 
-Interactions fmmmm_interactions(const KDTree<3>& obs_tree, const KDTree<3>& src_tree,
-    double inner_r, double outer_r, size_t order, bool treecode);
+#define INSTANTIATE_MAC(TreeT, I, MAC)\
+    template InteractionsT<I> fmmmm_interactions<TreeT, I, MAC>(\
+        const TreeT& obs_tree, const TreeT& src_tree,\
+        const MAC& mac, size_t order, bool treecode);\
+    template InteractionsT<I> fmmmm_interactions_symmetric<TreeT, I, MAC>(\
+        const TreeT& tree, const MAC& mac, size_t order, bool treecode);\
+    template bool interactions_valid(const InteractionsT<I>& interactions,\
+        const TreeT& obs_tree, const TreeT& src_tree, const MAC& mac);
+
+#define INSTANTIATE(TreeT, I)\
+    INSTANTIATE_MAC(TreeT, I, BallMAC<TreeT>)\
+    INSTANTIATE_MAC(TreeT, I, BoxMAC<TreeT>)\
+    INSTANTIATE_MAC(TreeT, I, ThetaMAC<TreeT>)\
+    INSTANTIATE_MAC(TreeT, I, ErrorMAC<TreeT>)
+
+INSTANTIATE(Octree<2>, size_t)
+INSTANTIATE(Octree<3>, size_t)
+INSTANTIATE(KDTree<2>, size_t)
+INSTANTIATE(KDTree<3>, size_t)
+INSTANTIATE(Octree<2>, int32_t)
+INSTANTIATE(Octree<3>, int32_t)
+INSTANTIATE(KDTree<2>, int32_t)
+INSTANTIATE(KDTree<3>, int32_t)
+#undef INSTANTIATE
+#undef INSTANTIATE_MAC
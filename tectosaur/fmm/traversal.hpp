@@ -2,15 +2,23 @@
 
 #include <vector>
 #include <cstddef>
+#include <cstdint>
+#include "mac.hpp"
 
-struct CompressedInteractionList {
-    std::vector<size_t> obs_n_idxs;//TODO: Make these 64-bit.
-    std::vector<size_t> obs_src_starts;
-    std::vector<size_t> src_n_idxs;
+// I is the index type. Lists with 32-bit indices take half the memory and
+// can be handed to the GPU without conversion, but they can only hold up to
+// 2^31 - 1 interactions.
+template <typename I>
+struct CompressedInteractionListT {
+    std::vector<I> obs_n_idxs;
+    std::vector<I> obs_src_starts;
+    std::vector<I> src_n_idxs;
 };
+using CompressedInteractionList = CompressedInteractionListT<size_t>;
+using CompressedInteractionList32 = CompressedInteractionListT<int32_t>;
 
-template <typename TreeT>
-size_t count_interactions(const CompressedInteractionList& list,
+template <typename TreeT, typename I>
+size_t count_interactions(const CompressedInteractionListT<I>& list,
     const TreeT& obs_tree, const TreeT& src_tree,
     bool obs_surf, bool src_surf, int n_surf) 
 {
@@ -19,15 +27,13 @@ size_t count_interactions(const CompressedInteractionList& list,
         int obs_n_idx = list.obs_n_idxs[i];
         int n_obs = n_surf;
         if (!obs_surf) {
-            auto& n = obs_tree.nodes[obs_n_idx];
-            n_obs = n.end - n.start;
+            n_obs = obs_tree.nodes.n_balls(obs_n_idx);
         }
-        for (size_t j = list.obs_src_starts[i]; j < list.obs_src_starts[i + 1]; j++) {
+        for (size_t j = list.obs_src_starts[i]; j < size_t(list.obs_src_starts[i + 1]); j++) {
             size_t src_n_idx = list.src_n_idxs[j];
             int n_src = n_surf;
             if (!src_surf) {
-                auto& n = src_tree.nodes[src_n_idx];
-                n_src = n.end - n.start;
+                n_src = src_tree.nodes.n_balls(src_n_idx);
             }
             n += n_obs * n_src;
         }
@@ -35,21 +41,73 @@ size_t count_interactions(const CompressedInteractionList& list,
     return n;
 }
 
-struct Interactions {
-    CompressedInteractionList p2m;
-    std::vector<CompressedInteractionList> m2m;
-    std::vector<CompressedInteractionList> u2e;
+template <typename I>
+struct InteractionsT {
+    CompressedInteractionListT<I> p2m;
+    std::vector<CompressedInteractionListT<I>> m2m;
+    std::vector<CompressedInteractionListT<I>> u2e;
 
-    CompressedInteractionList l2p;
-    std::vector<CompressedInteractionList> l2l;
-    std::vector<CompressedInteractionList> d2e;
+    CompressedInteractionListT<I> l2p;
+    std::vector<CompressedInteractionListT<I>> l2l;
+    std::vector<CompressedInteractionListT<I>> d2e;
 
-    CompressedInteractionList p2p;
-    CompressedInteractionList p2l;
-    CompressedInteractionList m2p;
-    CompressedInteractionList m2l;
+    CompressedInteractionListT<I> p2p;
+    CompressedInteractionListT<I> p2l;
+    CompressedInteractionListT<I> m2p;
+    CompressedInteractionListT<I> m2l;
 };
+using Interactions = InteractionsT<size_t>;
+using Interactions32 = InteractionsT<int32_t>;
 
-template <typename TreeT>
-Interactions fmmmm_interactions(const TreeT& obs_tree, const TreeT& src_tree,
-    double inner_r, double outer_r, size_t order, bool treecode);
+// MAC is one of the acceptance criteria in mac.hpp.
+template <typename TreeT, typename I = size_t, typename MAC>
+InteractionsT<I> fmmmm_interactions(const TreeT& obs_tree, const TreeT& src_tree,
+    const MAC& mac, size_t order, bool treecode);
+
+template <typename TreeT, typename I = size_t>
+InteractionsT<I> fmmmm_interactions(const TreeT& obs_tree, const TreeT& src_tree,
+    double inner_r, double outer_r, size_t order, bool treecode) 
+{
+    return fmmmm_interactions<TreeT, I>(
+        obs_tree, src_tree, BallMAC<TreeT>(inner_r, outer_r), order, treecode
+    );
+}
+
+// The same interactions for obs_tree == src_tree, but each pair of distinct
+// nodes is only traversed once. A pair of nodes is approximated only if the
+// MAC accepts it in both directions. The p2p list holds each block between
+// distinct nodes only once, in the row of one of them, so the p2p evaluation
+// must apply each of these blocks in both directions. This includes the p2p
+// blocks that replace an accepted pair of nodes with fewer than order balls
+// each. The m2p, p2l and m2l lists hold every approximated pair in both
+// directions.
+template <typename TreeT, typename I = size_t, typename MAC>
+InteractionsT<I> fmmmm_interactions_symmetric(const TreeT& tree,
+    const MAC& mac, size_t order, bool treecode);
+
+template <typename TreeT, typename I = size_t>
+InteractionsT<I> fmmmm_interactions_symmetric(const TreeT& tree,
+    double inner_r, double outer_r, size_t order, bool treecode) 
+{
+    return fmmmm_interactions_symmetric<TreeT, I>(
+        tree, BallMAC<TreeT>(inner_r, outer_r), order, treecode
+    );
+}
+
+// Whether the approximate interactions (m2l, p2l and m2p) still pass the
+// acceptance criterion for the trees' current bounds, for example after the
+// trees have been refit to slightly moved geometry. The set of obs/src pairs
+// covered by the lists only depends on the tree topology, so if this returns
+// true, the interactions can be reused as they are.
+template <typename TreeT, typename I, typename MAC>
+bool interactions_valid(const InteractionsT<I>& interactions,
+    const TreeT& obs_tree, const TreeT& src_tree, const MAC& mac);
+
+template <typename TreeT, typename I>
+bool interactions_valid(const InteractionsT<I>& interactions,
+    const TreeT& obs_tree, const TreeT& src_tree, double inner_r, double outer_r) 
+{
+    return interactions_valid(
+        interactions, obs_tree, src_tree, BallMAC<TreeT>(inner_r, outer_r)
+    );
+}
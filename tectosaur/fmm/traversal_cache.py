@@ -0,0 +1,90 @@
+import numpy as np
+
+import tectosaur.util.disk_cache as disk_cache
+
+from tectosaur.util.cpp import imp
+traversal_ext = imp("tectosaur.fmm.traversal_wrapper")
+
+# Serializes the trees and interaction lists of an FMM so that runs on the
+# same mesh (restarts, parameter sweeps) can skip tree construction and
+# traversal entirely.
+
+tree_array_names = [
+    'ball_centers', 'ball_Rs', 'orig_idxs', 'node_centers', 'node_Rs',
+    'node_starts', 'node_ends', 'node_depths', 'node_first_child',
+    'node_n_children'
+]
+list_data_names = ['obs_n_idxs', 'obs_src_starts', 'src_n_idxs']
+single_ops = ['p2m', 'l2p', 'p2p', 'p2l', 'm2p', 'm2l']
+level_ops = ['m2m', 'u2e', 'l2l', 'd2e']
+
+def tree_to_arrays(tree, prefix):
+    return {
+        prefix + name: np.array(getattr(tree, name), copy = False)
+        for name in tree_array_names
+    }
+
+def tree_from_arrays(traversal_module, arrays, prefix):
+    return traversal_module.Tree.from_arrays(
+        *[arrays[prefix + name] for name in tree_array_names]
+    )
+
+def list_to_arrays(op, prefix):
+    return {
+        prefix + name: np.array(getattr(op, name), copy = False)
+        for name in list_data_names
+    }
+
+# Lists with 32-bit indices are restored as CompressedInteractionList32.
+def index_suffix(arrays):
+    return '32' if arrays['p2p_src_n_idxs'].dtype == np.int32 else ''
+
+def list_from_arrays(arrays, prefix):
+    cls = getattr(traversal_ext, 'CompressedInteractionList' + index_suffix(arrays))
+    return cls(*[arrays[prefix + name] for name in list_data_names])
+
+def interactions_to_arrays(interactions):
+    out = dict()
+    for name in single_ops:
+        out.update(list_to_arrays(getattr(interactions, name), name + '_'))
+    for name in level_ops:
+        levels = getattr(interactions, name)
+        out[name + '_n_levels'] = np.array(len(levels))
+        for i, op in enumerate(levels):
+            out.update(list_to_arrays(op, name + str(i) + '_'))
+    return out
+
+def interactions_from_arrays(arrays):
+    out = getattr(traversal_ext, 'Interactions' + index_suffix(arrays))()
+    for name in single_ops:
+        setattr(out, name, list_from_arrays(arrays, name + '_'))
+    for name in level_ops:
+        n_levels = int(arrays[name + '_n_levels'])
+        setattr(out, name, [
+            list_from_arrays(arrays, name + str(i) + '_') for i in range(n_levels)
+        ])
+    return out
+
+def cached_traversal(traversal_module, key, build_fnc):
+    """
+    Returns (obs_tree, src_tree, interactions), loading them from the disk cache
+    if an entry exists for key and otherwise calling build_fnc and storing the
+    result. key should be built with disk_cache.hash_key from everything that
+    determines the trees and the traversal: the meshes, the tree type, the leaf
+    size, the MAC and the expansion order.
+    """
+    arrays = disk_cache.load_arrays('traversal', key)
+    if arrays is not None:
+        return (
+            tree_from_arrays(traversal_module, arrays, 'obs_'),
+            tree_from_arrays(traversal_module, arrays, 'src_'),
+            interactions_from_arrays(arrays)
+        )
+
+    obs_tree, src_tree, interactions = build_fnc()
+    arrays = dict()
+    arrays.update(tree_to_arrays(obs_tree, 'obs_'))
+    arrays.update(tree_to_arrays(src_tree, 'src_'))
+    arrays.update(interactions_to_arrays(interactions))
+    disk_cache.save_arrays('traversal', key, arrays)
+    return obs_tree, src_tree, interactions
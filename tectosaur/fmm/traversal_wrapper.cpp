@@ -15,57 +15,145 @@ fmm_lib_cfg(cfg)
 
 namespace py = pybind11;
 
+template <typename TreeT, typename F>
+auto wrap_build_fnc(F build_fnc) {
+    return [=] (NPArrayD np_pts, NPArrayD np_R, size_t n_per_cell) {
+        check_shape<TreeT::dim>(np_pts);
+        return build_fnc(
+            as_ptr<std::array<double,TreeT::dim>>(np_pts),
+            as_ptr<double>(np_R),
+            np_pts.request().shape[0], n_per_cell
+        );
+    };
+}
+
+// Zero-copy views of the structure-of-arrays node data.
+#define NODEARRAYPROP(type, py_name, name)\
+    def_property_readonly(#py_name, [] (type& tree) {\
+        auto& arr = tree.nodes.name;\
+        return make_array({arr.size()}, arr.data());\
+    })
+
+// Overloads of the traversal functions that take a MAC object in place of
+// inner_r and outer_r.
+template <typename TreeT, typename MAC>
+void wrap_mac_traversal(py::module& m) {
+    m.def("fmmmm_interactions", &fmmmm_interactions<TreeT, size_t, MAC>);
+    m.def("fmmmm_interactions32", &fmmmm_interactions<TreeT, int32_t, MAC>);
+    m.def("fmmmm_interactions_symmetric", &fmmmm_interactions_symmetric<TreeT, size_t, MAC>);
+    m.def("fmmmm_interactions_symmetric32",
+        &fmmmm_interactions_symmetric<TreeT, int32_t, MAC>);
+    m.def("interactions_valid", &interactions_valid<TreeT, size_t, MAC>);
+    m.def("interactions_valid", &interactions_valid<TreeT, int32_t, MAC>);
+}
+
 template <typename TreeT>
-void wrap_fmm(py::module& m) {
+py::class_<TreeT> wrap_fmm(py::module& m) {
     using Node = typename TreeT::Node;
-    py::class_<Node>(m, "TreeNode")
-        .def_readonly("start", &Node::start)
-        .def_readonly("end", &Node::end)
-        .def_readonly("bounds", &Node::bounds)
-        .def_readonly("is_leaf", &Node::is_leaf)
-        .def_readonly("idx", &Node::idx)
-        .def_readonly("height", &Node::height)
-        .def_readonly("depth", &Node::depth)
-        .def_readonly("children", &Node::children);
-
-    py::class_<TreeT>(m, "Tree")
-        .def_static("build", 
-            [] (NPArrayD np_pts, NPArrayD np_R, size_t n_per_cell) {
-                check_shape<TreeT::dim>(np_pts);
-                return TreeT::build_fnc(
-                    as_ptr<std::array<double,TreeT::dim>>(np_pts),
-                    as_ptr<double>(np_R),
-                    np_pts.request().shape[0], n_per_cell
+    auto tree = py::class_<TreeT>(m, "Tree");
+    tree
+        .def_static("build", wrap_build_fnc<TreeT>(TreeT::build_fnc))
+        .def_static("from_arrays", [] (NPArrayD ball_centers, NPArrayD ball_Rs,
+                NPArray<size_t> orig_idxs, NPArrayD node_centers, NPArrayD node_Rs,
+                NPArray<size_t> node_starts, NPArray<size_t> node_ends,
+                NPArray<int> node_depths, NPArray<size_t> node_first_child,
+                NPArray<size_t> node_n_children)
+            {
+                constexpr size_t dim = TreeT::dim;
+                check_shape<dim>(ball_centers);
+                check_shape<dim>(node_centers);
+                auto centers = get_vector<std::array<double,dim>>(ball_centers);
+                auto* R_ptr = as_ptr<double>(ball_Rs);
+                std::vector<Ball<dim>> balls(centers.size());
+                for (size_t i = 0; i < balls.size(); i++) {
+                    balls[i] = {centers[i], R_ptr[i]};
+                }
+                NodeArrays<dim> arrs;
+                arrs.centers = get_vector<std::array<double,dim>>(node_centers);
+                arrs.Rs = get_vector<double>(node_Rs);
+                arrs.starts = get_vector<size_t>(node_starts);
+                arrs.ends = get_vector<size_t>(node_ends);
+                arrs.depths = get_vector<int>(node_depths);
+                arrs.first_child = get_vector<size_t>(node_first_child);
+                arrs.n_children = get_vector<size_t>(node_n_children);
+                return tree_from_arrays<TreeT>(
+                    std::move(balls), get_vector<size_t>(orig_idxs), std::move(arrs)
                 );
             })
         .def("root", &TreeT::root)
+        .def("refit", [] (TreeT& t, NPArrayD np_pts, NPArrayD np_R) {
+            check_shape<TreeT::dim>(np_pts);
+            if (size_t(np_pts.request().shape[0]) != t.balls.size()) {
+                throw std::runtime_error("refit requires the same number of balls as the tree");
+            }
+            refit(t, as_ptr<std::array<double,TreeT::dim>>(np_pts), as_ptr<double>(np_R));
+        })
         .def_property_readonly("split", [] (const TreeT& t) { return TreeT::split; })
-        .def_readonly("nodes", &TreeT::nodes)
+        .def_property_readonly("nodes", [] (const TreeT& t) {
+            std::vector<Node> out(t.nodes.size());
+            for (size_t i = 0; i < out.size(); i++) {
+                out[i] = t.node(i);
+            }
+            return out;
+        })
+        .def("node", &TreeT::node)
         .NPARRAYPROP(TreeT, orig_idxs)
         .def_readonly("max_height", &TreeT::max_height)
         .def_readonly("balls", &TreeT::balls)
-        .def_property_readonly("node_centers", [] (TreeT& tree) {
-            auto out = make_array<double>({tree.nodes.size(), TreeT::dim});
-            auto* out_ptr = as_ptr<std::array<double,TreeT::dim>>(out);
-            for (size_t i = 0; i < tree.nodes.size(); i++) {
-                out_ptr[i] = tree.nodes[i].bounds.center;
+        .def_property_readonly("ball_centers", [] (TreeT& t) {
+            auto out = make_array<double>({t.balls.size(), TreeT::dim});
+            auto* ptr = as_ptr<double>(out);
+            for (size_t i = 0; i < t.balls.size(); i++) {
+                for (size_t d = 0; d < TreeT::dim; d++) {
+                    ptr[i * TreeT::dim + d] = t.balls[i].center[d];
+                }
             }
             return out;
         })
-        .def_property_readonly("node_Rs", [] (TreeT& tree) {
-            auto out = make_array<double>({tree.nodes.size()});
-            auto* out_ptr = as_ptr<double>(out);
-            for (size_t i = 0; i < tree.nodes.size(); i++) {
-                out_ptr[i] = tree.nodes[i].bounds.R;
+        .def_property_readonly("ball_Rs", [] (TreeT& t) {
+            auto out = make_array<double>({t.balls.size()});
+            auto* ptr = as_ptr<double>(out);
+            for (size_t i = 0; i < t.balls.size(); i++) {
+                ptr[i] = t.balls[i].R;
             }
             return out;
         })
+        .NODEARRAYPROP(TreeT, node_centers, centers)
+        .NODEARRAYPROP(TreeT, node_Rs, Rs)
+        .NODEARRAYPROP(TreeT, node_starts, starts)
+        .NODEARRAYPROP(TreeT, node_ends, ends)
+        .NODEARRAYPROP(TreeT, node_depths, depths)
+        .NODEARRAYPROP(TreeT, node_heights, heights)
+        .NODEARRAYPROP(TreeT, node_first_child, first_child)
+        .NODEARRAYPROP(TreeT, node_n_children, n_children)
         .def_property_readonly("n_nodes", [] (TreeT& o) {
             return o.nodes.size();
         });
 
-    m.def("fmmmm_interactions", &fmmmm_interactions<TreeT>);
-    m.def("count_interactions", &count_interactions<TreeT>);
+    m.def("fmmmm_interactions", &fmmmm_interactions<TreeT, size_t>);
+    m.def("fmmmm_interactions32", &fmmmm_interactions<TreeT, int32_t>);
+    m.def("fmmmm_interactions_symmetric", &fmmmm_interactions_symmetric<TreeT, size_t>);
+    m.def("fmmmm_interactions_symmetric32",
+        &fmmmm_interactions_symmetric<TreeT, int32_t>);
+    m.def("count_interactions", &count_interactions<TreeT, size_t>);
+    m.def("count_interactions", &count_interactions<TreeT, int32_t>);
+    m.def("interactions_valid", &interactions_valid<TreeT, size_t>);
+    m.def("interactions_valid", &interactions_valid<TreeT, int32_t>);
+
+    py::class_<BallMAC<TreeT>>(m, "BallMAC")
+        .def(py::init<double,double>());
+    py::class_<BoxMAC<TreeT>>(m, "BoxMAC")
+        .def(py::init<const TreeT&,const TreeT&,double,double>());
+    py::class_<ThetaMAC<TreeT>>(m, "ThetaMAC")
+        .def(py::init<double>());
+    py::class_<ErrorMAC<TreeT>>(m, "ErrorMAC")
+        .def(py::init<const TreeT&,const TreeT&,size_t,double>());
+    wrap_mac_traversal<TreeT, BallMAC<TreeT>>(m);
+    wrap_mac_traversal<TreeT, BoxMAC<TreeT>>(m);
+    wrap_mac_traversal<TreeT, ThetaMAC<TreeT>>(m);
+    wrap_mac_traversal<TreeT, ErrorMAC<TreeT>>(m);
+
+    return tree;
 }
 
 template <size_t dim>
@@ -77,14 +165,72 @@ void wrap_dim(py::module& m) {
         .def_readonly("center", &Ball<dim>::center)
         .def_readonly("R", &Ball<dim>::R);
 
+    // Octrees and kd-trees share the node type, so it lives beside Ball.
+    using Node = TreeNode<dim>;
+    py::class_<Node>(m, "TreeNode")
+        .def_readonly("start", &Node::start)
+        .def_readonly("end", &Node::end)
+        .def_readonly("bounds", &Node::bounds)
+        .def_readonly("is_leaf", &Node::is_leaf)
+        .def_readonly("idx", &Node::idx)
+        .def_readonly("height", &Node::height)
+        .def_readonly("depth", &Node::depth)
+        .def_readonly("first_child", &Node::first_child)
+        .def_readonly("n_children", &Node::n_children)
+        .def_property_readonly("children", [] (const Node& n) {
+            std::vector<size_t> out(n.n_children);
+            for (size_t i = 0; i < n.n_children; i++) {
+                out[i] = n.child(i);
+            }
+            return out;
+        });
+
     auto octree = m.def_submodule("octree");
     auto kdtree = m.def_submodule("kdtree");
 
-    wrap_fmm<Octree<dim>>(octree);
-    wrap_fmm<KDTree<dim>>(kdtree);
+    wrap_fmm<Octree<dim>>(octree)
+        .def_static("build_morton", wrap_build_fnc<Octree<dim>>(build_octree_morton<dim>))
+        .def_static("build_compact", wrap_build_fnc<Octree<dim>>(build_octree_compact<dim>));
+    auto kd_build_fnc = [] (KDSplit split) {
+        return wrap_build_fnc<KDTree<dim>>(
+            [=] (std::array<double,dim>* balls, double* R, size_t n_balls, size_t n_per_cell) {
+                return build_kdtree_split(balls, R, n_balls, n_per_cell, split);
+            }
+        );
+    };
+    wrap_fmm<KDTree<dim>>(kdtree)
+        .def_static("build_median", kd_build_fnc(KDSplit::median))
+        .def_static("build_widest", kd_build_fnc(KDSplit::widest))
+        .def_static("build_cost", kd_build_fnc(KDSplit::cost));
 }
 
 
+template <typename I>
+void wrap_interactions(py::module& m, std::string suffix) {
+    using ListT = CompressedInteractionListT<I>;
+    py::class_<ListT>(m, ("CompressedInteractionList" + suffix).c_str())
+        .def(py::init([] (NPArray<I> obs_n_idxs, NPArray<I> obs_src_starts,
+                NPArray<I> src_n_idxs) 
+            {
+                return ListT{
+                    get_vector<I>(obs_n_idxs),
+                    get_vector<I>(obs_src_starts),
+                    get_vector<I>(src_n_idxs)
+                };
+            }))
+        .NPARRAYPROP(ListT, obs_n_idxs)
+        .NPARRAYPROP(ListT, obs_src_starts)
+        .NPARRAYPROP(ListT, src_n_idxs);
+
+    using InteractionsI = InteractionsT<I>;
+#define OP(NAME)\
+        def_readwrite(#NAME, &InteractionsI::NAME)
+    py::class_<InteractionsI>(m, ("Interactions" + suffix).c_str())
+        .def(py::init<>())
+        .OP(u2e).OP(d2e).OP(p2m).OP(m2m).OP(p2l).OP(m2l).OP(l2l).OP(p2p).OP(m2p).OP(l2p);
+#undef OP
+}
+
 PYBIND11_MODULE(traversal_wrapper,m) {
     auto two = m.def_submodule("two");
     auto three = m.def_submodule("three");
@@ -92,14 +238,6 @@ PYBIND11_MODULE(traversal_wrapper,m) {
     wrap_dim<2>(two);
     wrap_dim<3>(three);
 
-    py::class_<CompressedInteractionList>(m, "CompressedInteractionList")
-        .NPARRAYPROP(CompressedInteractionList, obs_n_idxs)
-        .NPARRAYPROP(CompressedInteractionList, obs_src_starts)
-        .NPARRAYPROP(CompressedInteractionList, src_n_idxs);
-
-#define OP(NAME)\
-        def_readonly(#NAME, &Interactions::NAME)
-    py::class_<Interactions>(m, "Interactions")
-        .OP(u2e).OP(d2e).OP(p2m).OP(m2m).OP(p2l).OP(m2l).OP(l2l).OP(p2p).OP(m2p).OP(l2p);
-#undef OP
+    wrap_interactions<size_t>(m, "");
+    wrap_interactions<int32_t>(m, "32");
 }
@@ -1,7 +1,9 @@
 #pragma once
 #include "geometry.hpp"
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 template <size_t dim>
 struct BallWithIdx {
@@ -69,3 +71,198 @@ std::vector<BallWithIdx<dim>> combine_balls_idxs(
     }
     return balls_idxs;
 }
+
+// The nodes of a tree, stored as a structure of arrays. This is the only
+// copy of the node data: the traversals read the arrays directly and they
+// are handed to numpy and the GPU without copying. The children of a node are
+// stored contiguously after their parent, so they are the range
+// [first_child, first_child + n_children). Leaves are the nodes without
+// children and have first_child = 0.
+template <size_t dim>
+struct NodeArrays {
+    std::vector<std::array<double,dim>> centers;
+    std::vector<double> Rs;
+    std::vector<size_t> starts;
+    std::vector<size_t> ends;
+    std::vector<int> depths;
+    std::vector<int> heights;
+    std::vector<size_t> first_child;
+    std::vector<size_t> n_children;
+
+    size_t size() const { return starts.size(); }
+    bool is_leaf(size_t i) const { return n_children[i] == 0; }
+    size_t n_balls(size_t i) const { return ends[i] - starts[i]; }
+    Ball<dim> bounds(size_t i) const { return {centers[i], Rs[i]}; }
+
+    void resize(size_t n) {
+        centers.resize(n);
+        Rs.resize(n);
+        starts.resize(n);
+        ends.resize(n);
+        depths.resize(n);
+        heights.resize(n);
+        first_child.resize(n);
+        n_children.resize(n);
+    }
+};
+
+// One node gathered from the node arrays, for inspection from Python and in
+// tests. The traversals don't use this.
+template <size_t dim>
+struct TreeNode {
+    size_t start;
+    size_t end;
+    Ball<dim> bounds;
+    bool is_leaf;
+    int height;
+    int depth;
+    size_t idx;
+    size_t first_child;
+    size_t n_children;
+
+    size_t child(size_t i) const { return first_child + i; }
+};
+
+template <size_t dim>
+TreeNode<dim> get_node(const NodeArrays<dim>& arrs, size_t i) {
+    return {
+        arrs.starts[i], arrs.ends[i], arrs.bounds(i), arrs.is_leaf(i),
+        arrs.heights[i], arrs.depths[i], i, arrs.first_child[i], arrs.n_children[i]
+    };
+}
+
+// The builders grow a vector of nodes with an array of children each, which
+// is convenient while subtrees are being spliced together. Once the tree is
+// complete, the nodes are moved into the node arrays and the build nodes are
+// freed.
+template <typename TreeT, typename BuildNodeT>
+void set_nodes(TreeT& tree, std::vector<BuildNodeT>&& build_nodes) {
+    auto n_nodes = build_nodes.size();
+    auto& arrs = tree.nodes;
+    arrs.resize(n_nodes);
+#pragma omp parallel for
+    for (size_t i = 0; i < n_nodes; i++) {
+        auto& n = build_nodes[i];
+        arrs.centers[i] = n.bounds.center;
+        arrs.Rs[i] = n.bounds.R;
+        arrs.starts[i] = n.start;
+        arrs.ends[i] = n.end;
+        arrs.depths[i] = n.depth;
+        arrs.heights[i] = n.height;
+        arrs.first_child[i] = n.is_leaf ? 0 : n.children[0];
+        arrs.n_children[i] = n.is_leaf ? 0 : n.n_children;
+    }
+    tree.max_height = (n_nodes == 0) ? 0 : arrs.heights[0];
+    std::vector<BuildNodeT>().swap(build_nodes);
+}
+
+// Fills in the node heights from the children. Children are always stored
+// after their parent, so one reverse pass is enough.
+template <size_t dim>
+void compute_heights(NodeArrays<dim>& arrs) {
+    for (size_t i = arrs.size(); i > 0; i--) {
+        auto n = i - 1;
+        arrs.heights[n] = 0;
+        for (size_t c = 0; c < arrs.n_children[n]; c++) {
+            arrs.heights[n] = std::max(
+                arrs.heights[n], arrs.heights[arrs.first_child[n] + c] + 1
+            );
+        }
+    }
+}
+
+// Reassembles a tree from its sorted balls, orig_idxs and node arrays, for
+// example after they have been loaded from disk. The heights aren't stored,
+// they're implied by the children.
+template <typename TreeT>
+TreeT tree_from_arrays(std::vector<Ball<TreeT::dim>> balls,
+    std::vector<size_t> orig_idxs, NodeArrays<TreeT::dim> arrs)
+{
+    TreeT tree;
+    arrs.heights.resize(arrs.size());
+    compute_heights(arrs);
+    tree.max_height = arrs.heights[0];
+    tree.balls = std::move(balls);
+    tree.orig_idxs = std::move(orig_idxs);
+    tree.nodes = std::move(arrs);
+    return tree;
+}
+
+// Moves the balls of an already built tree to new centers and radii, given in
+// the original (unsorted) order, while keeping the node topology. Node bounds
+// are recomputed bottom-up, one height level at a time, with the nodes of a
+// level in parallel. The bounds are the same center of mass balls that a build
+// produces, but the center of an internal node is formed from its children's
+// centers rather than by summing over all of its balls.
+template <typename TreeT>
+void refit(TreeT& tree, std::array<double,TreeT::dim>* in_balls, double* in_R) {
+    constexpr size_t dim = TreeT::dim;
+    auto& nodes = tree.nodes;
+
+#pragma omp parallel for
+    for (size_t i = 0; i < tree.balls.size(); i++) {
+        auto orig_idx = tree.orig_idxs[i];
+        tree.balls[i] = {in_balls[orig_idx], in_R[orig_idx]};
+    }
+
+    std::vector<std::vector<size_t>> levels(tree.max_height + 1);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        levels[nodes.heights[i]].push_back(i);
+    }
+
+    for (auto& level: levels) {
+#pragma omp parallel for
+        for (size_t i = 0; i < level.size(); i++) {
+            auto n = level[i];
+            size_t n_balls = nodes.n_balls(n);
+            if (n_balls == 0) {
+                // Empty nodes are placed by their parent below.
+                continue;
+            } else if (n_balls == 1) {
+                nodes.centers[n] = tree.balls[nodes.starts[n]].center;
+                nodes.Rs[n] = tree.balls[nodes.starts[n]].R;
+                continue;
+            }
+
+            std::array<double,dim> com{};
+            double max_r = 0.0;
+            if (nodes.is_leaf(n)) {
+                for (size_t j = nodes.starts[n]; j < nodes.ends[n]; j++) {
+                    for (size_t d = 0; d < dim; d++) {
+                        com[d] += tree.balls[j].center[d];
+                    }
+                }
+            } else {
+                for (size_t c = 0; c < nodes.n_children[n]; c++) {
+                    auto child = nodes.first_child[n] + c;
+                    for (size_t d = 0; d < dim; d++) {
+                        com[d] += nodes.centers[child][d] * nodes.n_balls(child);
+                    }
+                }
+            }
+            for (size_t d = 0; d < dim; d++) {
+                com[d] /= n_balls;
+            }
+            for (size_t j = nodes.starts[n]; j < nodes.ends[n]; j++) {
+                max_r = std::max(
+                    max_r, dist(tree.balls[j].center, com) + tree.balls[j].R
+                );
+            }
+            nodes.centers[n] = com;
+            nodes.Rs[n] = max_r;
+
+            for (size_t c = 0; c < nodes.n_children[n]; c++) {
+                auto child = nodes.first_child[n] + c;
+                if (nodes.n_balls(child) == 0) {
+                    nodes.centers[child] = com;
+                    nodes.Rs[child] = max_r / 50.0;
+                }
+            }
+        }
+    }
+
+    if (nodes.n_balls(0) == 0) {
+        nodes.centers[0] = std::array<double,dim>{};
+        nodes.Rs[0] = 1.0;
+    }
+}
@@ -278,14 +278,16 @@ ${fmm_op("p2p", "pts", "pts", True)}
 ${fmm_op("s2p", "pts", "surf", False)}
 
 
+// The c2e operator is a truncated SVD: UT is (n_rank, n_rows), E has n_rank
+// entries and V is (n_rows, n_rank).
 KERNEL
 void c2e_kernel1(GLOBAL_MEM Real* out, GLOBAL_MEM Real* in,
-        int n_nodes, int n_rows, GLOBAL_MEM int* node_idxs,
+        int n_nodes, int n_rows, int n_rank, GLOBAL_MEM int* node_idxs,
         GLOBAL_MEM Real* UT)
 {
     const int idx = get_global_id(0);
     const int row_idx = get_global_id(1);
-    if (row_idx >= n_rows || idx >= n_nodes) {
+    if (row_idx >= n_rank || idx >= n_nodes) {
         return;
     }
     const int node_idx = node_idxs[idx];
@@ -301,7 +303,7 @@ void c2e_kernel1(GLOBAL_MEM Real* out, GLOBAL_MEM Real* in,
 
 KERNEL
 void c2e_kernel2(GLOBAL_MEM Real* out, GLOBAL_MEM Real* in,
-        int n_nodes, int n_rows, GLOBAL_MEM int* node_idxs,
+        int n_nodes, int n_rows, int n_rank, GLOBAL_MEM int* node_idxs,
         GLOBAL_MEM Real* node_R, Real alpha, GLOBAL_MEM Real* V,
         GLOBAL_MEM Real* E)
 {
@@ -314,8 +316,8 @@ void c2e_kernel2(GLOBAL_MEM Real* out, GLOBAL_MEM Real* in,
     const Real R = node_R[node_idx];
 
     Real sum2 = 0.0;
-    for (int j = 0; j < n_rows; j++) {
-        Real Vv = V[row_idx * n_rows + j];
+    for (int j = 0; j < n_rank; j++) {
+        Real Vv = V[row_idx * n_rank + j];
         Real Ev = E[j];
         Real REv = pow(R, ${K.scale_type} + 4) * Ev;
         Real invEv = REv / (REv * REv + alpha * alpha);
@@ -1,12 +1,25 @@
 <%!
 def dn(dim):
     return ['x', 'y', 'z'][dim]
+# The coefficients are stored packed: only the pairs with 0 <= m <= n, in the
+# order (0,0), (1,0), (1,1), (2,0), ... so (n, m) is at tri_idx(n) + m.
+def tri_idx(n):
+    return '(((' + n + ') * ((' + n + ') + 1)) / 2)'
 from tectosaur.kernels import kernels
 e = [[[int((i - j) * (j - k) * (k - i) / 2) for k in range(3)]
     for j in range(3)] for i in range(3)]
 %>
 <%
     multipole_dim = K.multipole_dim
+    multipoles_per_cell = (order + 1) * (order + 2) // 2 * multipole_dim * 2
+    # The (A, B, i) channel triples where channel B holds the D_i weighted
+    # version of channel A. The B channels depend on the expansion center, so
+    # when an expansion is moved by F = old center - new center, the
+    # translated A channel times F_i is added to the translated B channel.
+    if K.name == "elasticRH3":
+        d_channels = [(10 + j, 13 + i * 3 + j, i) for i in range(3) for j in range(3)]
+    else:
+        d_channels = [(3, 4 + i, i) for i in range(3)]
 %>
 ${cluda_preamble}
 
@@ -161,7 +174,16 @@ ${cluda_preamble}
 % endif
 </%def>
 
-<%def name="m2p_core(n, real, imag)">
+<%def name="m2p_rhs(n, real, imag, arr = 'sh_multipoles')">
+// The irregular solid harmonic is shared by all the right hand sides.
+for (int r = 0; r < ${n_rhs}; r++) {
+    Real* sum = sum_rhs[r];
+    Real (*basissum)[3] = basissum_rhs[r];
+    ${m2p_core(n, real, imag, "(" + arr + " + r * " + str(multipoles_per_cell) + ")")}
+}
+</%def>
+
+<%def name="m2p_core(n, real, imag, arr = 'sh_multipoles')">
 {
     % if K.name == "elasticU3":
         Real mult = 1.0;
@@ -175,11 +197,11 @@ ${cluda_preamble}
             Real imag_val = C * (${imag});
             for (int d = 0; d < 3; d++) {
                 int idx =
-                    (${n}) * ${multipole_dim * 2 * (order + 1)}
+                    ${tri_idx(n)} * ${multipole_dim * 2}
                     + mi * ${multipole_dim} * 2
                     + d * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 sum[d] += Rr * real_val + Ri * imag_val;
             }
         }
@@ -190,20 +212,20 @@ ${cluda_preamble}
             Real imag_val = C * (${imag}); 
 
             int idx = 
-                (${n}) * ${multipole_dim * 2 * (order + 1)} 
+                ${tri_idx(n)} * ${multipole_dim * 2} 
                 + mi * ${multipole_dim * 2} 
                 + 3 * 2;
-            Real Rr = sh_multipoles[idx];
-            Real Ri = sh_multipoles[idx + 1];
+            Real Rr = ${arr}[idx];
+            Real Ri = ${arr}[idx + 1];
             Real Aval = Rr * real_val + Ri * imag_val;
             % for d1 in range(3):
             {
                 int idx = 
-                    (${n}) * ${multipole_dim * 2 * (order + 1)} 
+                    ${tri_idx(n)} * ${multipole_dim * 2} 
                     + mi * ${multipole_dim * 2} 
                     + (4 + ${d1}) * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 Real Bval = Rr * real_val + Ri * imag_val;
 
                 sum[${d1}] += D${dn(d1)} * Aval - Bval;
@@ -222,11 +244,11 @@ ${cluda_preamble}
             Real imag_val = C * (${imag});
             for (int d = 0; d < 3; d++) {
                 int idx =
-                    (${n}) * ${multipole_dim * 2 * (order + 1)}
+                    ${tri_idx(n)} * ${multipole_dim * 2}
                     + mi * ${multipole_dim} * 2
                     + d * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 sum[d] += Rr * real_val + Ri * imag_val;
             }
         }
@@ -238,20 +260,20 @@ ${cluda_preamble}
             Real imag_val = C * (${imag}); 
 
             int idx = 
-                (${n}) * ${multipole_dim * 2 * (order + 1)} 
+                ${tri_idx(n)} * ${multipole_dim * 2} 
                 + mi * ${multipole_dim * 2} 
                 + 3 * 2;
-            Real Rr = sh_multipoles[idx];
-            Real Ri = sh_multipoles[idx + 1];
+            Real Rr = ${arr}[idx];
+            Real Ri = ${arr}[idx + 1];
             Real Aval = Rr * real_val + Ri * imag_val;
             % for d1 in range(3):
             {
                 int idx = 
-                    (${n}) * ${multipole_dim * 2 * (order + 1)} 
+                    ${tri_idx(n)} * ${multipole_dim * 2} 
                     + mi * ${multipole_dim * 2} 
                     + (4 + ${d1}) * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 Real Bval = Rr * real_val + Ri * imag_val;
 
                 sum[${d1}] += D${dn(d1)} * Aval - Bval;
@@ -271,11 +293,11 @@ ${cluda_preamble}
             % for dsrc in range(3):
             {
                 int idx =
-                    (${n}) * ${multipole_dim * 2 * (order + 1)}
+                    ${tri_idx(n)} * ${multipole_dim * 2}
                     + mi * ${multipole_dim} * 2
                     + ${dsrc} * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 Real SR = Rr * real_val + Ri * imag_val;
                 % for dobs in range(3):
                     % for j in range(3):
@@ -299,20 +321,20 @@ ${cluda_preamble}
             Real imag_val = C * (${imag}); 
 
             int idx = 
-                (${n}) * ${multipole_dim * 2 * (order + 1)} 
+                ${tri_idx(n)} * ${multipole_dim * 2} 
                 + mi * ${multipole_dim * 2} 
                 + 3 * 2;
-            Real Rr = sh_multipoles[idx];
-            Real Ri = sh_multipoles[idx + 1];
+            Real Rr = ${arr}[idx];
+            Real Ri = ${arr}[idx + 1];
             Real Aval = Rr * real_val + Ri * imag_val;
             % for p in range(3):
             {
                 int idx = 
-                    (${n}) * ${multipole_dim * 2 * (order + 1)} 
+                    ${tri_idx(n)} * ${multipole_dim * 2} 
                     + mi * ${multipole_dim * 2} 
                     + (4 + ${p}) * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 Real Bval = Rr * real_val + Ri * imag_val;
                 % for dobs in range(3):
                 % for j in range(3):
@@ -339,11 +361,11 @@ ${cluda_preamble}
             Real imag_val = C * (${imag});
             {
                 int idx =
-                    (${n}) * ${multipole_dim * 2 * (order + 1)}
+                    ${tri_idx(n)} * ${multipole_dim * 2}
                     + mi * ${multipole_dim} * 2
                     + 0 * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 Real SR = CsRH1 * (Rr * real_val + Ri * imag_val);
                 % for dobs in range(3):
                     for (int bobs = 0; bobs < 3; bobs++) {
@@ -356,11 +378,11 @@ ${cluda_preamble}
             % for j in range(3):
             {
                 int idx =
-                    (${n}) * ${multipole_dim * 2 * (order + 1)}
+                    ${tri_idx(n)} * ${multipole_dim * 2}
                     + mi * ${multipole_dim} * 2
                     + (1 + ${dobs * 3 + j}) * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 Real SR = Rr * real_val + Ri * imag_val;
                 for (int bobs = 0; bobs < 3; bobs++) {
                     basissum[bobs][${dobs}] -= 2 * bobs_surf_curl[bobs][${j}] * SR;
@@ -373,11 +395,11 @@ ${cluda_preamble}
             % for j in range(3):
             {
                 int idx =
-                    (${n}) * ${multipole_dim * 2 * (order + 1)}
+                    ${tri_idx(n)} * ${multipole_dim * 2}
                     + mi * ${multipole_dim} * 2
                     + (10 + ${j}) * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 Real SR = Rr * real_val + Ri * imag_val;
                 % for dobs in range(3):
                 for (int bobs = 0; bobs < 3; bobs++) {
@@ -391,11 +413,11 @@ ${cluda_preamble}
             % for j in range(3):
             {
                 int idx =
-                    (${n}) * ${multipole_dim * 2 * (order + 1)}
+                    ${tri_idx(n)} * ${multipole_dim * 2}
                     + mi * ${multipole_dim} * 2
                     + (13 + ${dobs * 3 + j}) * 2;
-                Real Rr = sh_multipoles[idx];
-                Real Ri = sh_multipoles[idx + 1];
+                Real Rr = ${arr}[idx];
+                Real Ri = ${arr}[idx + 1];
                 Real SR = Rr * real_val + Ri * imag_val;
                 for (int bobs = 0; bobs < 3; bobs++) {
                     basissum[bobs][${dobs}] += 2 * bobs_surf_curl[bobs][${j}] * SR;
@@ -418,13 +440,33 @@ ${prim.geometry_fncs()}
 CONSTANT Real quad_pts[${quad_pts.size}] = {${str(quad_pts.flatten().tolist())[1:-1]}};
 CONSTANT Real quad_wts[${quad_wts.size}] = {${str(quad_wts.flatten().tolist())[1:-1]}};
 
-<%def name="multipole_idx(node_idx, n_idx, m_idx, d_idx)">
-    (${node_idx} * ${multipole_dim * 2 * (order + 1) * (order + 1)}
-    + ${n_idx} * ${multipole_dim * 2 * (order + 1)}
-    + ${m_idx} * ${multipole_dim * 2}
+<%def name="multipole_idx(node_idx, n_idx, m_idx, d_idx, r_idx = 'r')">
+    ((${node_idx} * ${n_rhs} + ${r_idx}) * ${multipoles_per_cell}
+    + (${tri_idx(n_idx)} + ${m_idx}) * ${multipole_dim * 2}
     + ${d_idx} * 2)
 </%def>
 
+<%def name="decl_sums()">
+    Real sumreal_rhs[${n_rhs}][${order + 1}][${order + 1}][${multipole_dim}];
+    Real sumimag_rhs[${n_rhs}][${order + 1}][${order + 1}][${multipole_dim}];
+
+    for (int r = 0; r < ${n_rhs}; r++) {
+        for (int i = 0; i < ${order + 1}; i++) {
+            for (int j = 0; j < ${order + 1}; j++) {
+                for (int d = 0; d < ${multipole_dim}; d++) {
+                    sumreal_rhs[r][i][j][d] = 0.0;
+                    sumimag_rhs[r][i][j][d] = 0.0;
+                }
+            }
+        }
+    }
+</%def>
+
+<%def name="select_rhs_sums()">
+    Real (*sumreal)[${order + 1}][${multipole_dim}] = sumreal_rhs[r];
+    Real (*sumimag)[${order + 1}][${multipole_dim}] = sumimag_rhs[r];
+</%def>
+
 KERNEL void p2p(
     GLOBAL_MEM Real* out,
     GLOBAL_MEM Real* inarr,
@@ -457,11 +499,22 @@ KERNEL void p2p(
     ${prim.decl_tri_info("obs", K.needs_obsn, K.surf_curl_obs)}
     ${prim.tri_info("obs", "obs_pts", "obs_tris", K.needs_obsn, K.surf_curl_obs)}
 
-    Real sum[9];
-    for (int d = 0; d < 9; d++) {
-        sum[d] = 0.0;
+    Real sum_rhs[${n_rhs}][9];
+    for (int r = 0; r < ${n_rhs}; r++) {
+        for (int d = 0; d < 9; d++) {
+            sum_rhs[r][d] = 0.0;
+        }
     }
 
+    % if symmetric_p2p:
+    Real obs_in[${n_rhs}][9];
+    for (int k = 0; k < 9; k++) {
+        for (int r = 0; r < ${n_rhs}; r++) {
+            obs_in[r][k] = inarr[(obs_tri_idx * 9 + k) * ${n_rhs} + r];
+        }
+    }
+    % endif
+
     for (int src_block_idx = this_obs_src_start;
          src_block_idx < this_obs_src_end;
          src_block_idx++) 
@@ -475,11 +528,22 @@ KERNEL void p2p(
             ${prim.decl_tri_info("src", K.needs_srcn, K.surf_curl_src)}
             ${prim.tri_info("src", "src_pts", "src_tris", K.needs_srcn, K.surf_curl_src)}
 
-            Real in[9];
+            Real in_rhs[${n_rhs}][9];
             for (int k = 0; k < 9; k++) {
-                in[k] = inarr[src_tri_idx * 9 + k];
+                for (int r = 0; r < ${n_rhs}; r++) {
+                    in_rhs[r][k] = inarr[(src_tri_idx * 9 + k) * ${n_rhs} + r];
+                }
             }
 
+            % if symmetric_p2p:
+            Real src_sum[${n_rhs}][9];
+            for (int r = 0; r < ${n_rhs}; r++) {
+                for (int d = 0; d < 9; d++) {
+                    src_sum[r][d] = 0.0;
+                }
+            }
+            % endif
+
             for (int iq1 = 0; iq1 < ${quad_wts.shape[0]}; iq1++) {
                 Real obsxhat = quad_pts[iq1 * 2 + 0];
                 Real obsyhat = quad_pts[iq1 * 2 + 1];
@@ -507,31 +571,92 @@ KERNEL void p2p(
                     % endif
 
                     Real factor = obs_jacobian * src_jacobian * quadw;
-                    % for d in range(3):
-                        Real sum${dn(d)} = 0.0;
-                        Real in${dn(d)} = 0.0;
-                        for (int b_src = 0; b_src < 3; b_src++) {
-                            in${dn(d)} += in[b_src * 3 + ${d}] * srcb[b_src];
+
+                    // The geometry above is shared by all the right hand sides.
+                    // The vector code reads in and writes sum.
+                    for (int r = 0; r < ${n_rhs}; r++) {
+                        Real* in = in_rhs[r];
+                        Real* sum = sum_rhs[r];
+                        % for d in range(3):
+                            Real sum${dn(d)} = 0.0;
+                            Real in${dn(d)} = 0.0;
+                            for (int b_src = 0; b_src < 3; b_src++) {
+                                in${dn(d)} += in[b_src * 3 + ${d}] * srcb[b_src];
+                            }
+                        % endfor
+
+                        {
+                            ${prim.call_vector_code(K)}
                         }
-                    % endfor
 
-                    ${prim.call_vector_code(K)}
+                        for (int b_obs = 0; b_obs < 3; b_obs++) {
+                            % for d_obs in range(3):
+                            sum[b_obs * 3 + ${d_obs}] += factor * obsb[b_obs] * sum${dn(d_obs)};
+                            % endfor
+                        }
 
-                    for (int b_obs = 0; b_obs < 3; b_obs++) {
-                        % for d_obs in range(3):
-                        sum[b_obs * 3 + ${d_obs}] += factor * obsb[b_obs] * sum${dn(d_obs)};
-                        % endfor
+                        % if symmetric_p2p:
+                        // The kernel is symmetric under swapping x and y, so the
+                        // effect of the obs tri on the src tri is the same
+                        // vector code applied to the obs tri's input.
+                        {
+                            % for d in range(3):
+                                Real sum${dn(d)} = 0.0;
+                                Real in${dn(d)} = 0.0;
+                                for (int b_obs = 0; b_obs < 3; b_obs++) {
+                                    in${dn(d)} += obs_in[r][b_obs * 3 + ${d}] * obsb[b_obs];
+                                }
+                            % endfor
+
+                            ${prim.call_vector_code(K)}
+
+                            for (int b_src = 0; b_src < 3; b_src++) {
+                                % for d_src in range(3):
+                                src_sum[r][b_src * 3 + ${d_src}] +=
+                                    factor * srcb[b_src] * sum${dn(d_src)};
+                                % endfor
+                            }
+                        }
+                        % endif
+                    }
+                }
+            }
+
+            % if symmetric_p2p:
+            // Blocks between distinct leaves are only listed once, so they
+            // are applied in both directions here. In the diagonal blocks,
+            // the src tri's thread handles its own output.
+            if (obs_tri_idx < src_n_start[this_src_n_idx] ||
+                    obs_tri_idx >= src_n_end[this_src_n_idx]) 
+            {
+                for (int k = 0; k < 9; k++) {
+                    for (int r = 0; r < ${n_rhs}; r++) {
+                        atomicAdd(&out[(src_tri_idx * 9 + k) * ${n_rhs} + r], src_sum[r][k]);
                     }
                 }
             }
+            % endif
         }
     }
     for (int k = 0; k < 9; k++) {
-        out[obs_tri_idx * 9 + k] = sum[k];
+        for (int r = 0; r < ${n_rhs}; r++) {
+            % if symmetric_p2p:
+                atomicAdd(&out[(obs_tri_idx * 9 + k) * ${n_rhs} + r], sum_rhs[r][k]);
+            % else:
+                out[(obs_tri_idx * 9 + k) * ${n_rhs} + r] = sum_rhs[r][k];
+            % endif
+        }
     }
 }
 
 <%def name="multipole_sum(n, m, real, imag)">
+// The regular solid harmonic is shared by all the right hand sides.
+for (int r = 0; r < ${n_rhs}; r++) {
+    ${select_rhs_sums()}
+    Real* invals = invals_rhs[r];
+    % if K.surf_curl_src:
+        Real (*src_surf_curl)[3] = src_surf_curl_rhs[r];
+    % endif
     ${p2m_core(n, m, real, imag)}
     ${out_sum_dR(n, m, real, imag)}
     if (mi == 1) {
@@ -539,6 +664,7 @@ KERNEL void p2p(
             "(" + n + ")", "(-1)", "(-" + real + ")", "(" + imag + ")"
         )}
     }
+}
 </%def>
 
 <%def name="out_sum_dR(n, m, real, imag)">
@@ -589,12 +715,15 @@ KERNEL void p2p(
 </%def>
 
 <%def name="finish_multipole_sum()">
-    for (int i = 0; i < ${order + 1}; i++) {
-        for (int j = 0; j < ${order + 1}; j++) {
-            for (int d = 0; d < ${multipole_dim}; d++) {
-                int idx = ${multipole_idx("this_obs_n_idx", "i", "j", "d")};
-                multipoles[idx] = sumreal[i][j][d];
-                multipoles[idx + 1] = sumimag[i][j][d];
+    for (int r = 0; r < ${n_rhs}; r++) {
+        ${select_rhs_sums()}
+        for (int i = 0; i < ${order + 1}; i++) {
+            for (int j = 0; j <= i; j++) {
+                for (int d = 0; d < ${multipole_dim}; d++) {
+                    int idx = ${multipole_idx("this_obs_n_idx", "i", "j", "d")};
+                    multipoles[idx] = sumreal[i][j][d];
+                    multipoles[idx + 1] = sumimag[i][j][d];
+                }
             }
         }
     }
@@ -622,17 +751,7 @@ KERNEL void p2m(
     Real xy = n_centers[this_obs_n_idx * 3 + 1];
     Real xz = n_centers[this_obs_n_idx * 3 + 2];
 
-    Real sumreal[${order + 1}][${order + 1}][${multipole_dim}];
-    Real sumimag[${order + 1}][${order + 1}][${multipole_dim}];
-
-    for (int i = 0; i < ${order + 1}; i++) {
-        for (int j = 0; j < ${order + 1}; j++) {
-            for (int d = 0; d < ${multipole_dim}; d++) {
-                sumreal[i][j][d] = 0.0;
-                sumimag[i][j][d] = 0.0;
-            }
-        }
-    }
+    ${decl_sums()}
 
     for (int src_tri_idx = n_starts[this_obs_n_idx];
             src_tri_idx < n_ends[this_obs_n_idx];
@@ -641,9 +760,11 @@ KERNEL void p2m(
         const int src_tri_rot_clicks = 0;
         ${prim.decl_tri_info("src", K.needs_srcn, K.surf_curl_src)}
         ${prim.tri_info("src", "src_pts", "src_tris", K.needs_srcn, K.surf_curl_src)}
-        Real in[9];
+        Real in_rhs[${n_rhs}][9];
         for (int k = 0; k < 9; k++) {
-            in[k] = src_in[src_tri_idx * 9 + k];
+            for (int r = 0; r < ${n_rhs}; r++) {
+                in_rhs[r][k] = src_in[(src_tri_idx * 9 + k) * ${n_rhs} + r];
+            }
         }
 
         for (int iq = 0; iq < ${quad_wts.shape[0]}; iq++) {
@@ -663,25 +784,29 @@ KERNEL void p2m(
             Real r2 = Dx * Dx + Dy * Dy + Dz * Dz;
 
             Real factor = src_jacobian * quadw;
-            Real invals[3];
-            for (int d = 0; d < 3; d++) {
-                invals[d] = 0.0;
-                for (int b_src = 0; b_src < 3; b_src++) {
-                    invals[d] += factor * in[b_src * 3 + d] * srcb[b_src];
+            Real invals_rhs[${n_rhs}][3];
+            for (int r = 0; r < ${n_rhs}; r++) {
+                for (int d = 0; d < 3; d++) {
+                    invals_rhs[r][d] = 0.0;
+                    for (int b_src = 0; b_src < 3; b_src++) {
+                        invals_rhs[r][d] += factor * in_rhs[r][b_src * 3 + d] * srcb[b_src];
+                    }
                 }
             }
 
 
             % if K.surf_curl_src:
-                Real src_surf_curl[3][3];
-                for (int d = 0; d < 3; d++) {
-                    for (int Ij = 0; Ij < 3; Ij++) {
-                        src_surf_curl[d][Ij] = 0.0;
-                        for (int b_src = 0; b_src < 3; b_src++) {
-                            src_surf_curl[d][Ij] += 
-                                factor * 
-                                bsrc_surf_curl[b_src][Ij]
-                                * in[b_src * 3 + d];
+                Real src_surf_curl_rhs[${n_rhs}][3][3];
+                for (int r = 0; r < ${n_rhs}; r++) {
+                    for (int d = 0; d < 3; d++) {
+                        for (int Ij = 0; Ij < 3; Ij++) {
+                            src_surf_curl_rhs[r][d][Ij] = 0.0;
+                            for (int b_src = 0; b_src < 3; b_src++) {
+                                src_surf_curl_rhs[r][d][Ij] += 
+                                    factor * 
+                                    bsrc_surf_curl[b_src][Ij]
+                                    * in_rhs[r][b_src * 3 + d];
+                            }
                         }
                     }
                 }
@@ -749,10 +874,12 @@ for (int ni = (${nip}); ni <= ${order}; ni++) {
 
             int mi_diff = mi - full_mip;
             int pos_mi_diff = abs(mi_diff);
-            int start_idx = this_src_n_idx * ${multipole_dim * 2 * (order + 1) * (order + 1)}
-                + (ni_diff) * ${multipole_dim * 2 * (order + 1)}
-                + (pos_mi_diff) * ${multipole_dim * 2};
-            {
+            if (pos_mi_diff > ni_diff) {
+                continue;
+            }
+            for (int r = 0; r < ${n_rhs}; r++) {
+                ${select_rhs_sums()}
+                int start_idx = ${multipole_idx("this_src_n_idx", "ni_diff", "pos_mi_diff", "0")};
                 ${m2m_core()}
             }
         }
@@ -782,17 +909,7 @@ KERNEL void m2m(
     Real xz = n_centers[this_obs_n_idx * 3 + 2];
 
     //TODO: Could Kahan summation be helpful?
-    Real sumreal[${order + 1}][${order + 1}][${multipole_dim}];
-    Real sumimag[${order + 1}][${order + 1}][${multipole_dim}];
-
-    for (int i = 0; i < ${order + 1}; i++) {
-        for (int j = 0; j < ${order + 1}; j++) {
-            for (int d = 0; d < ${multipole_dim}; d++) {
-                sumreal[i][j][d] = 0.0;
-                sumimag[i][j][d] = 0.0;
-            }
-        }
-    }
+    ${decl_sums()}
 
     for (int src_block_idx = this_obs_src_start;
          src_block_idx < this_obs_src_end;
@@ -864,10 +981,7 @@ KERNEL void m2p_U(
 
     ${K.constants_code}
 
-    <%
-        multipoles_per_cell = (order + 1) ** 2 * multipole_dim * 2
-    %>
-    LOCAL_MEM Real sh_multipoles[${multipoles_per_cell}];
+    LOCAL_MEM Real sh_multipoles[${multipoles_per_cell * n_rhs}];
 
     int n_start = obs_n_starts[this_obs_n_idx];
     int n_end = obs_n_ends[this_obs_n_idx];
@@ -886,12 +1000,14 @@ KERNEL void m2p_U(
         int iq = outer_idx % ${quad_wts.shape[0]};
         int obs_tri_idx = n_start + (outer_idx - iq) / ${quad_wts.shape[0]};
 
-        Real sum[3];
-        Real basissum[3][3];
-        for (int d1 = 0; d1 < 3; d1++) {
-            sum[d1] = 0.0;
-            for (int d2 = 0; d2 < 3; d2++) {
-                basissum[d1][d2] = 0.0;
+        Real sum_rhs[${n_rhs}][3];
+        Real basissum_rhs[${n_rhs}][3][3];
+        for (int r = 0; r < ${n_rhs}; r++) {
+            for (int d1 = 0; d1 < 3; d1++) {
+                sum_rhs[r][d1] = 0.0;
+                for (int d2 = 0; d2 < 3; d2++) {
+                    basissum_rhs[r][d1][d2] = 0.0;
+                }
             }
         }
 
@@ -927,10 +1043,10 @@ KERNEL void m2p_U(
             const int this_src_n_idx = src_n_idxs[src_block_idx];
             LOCAL_BARRIER;
             for (int multipole_idx = worker_idx;
-                multipole_idx < ${multipoles_per_cell};
+                multipole_idx < ${multipoles_per_cell * n_rhs};
                 multipole_idx += ${n_workers_per_block}) 
             {
-                int full_arr_idx = this_src_n_idx * ${multipoles_per_cell} + multipole_idx;
+                int full_arr_idx = this_src_n_idx * ${multipoles_per_cell * n_rhs} + multipole_idx;
                 sh_multipoles[multipole_idx] = multipoles[full_arr_idx];
             }
             LOCAL_BARRIER;
@@ -953,7 +1069,7 @@ KERNEL void m2p_U(
             Real Ssr = sqrt(invr2);
             Real Ssi = 0.0;
             for (int mi = 0; mi < ${order + 1}; mi++) {
-                ${m2p_core("mi", "Ssr", "Ssi")}
+                ${m2p_rhs("mi", "Ssr", "Ssi")}
 
                 Real Sm2r = 0.0;
                 Real Sm2i = 0.0;
@@ -964,7 +1080,7 @@ KERNEL void m2p_U(
                     Real t2f = ni * ni - mi * mi;
                     Real Svr = invr2 * (t1f * Sm1r - t2f * Sm2r);
                     Real Svi = invr2 * (t1f * Sm1i - t2f * Sm2i);
-                    ${m2p_core("ni + 1", "Svr", "Svi")}
+                    ${m2p_rhs("ni + 1", "Svr", "Svi")}
 
                     Sm2r = Sm1r;
                     Sm2i = Sm1i;
@@ -979,22 +1095,439 @@ KERNEL void m2p_U(
             }
         }
 
-        for (int d1 = 0; d1 < 3; d1++) {
-            for (int d2 = 0; d2 < 3; d2++) {
-                basissum[d1][d2] += obsb[d1] * sum[d2];
+        for (int r = 0; r < ${n_rhs}; r++) {
+            for (int d1 = 0; d1 < 3; d1++) {
+                for (int d2 = 0; d2 < 3; d2++) {
+                    basissum_rhs[r][d1][d2] += obsb[d1] * sum_rhs[r][d2];
+                }
             }
         }
 
         if (outer_idx < n_outer_idxs) {
+            for (int r = 0; r < ${n_rhs}; r++) {
+                for (int d1 = 0; d1 < 3; d1++) {
+                    for (int d2 = 0; d2 < 3; d2++) {
+                        int out_idx = (obs_tri_idx * 9 + d1 * 3 + d2) * ${n_rhs} + r;
+                        % if ocl_backend:
+                            out[out_idx] += basissum_rhs[r][d1][d2];
+                        % else:
+                            atomicAdd(&out[out_idx], basissum_rhs[r][d1][d2]);
+                        % endif
+                    }
+                }
+            }
+        }
+    }
+}
+
+<%def name="finish_local_sum()">
+    for (int r = 0; r < ${n_rhs}; r++) {
+        ${select_rhs_sums()}
+        for (int i = 0; i < ${order + 1}; i++) {
+            for (int j = 0; j <= i; j++) {
+                for (int d = 0; d < ${multipole_dim}; d++) {
+                    int idx = ${multipole_idx("this_obs_n_idx", "i", "j", "d")};
+                    locals[idx] += sumreal[i][j][d];
+                    locals[idx + 1] += sumimag[i][j][d];
+                }
+            }
+        }
+    }
+</%def>
+
+<%def name="add_translated(F_sign)">
+    for (int d = 0; d < ${multipole_dim}; d++) {
+        sumreal[ni][mi][d] += valreal[d];
+        sumimag[ni][mi][d] += valimag[d];
+    }
+    % for A, B, i in d_channels:
+        sumreal[ni][mi][${B}] += ${F_sign}D${dn(i)} * valreal[${A}];
+        sumimag[ni][mi][${B}] += ${F_sign}D${dn(i)} * valimag[${A}];
+    % endfor
+</%def>
+
+// The local expansion of a node is
+//     u(x) = sum_{n,m} L_n^m conj(R_n^m(x - center))
+// with the same channels as the multipoles, so that l2p is m2p_core with R in
+// place of S. For a source y, L_n^m = S_n^m(y - center).
+KERNEL void m2l(
+    GLOBAL_MEM Real* locals,
+    GLOBAL_MEM Real* multipoles,
+    int n_blocks,
+    GLOBAL_MEM int* obs_n_idxs,
+    GLOBAL_MEM int* obs_src_starts,
+    GLOBAL_MEM int* src_n_idxs,
+    GLOBAL_MEM Real* obs_n_centers,
+    GLOBAL_MEM Real* src_n_centers)
+{
+    const int global_idx = get_global_id(0); 
+    const int block_idx = global_idx;
+    if (block_idx >= n_blocks) {
+        return;
+    }
+    const int this_obs_n_idx = obs_n_idxs[block_idx];
+    const int this_obs_src_start = obs_src_starts[block_idx];
+    const int this_obs_src_end = obs_src_starts[block_idx + 1];
+
+    Real xx = obs_n_centers[this_obs_n_idx * 3 + 0];
+    Real xy = obs_n_centers[this_obs_n_idx * 3 + 1];
+    Real xz = obs_n_centers[this_obs_n_idx * 3 + 2];
+
+    ${decl_sums()}
+
+    for (int src_block_idx = this_obs_src_start;
+         src_block_idx < this_obs_src_end;
+         src_block_idx++) 
+    {
+        const int this_src_n_idx = src_n_idxs[src_block_idx];
+
+        Real yx = src_n_centers[this_src_n_idx * 3 + 0];
+        Real yy = src_n_centers[this_src_n_idx * 3 + 1];
+        Real yz = src_n_centers[this_src_n_idx * 3 + 2];
+
+        Real Dx = xx - yx;
+        Real Dy = xy - yy; 
+        Real Dz = xz - yz;
+        Real r2 = Dx * Dx + Dy * Dy + Dz * Dz;
+        Real invr2 = 1.0 / r2;
+
+        // S_n^m(obs center - src center) for n up to 2 * order.
+        Real Sreal[${2 * order + 1}][${2 * order + 1}];
+        Real Simag[${2 * order + 1}][${2 * order + 1}];
+        Real Ssr = sqrt(invr2);
+        Real Ssi = 0.0;
+        for (int mi = 0; mi < ${2 * order + 1}; mi++) {
+            Sreal[mi][mi] = Ssr;
+            Simag[mi][mi] = Ssi;
+
+            Real Sm2r = 0.0;
+            Real Sm2i = 0.0;
+            Real Sm1r = Ssr;
+            Real Sm1i = Ssi;
+            for (int ni = mi; ni < ${2 * order}; ni++) {
+                Real t1f = (2 * ni + 1) * Dz;
+                Real t2f = ni * ni - mi * mi;
+                Real Svr = invr2 * (t1f * Sm1r - t2f * Sm2r);
+                Real Svi = invr2 * (t1f * Sm1i - t2f * Sm2i);
+                Sreal[ni + 1][mi] = Svr;
+                Simag[ni + 1][mi] = Svi;
+
+                Sm2r = Sm1r;
+                Sm2i = Sm1i;
+                Sm1r = Svr;
+                Sm1i = Svi;
+            }
+            Real Ssrold = Ssr;
+            Real Ssiold = Ssi;
+            Real F = (2 * mi + 1) * invr2;
+            Ssr = F * (Dx * Ssrold - Dy * Ssiold);
+            Ssi = F * (Dx * Ssiold + Dy * Ssrold);
+        }
+
+        for (int r = 0; r < ${n_rhs}; r++) {
+            ${select_rhs_sums()}
+            // L_n^m = (-1)^n sum_{n',m'} conj(M_n'^m') S_{n+n'}^{m+m'}
+            for (int ni = 0; ni <= ${order}; ni++) {
+                for (int mi = 0; mi <= ni; mi++) {
+                    Real valreal[${multipole_dim}];
+                    Real valimag[${multipole_dim}];
+                    for (int d = 0; d < ${multipole_dim}; d++) {
+                        valreal[d] = 0.0;
+                        valimag[d] = 0.0;
+                    }
+
+                    for (int nj = 0; nj <= ${order}; nj++) {
+                        for (int mj = -nj; mj <= nj; mj++) {
+                            int Sm = mi + mj;
+                            Real S_real = Sreal[ni + nj][abs(Sm)];
+                            Real S_imag = Simag[ni + nj][abs(Sm)];
+                            if (Sm < 0 && Sm % 2 == 0) {
+                                S_imag *= -1;
+                            } else if (Sm < 0 && Sm % 2 != 0) {
+                                S_real *= -1;
+                            }
+
+                            int start_idx = ${multipole_idx("this_src_n_idx", "nj", "abs(mj)", "0")};
+                            for (int d = 0; d < ${multipole_dim}; d++) {
+                                Real M_real = multipoles[start_idx + d * 2 + 0];
+                                Real M_imag = multipoles[start_idx + d * 2 + 1];
+                                if (mj < 0 && mj % 2 == 0) {
+                                    M_imag *= -1;
+                                } else if (mj < 0 && mj % 2 != 0) {
+                                    M_real *= -1;
+                                }
+                                valreal[d] += M_real * S_real + M_imag * S_imag;
+                                valimag[d] += M_real * S_imag - M_imag * S_real;
+                            }
+                        }
+                    }
+
+                    if (ni % 2 != 0) {
+                        for (int d = 0; d < ${multipole_dim}; d++) {
+                            valreal[d] *= -1;
+                            valimag[d] *= -1;
+                        }
+                    }
+
+                    // F = src center - obs center = -D
+                    ${add_translated("-")}
+                }
+            }
+        }
+    }
+    ${finish_local_sum()}
+}
+
+// Each row is a child node with its parent as the source.
+KERNEL void l2l(
+    GLOBAL_MEM Real* locals,
+    int n_blocks,
+    GLOBAL_MEM int* obs_n_idxs,
+    GLOBAL_MEM int* obs_src_starts,
+    GLOBAL_MEM int* src_n_idxs,
+    GLOBAL_MEM Real* n_centers)
+{
+    const int global_idx = get_global_id(0); 
+    const int block_idx = global_idx;
+    if (block_idx >= n_blocks) {
+        return;
+    }
+    const int this_obs_n_idx = obs_n_idxs[block_idx];
+    const int this_obs_src_start = obs_src_starts[block_idx];
+    const int this_obs_src_end = obs_src_starts[block_idx + 1];
+
+    Real xx = n_centers[this_obs_n_idx * 3 + 0];
+    Real xy = n_centers[this_obs_n_idx * 3 + 1];
+    Real xz = n_centers[this_obs_n_idx * 3 + 2];
+
+    ${decl_sums()}
+
+    for (int src_block_idx = this_obs_src_start;
+         src_block_idx < this_obs_src_end;
+         src_block_idx++) 
+    {
+        const int this_src_n_idx = src_n_idxs[src_block_idx];
+
+        Real yx = n_centers[this_src_n_idx * 3 + 0];
+        Real yy = n_centers[this_src_n_idx * 3 + 1];
+        Real yz = n_centers[this_src_n_idx * 3 + 2];
+
+        Real Dx = xx - yx;
+        Real Dy = xy - yy; 
+        Real Dz = xz - yz;
+        Real r2 = Dx * Dx + Dy * Dy + Dz * Dz;
+
+        // R_n^m(child center - parent center)
+        Real Rreal[${order + 1}][${order + 1}];
+        Real Rimag[${order + 1}][${order + 1}];
+        Real Rsr = 1.0;
+        Real Rsi = 0.0;
+        for (int mi = 0; mi < ${order + 1}; mi++) {
+            Rreal[mi][mi] = Rsr;
+            Rimag[mi][mi] = Rsi;
+
+            Real Rm2r = 0.0;
+            Real Rm2i = 0.0;
+            Real Rm1r = Rsr;
+            Real Rm1i = Rsi;
+            for (int ni = mi; ni < ${order}; ni++) {
+                Real factor = 1.0 / ((ni + 1) * (ni + 1) - mi * mi);
+                Real t1f = (2 * ni + 1) * Dz;
+                Real Rvr = factor * (t1f * Rm1r - r2 * Rm2r);
+                Real Rvi = factor * (t1f * Rm1i - r2 * Rm2i);
+                Rreal[ni + 1][mi] = Rvr;
+                Rimag[ni + 1][mi] = Rvi;
+
+                Rm2r = Rm1r;
+                Rm2i = Rm1i;
+                Rm1r = Rvr;
+                Rm1i = Rvi;
+            }
+            Real Rsrold = Rsr;
+            Real Rsiold = Rsi;
+            Rsr = (Dx * Rsrold - Dy * Rsiold) / (2 * (mi + 1));
+            Rsi = (Dx * Rsiold + Dy * Rsrold) / (2 * (mi + 1));
+        }
+
+        for (int r = 0; r < ${n_rhs}; r++) {
+            ${select_rhs_sums()}
+            // L_n^m(child) = sum_{n',m'} L_{n+n'}^{m+m'}(parent) conj(R_n'^m')
+            for (int ni = 0; ni <= ${order}; ni++) {
+                for (int mi = 0; mi <= ni; mi++) {
+                    Real valreal[${multipole_dim}];
+                    Real valimag[${multipole_dim}];
+                    for (int d = 0; d < ${multipole_dim}; d++) {
+                        valreal[d] = 0.0;
+                        valimag[d] = 0.0;
+                    }
+
+                    for (int nj = 0; nj <= ${order} - ni; nj++) {
+                        for (int mj = -nj; mj <= nj; mj++) {
+                            Real R_real = Rreal[nj][abs(mj)];
+                            Real R_imag = Rimag[nj][abs(mj)];
+                            if (mj < 0 && mj % 2 == 0) {
+                                R_imag *= -1;
+                            } else if (mj < 0 && mj % 2 != 0) {
+                                R_real *= -1;
+                            }
+
+                            int Lm = mi + mj;
+                            int start_idx = ${multipole_idx("this_src_n_idx", "(ni + nj)", "abs(Lm)", "0")};
+                            for (int d = 0; d < ${multipole_dim}; d++) {
+                                Real L_real = locals[start_idx + d * 2 + 0];
+                                Real L_imag = locals[start_idx + d * 2 + 1];
+                                if (Lm < 0 && Lm % 2 == 0) {
+                                    L_imag *= -1;
+                                } else if (Lm < 0 && Lm % 2 != 0) {
+                                    L_real *= -1;
+                                }
+                                valreal[d] += L_real * R_real + L_imag * R_imag;
+                                valimag[d] += L_imag * R_real - L_real * R_imag;
+                            }
+                        }
+                    }
+
+                    // F = parent center - child center = -D
+                    ${add_translated("-")}
+                }
+            }
+        }
+    }
+    ${finish_local_sum()}
+}
+
+KERNEL void l2p(
+    GLOBAL_MEM Real* out,
+    GLOBAL_MEM Real* locals,
+    GLOBAL_MEM Real* params,
+    int n_blocks,
+    GLOBAL_MEM int* obs_n_idxs,
+    GLOBAL_MEM int* obs_n_starts,
+    GLOBAL_MEM int* obs_n_ends,
+    GLOBAL_MEM Real* pts,
+    GLOBAL_MEM int* tris,
+    GLOBAL_MEM Real* obs_n_centers)
+{
+    const int global_idx = get_group_id(0); 
+    const int worker_idx = get_local_id(0);
+    const int block_idx = global_idx;
+    const int this_obs_n_idx = obs_n_idxs[block_idx];
+
+    ${K.constants_code}
+
+    LOCAL_MEM Real sh_locals[${multipoles_per_cell * n_rhs}];
+    for (int local_idx = worker_idx;
+        local_idx < ${multipoles_per_cell * n_rhs};
+        local_idx += ${n_workers_per_block}) 
+    {
+        int full_arr_idx = this_obs_n_idx * ${multipoles_per_cell * n_rhs} + local_idx;
+        sh_locals[local_idx] = locals[full_arr_idx];
+    }
+    LOCAL_BARRIER;
+
+    Real cx = obs_n_centers[this_obs_n_idx * 3 + 0];
+    Real cy = obs_n_centers[this_obs_n_idx * 3 + 1];
+    Real cz = obs_n_centers[this_obs_n_idx * 3 + 2];
+
+    int n_start = obs_n_starts[this_obs_n_idx];
+    int n_end = obs_n_ends[this_obs_n_idx];
+    int n_tris = n_end - n_start;
+    int n_outer_idxs = n_tris * ${quad_wts.shape[0]};
+    int outer_idx_loop_max = ceil(((float)n_outer_idxs) / ((float)${n_workers_per_block}));
+    for (int group_outer_idx = 0;
+            group_outer_idx < outer_idx_loop_max;
+            group_outer_idx++) 
+    {
+        int outer_idx = group_outer_idx * ${n_workers_per_block} + worker_idx;
+        if (outer_idx >= n_outer_idxs) {
+            continue;
+        }
+        int iq = outer_idx % ${quad_wts.shape[0]};
+        int obs_tri_idx = n_start + (outer_idx - iq) / ${quad_wts.shape[0]};
+
+        Real sum_rhs[${n_rhs}][3];
+        Real basissum_rhs[${n_rhs}][3][3];
+        for (int r = 0; r < ${n_rhs}; r++) {
+            for (int d1 = 0; d1 < 3; d1++) {
+                sum_rhs[r][d1] = 0.0;
+                for (int d2 = 0; d2 < 3; d2++) {
+                    basissum_rhs[r][d1][d2] = 0.0;
+                }
+            }
+        }
+
+        Real obsxhat = quad_pts[iq * 2 + 0];
+        Real obsyhat = quad_pts[iq * 2 + 1];
+        Real quadw = quad_wts[iq];
+
+        const int obs_tri_rot_clicks = 0;
+        ${prim.decl_tri_info("obs", K.needs_obsn, K.surf_curl_obs)}
+        ${prim.tri_info("obs", "pts", "tris", K.needs_obsn, K.surf_curl_obs)}
+        ${prim.basis("obs")}
+        ${prim.pts_from_basis(
+            "x", "obs",
+            lambda b, d: "obs_tri[" + str(b) + "][" + str(d) + "]", 3
+        )}
+
+        for (int d1 = 0; d1 < 3; d1++) {
+            obsb[d1] *= quadw * obs_jacobian;
+            % if K.surf_curl_obs:
+                for (int d2 = 0; d2 < 3; d2++) {
+                    bobs_surf_curl[d1][d2] *= quadw * obs_jacobian;
+                }
+            % endif
+        }
+
+        Real Dx = xx - cx;
+        Real Dy = xy - cy; 
+        Real Dz = xz - cz;
+        Real r2 = Dx * Dx + Dy * Dy + Dz * Dz;
+
+        Real Rsr = 1.0;
+        Real Rsi = 0.0;
+        for (int mi = 0; mi < ${order + 1}; mi++) {
+            ${m2p_rhs("mi", "Rsr", "Rsi", "sh_locals")}
+
+            Real Rm2r = 0.0;
+            Real Rm2i = 0.0;
+            Real Rm1r = Rsr;
+            Real Rm1i = Rsi;
+            for (int ni = mi; ni < ${order}; ni++) {
+                Real factor = 1.0 / ((ni + 1) * (ni + 1) - mi * mi);
+                Real t1f = (2 * ni + 1) * Dz;
+                Real Rvr = factor * (t1f * Rm1r - r2 * Rm2r);
+                Real Rvi = factor * (t1f * Rm1i - r2 * Rm2i);
+                ${m2p_rhs("ni + 1", "Rvr", "Rvi", "sh_locals")}
+
+                Rm2r = Rm1r;
+                Rm2i = Rm1i;
+                Rm1r = Rvr;
+                Rm1i = Rvi;
+            }
+            Real Rsrold = Rsr;
+            Real Rsiold = Rsi;
+            Rsr = (Dx * Rsrold - Dy * Rsiold) / (2 * (mi + 1));
+            Rsi = (Dx * Rsiold + Dy * Rsrold) / (2 * (mi + 1));
+        }
+
+        for (int r = 0; r < ${n_rhs}; r++) {
+            for (int d1 = 0; d1 < 3; d1++) {
+                for (int d2 = 0; d2 < 3; d2++) {
+                    basissum_rhs[r][d1][d2] += obsb[d1] * sum_rhs[r][d2];
+                }
+            }
+        }
+
+        // Each obs tri is in exactly one leaf, but the quadrature points of a
+        // tri are spread over the workers.
+        for (int r = 0; r < ${n_rhs}; r++) {
             for (int d1 = 0; d1 < 3; d1++) {
                 for (int d2 = 0; d2 < 3; d2++) {
+                    int out_idx = (obs_tri_idx * 9 + d1 * 3 + d2) * ${n_rhs} + r;
                     % if ocl_backend:
-                        out[obs_tri_idx * 9 + d1 * 3 + d2] += basissum[d1][d2];
+                        out[out_idx] += basissum_rhs[r][d1][d2];
                     % else:
-                        atomicAdd(
-                            &out[obs_tri_idx * 9 + d1 * 3 + d2],
-                            basissum[d1][d2]
-                        );
+                        atomicAdd(&out[out_idx], basissum_rhs[r][d1][d2]);
                     % endif
                 }
             }
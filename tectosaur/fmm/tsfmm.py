@@ -4,43 +4,173 @@ import tectosaur as tct
 from tectosaur.util.quadrature import gauss2d_tri, gauss4d_tri
 from tectosaur.kernels import kernels
 import tectosaur.util.gpu as gpu
+import tectosaur.util.cpu as cpu
+import tectosaur.util.disk_cache as disk_cache
+from tectosaur.fmm.traversal_cache import (
+    cached_traversal, tree_to_arrays, tree_from_arrays
+)
 
 from tectosaur.util.cpp import imp
 traversal_ext = imp("tectosaur.fmm.traversal_wrapper")
 
-traversal_module = traversal_ext.three.octree
 
 import logging
 logger = logging.getLogger(__name__)
 
-# TODO: If I ever want this to be full FMM instead of treecode, I need to:
-# -- implement the p2l and l2p operators, pretty much the same way I did the p2m/m2p
-#    go from one source tri to one obs tri
-# -- implement the m2l operator, go from one source tri to one obs tri
-# -- implement the l2l operator
+# By default, TSFMM is a treecode: every far interaction is a multipole to
+# obs point (m2p) evaluation. With treecode = False, it runs the full FMM: far
+# interactions between nodes become m2l translations into local expansions,
+# which are passed down the obs tree (l2l) and evaluated at the obs points
+# (l2p). The traversal runs with order = 0, so it never produces p2l
+# interactions.
+
+# backend = 'gpu' (the default) runs the operators on the CUDA or OpenCL
+# device. backend = 'cpu' compiles the same kernels as native C++ and runs them
+# with OpenMP (see tectosaur/util/cpu.py) instead of going through a CPU
+# OpenCL implementation like pocl.
+
+# tree_type is 'octree' or 'kdtree'. tree_builder is the name of a Tree
+# construction method, 'build' by default. For octrees: 'build' for the
+# recursive center of mass octree, 'build_morton' for the linear octree built
+# from sorted Morton keys or 'build_compact' for an octree that doesn't store
+# empty children. On planar meshes, most octants are empty, so the compact tree
+# needs far fewer nodes and multipole coefficients. For kd-trees: 'build'
+# splits at the center of mass and 'build_median', 'build_widest' or
+# 'build_cost' select the other split policies (see KDSplit in kdtree.hpp).
+# mac_type selects the multipole acceptance criterion (see mac.hpp):
+# 'ball' (the default) accepts a pair of nodes if
+#     mac * R_src + R_obs < 0.98 * separation,
+# 'box' uses the same check spheres against the bounding boxes of the other
+# node's triangles, 'theta' is the Barnes-Hut test
+#     R_src + R_obs < theta * separation
+# and 'error' accepts a pair if an estimate of the truncation error of the
+# expansion is less than mac_tol relative to the whole source.
+def make_mac(traversal_module, cfg, obs_tree, src_tree):
+    mac_type = cfg.get('mac_type', 'ball')
+    if mac_type == 'ball':
+        return traversal_module.BallMAC(1.0, cfg['mac'])
+    elif mac_type == 'box':
+        return traversal_module.BoxMAC(obs_tree, src_tree, 1.0, cfg['mac'])
+    elif mac_type == 'theta':
+        return traversal_module.ThetaMAC(cfg['theta'])
+    elif mac_type == 'error':
+        return traversal_module.ErrorMAC(
+            obs_tree, src_tree, cfg['order'], cfg['mac_tol']
+        )
+    raise ValueError('unknown mac_type: ' + str(mac_type))
+
+def get_traversal_module(tree_type = 'octree'):
+    return getattr(traversal_ext.three, tree_type)
 
-def make_tree(m, max_pts_per_cell):
+def make_tree(m, max_pts_per_cell, tree_builder = 'build',
+        tree_type = 'octree'):
+    centers, Rs = tri_balls(m)
+    Tree = get_traversal_module(tree_type).Tree
+    tree = getattr(Tree, tree_builder)(centers, Rs, max_pts_per_cell)
+    return tree
+
+def tree_order(m, max_pts_per_cell, tree_builder = 'build',
+        tree_type = 'octree'):
+    """
+    Returns the permutation that puts the triangles of m into tree order:
+    (m[0], m[1][perm]) is the same mesh renumbered into tree order.
+
+    A TSFMM built on the renumbered mesh usually comes out in the mesh's own
+    order and then skips the matvec permutations, but that isn't guaranteed:
+    the node centers are recomputed from the renumbered balls and rounding can
+    move a ball that lies on a splitting plane into a neighboring child. The
+    kd-tree builders don't preserve the order either. Use TSFMM's renumber
+    option instead to get an operator that never permutes.
+    """
+    return np.array(make_tree(m, max_pts_per_cell, tree_builder, tree_type).orig_idxs)
+
+def in_order_tree(traversal_module, tree):
+    """
+    The same tree for the mesh renumbered by tree.orig_idxs: the nodes and
+    balls are unchanged and orig_idxs is the identity.
+    """
+    arrays = tree_to_arrays(tree, '')
+    orig_idxs = arrays['orig_idxs']
+    arrays['orig_idxs'] = np.arange(orig_idxs.shape[0], dtype = orig_idxs.dtype)
+    return tree_from_arrays(traversal_module, arrays, '')
+
+def tri_balls(m):
     tri_pts = m[0][m[1]]
     centers = np.mean(tri_pts, axis = 1)
     pt_dist = tri_pts - centers[:,np.newaxis,:]
     Rs = np.max(np.linalg.norm(pt_dist, axis = 2), axis = 1)
-    tree = traversal_module.Tree.build(centers, Rs, max_pts_per_cell)
-    return tree
-
+    return centers, Rs
+
+# With renumber = True, TSFMM renumbers the obs and src triangles into the
+# order of its trees once, when it is built, so the input and output vectors of
+# every matvec are already in tree order and are never permuted. obs_perm and
+# src_perm are the permutations: the operator acts on the meshes
+# (obs_m[0], obs_m[1][obs_perm]) and (src_m[0], src_m[1][src_perm]), which are
+# stored as self.obs_m and self.src_m. Other operators on the same mesh, like
+# the nearfield and mass operators, should be built on the renumbered
+# triangles so that they all share one numbering. If the obs and src meshes
+# are the same, one tree and one permutation are shared by both. Without
+# renumber, obs_perm and src_perm are None.
 class TSFMM:
     def __init__(self, obs_m, src_m, **kwargs):
-        if gpu.ocl_backend:
+        self.backend = kwargs.get('backend', 'gpu')
+        if self.backend not in ['gpu', 'cpu']:
+            raise ValueError('unknown backend: ' + str(self.backend))
+        if self.backend == 'cpu' or gpu.ocl_backend:
             kwargs['n_workers_per_block'] = 1
+        self.arrays = cpu if self.backend == 'cpu' else gpu
 
         self.cfg = kwargs
         self.K = kernels[self.cfg['K_name']]
         self.obs_m = obs_m
         self.src_m = src_m
-        self.obs_tree = make_tree(self.obs_m, self.cfg['max_pts_per_cell'])
-        self.src_tree = make_tree(self.src_m, self.cfg['max_pts_per_cell'])
+        tree_type = self.cfg.get('tree_type', 'octree')
+        tree_builder = self.cfg.get('tree_builder', 'build')
+        self.traversal_module = get_traversal_module(tree_type)
+        self.symmetric = self.use_symmetric()
+        self.renumber = self.cfg.get('renumber', False)
+        self.shared_tree = self.symmetric or (self.renumber and self.same_meshes())
+        self.treecode = self.cfg.get('treecode', True)
+        self.n_rhs = 1
+        self.gpu_modules = dict()
+        self.rhs_arrays = dict()
         self.gpu_data = dict()
 
-        self.setup_interactions()
+        def build():
+            self.obs_tree = make_tree(
+                self.obs_m, self.cfg['max_pts_per_cell'], tree_builder, tree_type
+            )
+            if self.shared_tree:
+                self.src_tree = self.obs_tree
+            else:
+                self.src_tree = make_tree(
+                    self.src_m, self.cfg['max_pts_per_cell'], tree_builder, tree_type
+                )
+            self.setup_interactions()
+            return self.obs_tree, self.src_tree, self.interactions
+
+        # With use_cache, the trees and interaction lists are stored on disk
+        # and reused by later runs on the same meshes and parameters.
+        if self.cfg.get('use_cache', False):
+            key = disk_cache.hash_key(
+                self.obs_m[0], self.obs_m[1], self.src_m[0], self.src_m[1],
+                tree_type, tree_builder, self.cfg['max_pts_per_cell'],
+                self.cfg.get('mac'), self.cfg['order'], self.symmetric,
+                self.cfg.get('mac_type', 'ball'), self.cfg.get('theta'),
+                self.cfg.get('mac_tol'), self.treecode, self.shared_tree
+            )
+            self.obs_tree, self.src_tree, self.interactions = \
+                cached_traversal(self.traversal_module, key, build)
+            if self.shared_tree:
+                self.src_tree = self.obs_tree
+        else:
+            build()
+
+        self.obs_perm = None
+        self.src_perm = None
+        if self.renumber:
+            self.renumber_meshes()
+
         self.setup_output_sizes()
         self.params_to_gpu()
         self.tree_to_gpu()
@@ -48,10 +178,80 @@ class TSFMM:
         self.load_gpu_module()
         self.setup_arrays()
 
+    def use_symmetric(self):
+        """
+        When the obs and src meshes are the same and the kernel is symmetric,
+        a single tree is shared and each pair of nodes is only traversed once.
+        The p2p blocks between distinct nodes are then evaluated in both
+        directions by one thread, which needs atomic adds, so this isn't
+        available on the OpenCL backend. Set symmetric = False to disable.
+        """
+        if not self.cfg.get('symmetric', True):
+            return False
+        ocl = self.backend == 'gpu' and gpu.ocl_backend
+        if ocl or self.K.name != 'elasticU3':
+            return False
+        return self.same_meshes()
+
+    def same_meshes(self, obs_m = None, src_m = None):
+        obs_m = self.obs_m if obs_m is None else obs_m
+        src_m = self.src_m if src_m is None else src_m
+        return (
+            np.array_equal(obs_m[0], src_m[0]) and
+            np.array_equal(obs_m[1], src_m[1])
+        )
+
+    def renumber_meshes(self):
+        self.obs_perm = np.array(self.obs_tree.orig_idxs)
+        self.src_perm = np.array(self.src_tree.orig_idxs)
+        self.obs_m = (self.obs_m[0], self.obs_m[1][self.obs_perm])
+        self.src_m = (self.src_m[0], self.src_m[1][self.src_perm])
+        self.obs_tree = in_order_tree(self.traversal_module, self.obs_tree)
+        if self.shared_tree:
+            self.src_tree = self.obs_tree
+        else:
+            self.src_tree = in_order_tree(self.traversal_module, self.src_tree)
+
+    def refit(self, obs_m, src_m):
+        """
+        Update the operator for meshes with the same triangles as before but
+        moved vertices. The trees are refit instead of rebuilt and if the
+        existing interaction lists still pass the MAC, they are reused.
+        Returns whether the interaction lists were reused. With renumber, the
+        meshes must be in the renumbered order, like self.obs_m and self.src_m.
+        """
+        assert(obs_m[1].shape == self.obs_m[1].shape)
+        assert(src_m[1].shape == self.src_m[1].shape)
+        if self.shared_tree and not self.same_meshes(obs_m, src_m):
+            raise ValueError(
+                'A TSFMM with a shared obs and src tree must be refit with '
+                'identical obs and src meshes.'
+            )
+        self.obs_m = obs_m
+        self.src_m = src_m
+        self.obs_tree.refit(*tri_balls(self.obs_m))
+        if self.src_tree is not self.obs_tree:
+            self.src_tree.refit(*tri_balls(self.src_m))
+        self.tree_to_gpu()
+
+        valid = self.traversal_module.interactions_valid(
+            self.interactions, self.obs_tree, self.src_tree, self.make_mac()
+        )
+        if not valid:
+            self.setup_interactions()
+            self.setup_output_sizes()
+            self.interactions_to_gpu()
+            self.rhs_arrays.clear()
+            self.setup_arrays()
+        return valid
 
     def load_gpu_module(self):
+        if self.n_rhs in self.gpu_modules:
+            self.gpu_module = self.gpu_modules[self.n_rhs]
+            return
         quad = gauss2d_tri(self.cfg['quad_order'])
-        self.gpu_module = gpu.load_gpu(
+        load = cpu.load_cpu if self.backend == 'cpu' else gpu.load_gpu
+        self.gpu_module = load(
             'fmm/ts_kernels.cl',
             tmpl_args = dict(
                 order = self.cfg['order'],
@@ -59,33 +259,62 @@ class TSFMM:
                 quad_pts = quad[0],
                 quad_wts = quad[1],
                 n_workers_per_block = self.cfg['n_workers_per_block'],
+                symmetric_p2p = self.symmetric,
+                n_rhs = self.n_rhs,
                 K = self.K
             )
         )
+        self.gpu_modules[self.n_rhs] = self.gpu_module
+
+    def set_n_rhs(self, n_rhs):
+        """
+        The number of right hand sides is a compile time constant of the
+        kernels, so each n_rhs needs its own module and its own expansion and
+        input/output arrays. Both are kept per n_rhs, so alternating between
+        block sizes doesn't reload or reallocate anything. The operators loop
+        over the right hand sides innermost, reusing the geometry and the
+        solid harmonics. Note that the shared memory used by m2p and l2p grows
+        with n_rhs.
+        """
+        if n_rhs == self.n_rhs:
+            return
+        self.n_rhs = n_rhs
+        self.load_gpu_module()
+        self.setup_arrays()
+
+    def make_mac(self):
+        return make_mac(self.traversal_module, self.cfg, self.obs_tree, self.src_tree)
 
     def setup_interactions(self):
-        self.interactions = traversal_module.fmmmm_interactions(
-            self.obs_tree, self.src_tree, 1.0, self.cfg['mac'],
-            0, True
-        )
+        # The 32-bit lists can be uploaded to the GPU without conversion.
+        if self.symmetric:
+            self.interactions = self.traversal_module.fmmmm_interactions_symmetric32(
+                self.obs_tree, self.make_mac(), 0, self.treecode
+            )
+        else:
+            self.interactions = self.traversal_module.fmmmm_interactions32(
+                self.obs_tree, self.src_tree, self.make_mac(), 0, self.treecode
+            )
+        assert(self.interactions.p2l.src_n_idxs.shape[0] == 0)
 
     def setup_output_sizes(self):
         order = self.cfg['order']
         # n dim = [0, order],
-        # m dim = [0, n],
+        # m dim = [0, n], packed so that only the valid (n, m) pairs are stored,
         # multipole_dim moments,
         # 2 = real and imaginary parts
         multipole_dim = self.K.multipole_dim
-        self.n_multipoles = (order + 1) * (order + 1) * multipole_dim * 2 * self.src_tree.n_nodes
-        # self.n_locals = self.n_surf_dofs * self.obs_tree.n_nodes
+        per_node = (order + 1) * (order + 2) // 2 * multipole_dim * 2
+        self.n_multipoles = per_node * self.src_tree.n_nodes
+        self.n_locals = per_node * self.obs_tree.n_nodes
         self.n_input = self.src_m[1].shape[0] * 9
         self.n_output = self.obs_m[1].shape[0] * 9
 
     def float_gpu(self, arr):
-        return gpu.to_gpu(arr, self.cfg['float_type'])
+        return self.arrays.to_gpu(arr, self.cfg['float_type'])
 
     def int_gpu(self, arr):
-        return gpu.to_gpu(arr, np.int32)
+        return self.arrays.to_gpu(arr, np.int32)
 
     def params_to_gpu(self):
         self.gpu_data['params'] = self.float_gpu(np.array(self.cfg['params']))
@@ -93,21 +322,27 @@ class TSFMM:
     def tree_to_gpu(self):
         gd = self.gpu_data
 
+        # If a tree is in the mesh's own order, which renumber guarantees, the
+        # matvec input or output doesn't need to be permuted.
+        self.src_orig_idxs = np.array(self.src_tree.orig_idxs)
+        self.src_in_order = np.array_equal(
+            self.src_orig_idxs, np.arange(self.src_orig_idxs.shape[0])
+        )
+        self.obs_orig_idxs = np.array(self.obs_tree.orig_idxs)
+        self.obs_in_order = np.array_equal(
+            self.obs_orig_idxs, np.arange(self.obs_orig_idxs.shape[0])
+        )
+
         gd['obs_pts'] = self.float_gpu(self.obs_m[0])
-        gd['obs_tris'] = self.int_gpu(self.obs_m[1][self.obs_tree.orig_idxs])
+        gd['obs_tris'] = self.int_gpu(self.obs_m[1][self.obs_orig_idxs])
         gd['src_pts'] = self.float_gpu(self.src_m[0])
-        gd['src_tris'] = self.int_gpu(self.src_m[1][self.src_tree.orig_idxs])
-
-        self.obs_tree_nodes = self.obs_tree.nodes
-        self.src_tree_nodes = self.src_tree.nodes
+        gd['src_tris'] = self.int_gpu(self.src_m[1][self.src_orig_idxs])
 
         for name, tree in [('src', self.src_tree), ('obs', self.obs_tree)]:
             gd[name + '_n_C'] = self.float_gpu(tree.node_centers)
             # gd[name + '_n_R'] = self.float_gpu(tree.node_Rs)
-
-        for name, tree in [('src', self.src_tree_nodes), ('obs', self.obs_tree_nodes)]:
-            gd[name + '_n_start'] = self.int_gpu(np.array([n.start for n in tree]))
-            gd[name + '_n_end'] = self.int_gpu(np.array([n.end for n in tree]))
+            gd[name + '_n_start'] = self.int_gpu(tree.node_starts)
+            gd[name + '_n_end'] = self.int_gpu(tree.node_ends)
 
     def interactions_to_gpu(self):
         op_names = ['p2p', 'p2m', 'p2l', 'm2p', 'm2m', 'm2l', 'l2p', 'l2l']
@@ -125,10 +360,12 @@ class TSFMM:
         t = tct.Timer()
         obs_tri_block_idx = -1 * np.ones(self.obs_m[1].shape[0], dtype = np.int)
         p2p_obs_n_idxs = np.array(self.interactions.p2p.obs_n_idxs, copy = False)
+        obs_n_starts = self.obs_tree.node_starts
+        obs_n_ends = self.obs_tree.node_ends
         for block_idx in range(p2p_obs_n_idxs.shape[0]):
             n_idx = p2p_obs_n_idxs[block_idx]
-            start = self.obs_tree_nodes[n_idx].start
-            end = self.obs_tree_nodes[n_idx].end
+            start = obs_n_starts[n_idx]
+            end = obs_n_ends[n_idx]
             assert(np.all(obs_tri_block_idx[start:end] == -1))
             obs_tri_block_idx[start:end] = block_idx
         self.obs_tri_block_idx = obs_tri_block_idx
@@ -140,22 +377,40 @@ class TSFMM:
                 np.array(getattr(op, data_name), copy = False)
             )
 
+    # With multiple right hand sides, each row has 9 * n_rhs entries since
+    # the right hand side index is the fastest varying.
     def to_tree(self, input_orig):
-        orig_idxs = np.array(self.src_tree.orig_idxs)
-        input_orig = input_orig.reshape((-1,9))
-        return input_orig[orig_idxs,:].flatten()
+        if self.src_in_order:
+            return input_orig.reshape(-1)
+        input_orig = input_orig.reshape((self.src_orig_idxs.shape[0], -1))
+        return input_orig[self.src_orig_idxs,:].flatten()
 
     def to_orig(self, output_tree):
-        orig_idxs = np.array(self.obs_tree.orig_idxs)
-        output_tree = output_tree.reshape((-1, 9))
+        if self.obs_in_order:
+            return output_tree
+        output_tree = output_tree.reshape((self.obs_orig_idxs.shape[0], -1))
         output_orig = np.empty_like(output_tree)
-        output_orig[orig_idxs,:] = output_tree
+        output_orig[self.obs_orig_idxs,:] = output_tree
         return output_orig.flatten()
 
     def setup_arrays(self):
-        self.gpu_multipoles = gpu.empty_gpu(self.n_multipoles, self.cfg['float_type'])
-        self.gpu_out = gpu.empty_gpu(self.n_output, self.cfg['float_type'])
-        self.gpu_in = gpu.empty_gpu(self.n_input, self.cfg['float_type'])
+        n_rhs = self.n_rhs
+        if n_rhs not in self.rhs_arrays:
+            float_type = self.cfg['float_type']
+            arrs = dict(
+                multipoles = self.arrays.empty_gpu(self.n_multipoles * n_rhs, float_type),
+                out = self.arrays.empty_gpu(self.n_output * n_rhs, float_type),
+                inp = self.arrays.empty_gpu(self.n_input * n_rhs, float_type)
+            )
+            if not self.treecode:
+                arrs['locals'] = self.arrays.empty_gpu(self.n_locals * n_rhs, float_type)
+            self.rhs_arrays[n_rhs] = arrs
+        arrs = self.rhs_arrays[n_rhs]
+        self.gpu_multipoles = arrs['multipoles']
+        if not self.treecode:
+            self.gpu_locals = arrs['locals']
+        self.gpu_out = arrs['out']
+        self.gpu_in = arrs['inp']
 
     def p2m(self):
         n_obs_n = self.gpu_data['p2m_obs_n_idxs'].shape[0]
@@ -212,6 +467,62 @@ class TSFMM:
             block = (block_size,1,1)
         )
 
+    def m2l(self):
+        n_obs_n = self.gpu_data['m2l_obs_n_idxs'].shape[0]
+        if n_obs_n == 0:
+            return
+        block_size = self.cfg['n_workers_per_block']
+        n_blocks = int(np.ceil(n_obs_n / block_size))
+        self.gpu_module.m2l(
+            self.gpu_locals,
+            self.gpu_multipoles,
+            np.int32(n_obs_n),
+            self.gpu_data['m2l_obs_n_idxs'],
+            self.gpu_data['m2l_obs_src_starts'],
+            self.gpu_data['m2l_src_n_idxs'],
+            self.gpu_data['obs_n_C'],
+            self.gpu_data['src_n_C'],
+            grid = (n_blocks,1,1),
+            block = (block_size,1,1)
+        )
+
+    def l2l(self, depth):
+        n_obs_n = self.gpu_data['l2l' + str(depth) + '_obs_n_idxs'].shape[0]
+        if n_obs_n == 0:
+            return
+        block_size = self.cfg['n_workers_per_block']
+        n_blocks = int(np.ceil(n_obs_n / block_size))
+        self.gpu_module.l2l(
+            self.gpu_locals,
+            np.int32(n_obs_n),
+            self.gpu_data['l2l' + str(depth) + '_obs_n_idxs'],
+            self.gpu_data['l2l' + str(depth) + '_obs_src_starts'],
+            self.gpu_data['l2l' + str(depth) + '_src_n_idxs'],
+            self.gpu_data['obs_n_C'],
+            grid = (n_blocks,1,1),
+            block = (block_size,1,1)
+        )
+
+    def l2p(self):
+        n_obs_n = self.gpu_data['l2p_obs_n_idxs'].shape[0]
+        if n_obs_n == 0:
+            return
+        block_size = self.cfg['n_workers_per_block']
+        self.gpu_module.l2p(
+            self.gpu_out,
+            self.gpu_locals,
+            self.gpu_data['params'],
+            np.int32(n_obs_n),
+            self.gpu_data['l2p_obs_n_idxs'],
+            self.gpu_data['obs_n_start'],
+            self.gpu_data['obs_n_end'],
+            self.gpu_data['obs_pts'],
+            self.gpu_data['obs_tris'],
+            self.gpu_data['obs_n_C'],
+            grid = (n_obs_n,1,1),
+            block = (block_size,1,1)
+        )
+
     def p2p(self):
         n_obs_n = self.gpu_data['p2p_obs_n_idxs'].shape[0]
         if n_obs_n == 0:
@@ -239,7 +550,8 @@ class TSFMM:
         )
 
     def dot_helper(self, v):
-        self.gpu_in[:] = self.to_tree(v.astype(self.cfg['float_type']))
+        self.set_n_rhs(1 if v.ndim == 1 else v.shape[1])
+        self.gpu_in[:] = self.to_tree(v.astype(self.cfg['float_type'], copy = False))
         self.gpu_out.fill(0)
 
         self.p2p()
@@ -247,19 +559,31 @@ class TSFMM:
         for i in range(1, len(self.interactions.m2m)):
             self.m2m(i)
         self.m2p()
+        if not self.treecode:
+            # The l2l lists are indexed by depth, so the local expansions are
+            # passed down from the root one level at a time.
+            self.gpu_locals.fill(0)
+            self.m2l()
+            for i in range(1, len(self.interactions.l2l)):
+                self.l2l(i)
+            self.l2p()
 
     def dot(self, v):
+        """
+        v is either a vector or an (n_input, k) block of k right hand sides.
+        """
         self.dot_helper(v)
 
-        return self.to_orig(self.gpu_out.get())
+        out = self.to_orig(self.gpu_out.get())
+        return out.reshape((self.n_output,) + v.shape[1:])
 
     async def async_dot(self, v):
         t = tct.Timer(output_fnc = logger.debug)
         self.dot_helper(v)
         t.report('launch fmm')
-        out_tree = await gpu.async_get(self.gpu_out)
+        out_tree = await self.arrays.async_get(self.gpu_out)
         t.report('get fmm result')
-        out = self.to_orig(out_tree)
+        out = self.to_orig(out_tree).reshape((self.n_output,) + v.shape[1:])
         t.report('to orig')
         return out
 
@@ -267,7 +591,7 @@ def report_interactions(fmm_obj):
     def count_interactions(op_name, op):
         obs_surf = False if op_name[2] == 'p' else True
         src_surf = False if op_name[0] == 'p' else True
-        return traversal_module.count_interactions(
+        return fmm_obj.traversal_module.count_interactions(
             op, fmm_obj.obs_tree, fmm_obj.src_tree,
             obs_surf, src_surf, 1
         )
@@ -283,6 +607,7 @@ def report_interactions(fmm_obj):
         for i in range(len(fmm_obj.interactions.m2m))
     ])
     n_m2p = fmm_obj.interactions.m2p.src_n_idxs.shape[0]
+    n_m2l = fmm_obj.interactions.m2l.src_n_idxs.shape[0]
     total = n_obs_tris * n_src_tris
     not_p2p = total - p2p
 
@@ -295,3 +620,4 @@ def report_interactions(fmm_obj):
     logger.info('# p2m:' + str(n_p2m))
     logger.info('# m2m:' + str(n_m2m))
     logger.info('# m2p:' + str(n_m2p))
+    logger.info('# m2l:' + str(n_m2l))
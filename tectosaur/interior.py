@@ -27,16 +27,16 @@ def make_pairs_mat(pairs, entries, shape):
 
 
 class InteriorOp:
+    # near_index is a find_near_adj.build_nearfield_index(*src_mesh) that can be
+    # shared between the operators for many batches of observation points.
     def __init__(self, obs_pts, obs_ns, src_mesh, K_name, threshold, nq_vertex, nq_far,
-            nq_near, params, float_type):
+            nq_near, params, float_type, near_index = None):
         self.K_name = K_name
         self.float_type = float_type
         self.threshold = 4.0
-        pairs = find_near_adj.fast_find_nearfield.get_nearfield(
-            obs_pts, np.zeros(obs_pts.shape[0]),
-            *find_near_adj.get_tri_centroids_rs(*src_mesh),
-            self.threshold, 50
-        )
+        if near_index is None:
+            near_index = find_near_adj.build_nearfield_index(*src_mesh)
+        pairs = near_index.query(obs_pts, np.zeros(obs_pts.shape[0]), self.threshold)
 
         split = find_near_adj.split_vertex_nearfield(
             pairs, obs_pts, src_mesh[0], src_mesh[1]
@@ -167,7 +167,8 @@ class TriToPtDirectFarfieldOp:
                 block_size = self.block_size,
                 float_type = gpu.np_to_c_type(float_type),
                 quad_pts = self.q[0],
-                quad_wts = self.q[1]
+                quad_wts = self.q[1],
+                n_rhs = 1
             )
         )
         self.fnc = getattr(self.module, "farfield_tris_to_pts" + K_name)
@@ -5,68 +5,63 @@ cfg['sources'].extend(['../fmm/octree.cpp'])
 cfg['dependencies'].extend([
     '../fmm/octree.hpp',
     '../include/pybind11_nparray.hpp',
-    '../fmm/tree_helpers.hpp'
+    '../fmm/tree_helpers.hpp',
+    'leaf_filter.hpp'
 ])
 %>
 
-#include <atomic>
+#include <algorithm>
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include "../include/pybind11_nparray.hpp"
 #include "../include/timing.hpp"
 #include "../fmm/octree.hpp"
+#include "leaf_filter.hpp"
 
 namespace py = pybind11;
 
 template <size_t dim>
 void query_helper(std::vector<long>& out,
-    const OctreeNode<dim>& obs_node, const Octree<dim>& obs_tree,
-    const std::vector<double>& obs_expanded_r, double* obs_radius_ptr,
-    const OctreeNode<dim>& src_node, const Octree<dim>& src_tree,
-    const std::vector<double>& src_expanded_r, double* src_radius_ptr,
+    size_t obs_node, const Octree<dim>& obs_tree,
+    const std::vector<double>& obs_expanded_r, const BallsSoA<dim>& obs_balls,
+    size_t src_node, const Octree<dim>& src_tree,
+    const std::vector<double>& src_expanded_r, const BallsSoA<dim>& src_balls,
     double threshold) 
 {
-    double r1 = obs_expanded_r[obs_node.idx];
-    double r2 = src_expanded_r[src_node.idx];
+    auto& obs = obs_tree.nodes;
+    auto& src = src_tree.nodes;
+    double r1 = obs_expanded_r[obs_node];
+    double r2 = src_expanded_r[src_node];
     double limit = std::pow((r1 + r2) * threshold, 2);
-    if (dist2(obs_node.bounds.center, src_node.bounds.center) > limit) {
+    if (dist2(obs.centers[obs_node], src.centers[src_node]) > limit) {
         return;
     }
-    if (obs_node.is_leaf && src_node.is_leaf) {
-        for (size_t i = obs_node.start; i < obs_node.end; i++) {
-            auto orig_idx_i = obs_tree.orig_idxs[i];
-            for (size_t j = src_node.start; j < src_node.end; j++) {
-                auto orig_idx_j = src_tree.orig_idxs[j];
-                auto pt_touching_sep = obs_radius_ptr[i] + src_radius_ptr[j];
-                auto pt_limit = std::pow(pt_touching_sep * threshold, 2);
-                if (dist2(obs_tree.balls[i].center, src_tree.balls[j].center) > pt_limit) {
-                    continue;
-                }
-                out.push_back(orig_idx_i);
-                out.push_back(orig_idx_j);
-            }
-        }
+    if (obs.is_leaf(obs_node) && src.is_leaf(src_node)) {
+        filter_leaf_pairs(
+            out, obs_balls, obs.starts[obs_node], obs.ends[obs_node],
+            src_balls, src.starts[src_node], src.ends[src_node], threshold
+        );
         return;
     }
-    bool split2 = ((r1 < r2) && !src_node.is_leaf) || obs_node.is_leaf;
+    bool split2 = ((r1 < r2) && !src.is_leaf(src_node)) || obs.is_leaf(obs_node);
     if (split2) {
-        for (size_t i = 0; i < OctreeNode<dim>::split; i++) {
+        for (size_t i = 0; i < src.n_children[src_node]; i++) {
             query_helper(
                 out, 
-                obs_node, obs_tree, obs_expanded_r, obs_radius_ptr,
-                src_tree.nodes[src_node.children[i]], src_tree,
-                src_expanded_r, src_radius_ptr,
+                obs_node, obs_tree, obs_expanded_r, obs_balls,
+                src.first_child[src_node] + i, src_tree,
+                src_expanded_r, src_balls,
                 threshold
             ); 
         }
     } else {
-        for (size_t i = 0; i < OctreeNode<dim>::split; i++) {
+        for (size_t i = 0; i < obs.n_children[obs_node]; i++) {
             query_helper(
                 out,
-                obs_tree.nodes[obs_node.children[i]], obs_tree,
-                obs_expanded_r, obs_radius_ptr,
-                src_node, src_tree, src_expanded_r, src_radius_ptr,
+                obs.first_child[obs_node] + i, obs_tree,
+                obs_expanded_r, obs_balls,
+                src_node, src_tree, src_expanded_r, src_balls,
                 threshold
             ); 
         }
@@ -79,11 +74,11 @@ std::vector<double> get_expanded_node_r(const Octree<dim>& tree, double* radius_
     std::vector<double> expanded_node_r(tree.nodes.size());
 #pragma omp parallel for
     for (size_t i = 0; i < tree.nodes.size(); i++) {
-        auto& n = tree.nodes[i];
-        double max_radius = n.bounds.R;
-        for (size_t j = n.start; j < n.end; j++) {
+        auto& nodes = tree.nodes;
+        double max_radius = nodes.Rs[i];
+        for (size_t j = nodes.starts[i]; j < nodes.ends[i]; j++) {
             auto orig_idx = tree.orig_idxs[j];
-            auto modified_dist = dist(tree.balls[j].center, n.bounds.center) + radius_ptr[orig_idx];
+            auto modified_dist = dist(tree.balls[j].center, nodes.centers[i]) + radius_ptr[orig_idx];
             if (modified_dist > max_radius) {
                 max_radius = modified_dist;
             }
@@ -93,49 +88,273 @@ std::vector<double> get_expanded_node_r(const Octree<dim>& tree, double* radius_
     return expanded_node_r;
 }
 
+// Concatenates the chunks in order, copying them in parallel.
+std::vector<long> concat_chunks(const std::vector<std::vector<long>>& chunks) {
+    std::vector<size_t> offsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        offsets[i + 1] = offsets[i] + chunks[i].size();
+    }
+    std::vector<long> out(offsets.back());
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < chunks.size(); i++) {
+        std::copy(chunks[i].begin(), chunks[i].end(), out.begin() + offsets[i]);
+    }
+    return out;
+}
+
+// Node pairs with fewer balls than this between them are traversed serially
+// by a single task.
+constexpr size_t query_task_min_balls = 4096;
+
+// Splits the dual tree traversal into tasks until the node pairs are small,
+// so that a dense cluster of balls is shared between threads instead of
+// landing on whichever thread owns its top level node. Every serial subtree
+// writes its pairs into its own chunk and the chunks of the children are
+// appended in child order, so the chunks end up in the order of a serial
+// traversal regardless of which thread ran which task.
+template <size_t dim>
+void query_tasks(std::vector<std::vector<long>>& chunks,
+    size_t obs_node, const Octree<dim>& obs_tree,
+    const std::vector<double>& obs_expanded_r, const BallsSoA<dim>& obs_balls,
+    size_t src_node, const Octree<dim>& src_tree,
+    const std::vector<double>& src_expanded_r, const BallsSoA<dim>& src_balls,
+    double threshold)
+{
+    auto& obs = obs_tree.nodes;
+    auto& src = src_tree.nodes;
+    size_t n_balls = obs.n_balls(obs_node) + src.n_balls(src_node);
+    if (n_balls < query_task_min_balls || (obs.is_leaf(obs_node) && src.is_leaf(src_node))) {
+        chunks.emplace_back();
+        query_helper(
+            chunks.back(),
+            obs_node, obs_tree, obs_expanded_r, obs_balls,
+            src_node, src_tree, src_expanded_r, src_balls,
+            threshold
+        );
+        return;
+    }
+
+    double r1 = obs_expanded_r[obs_node];
+    double r2 = src_expanded_r[src_node];
+    double limit = std::pow((r1 + r2) * threshold, 2);
+    if (dist2(obs.centers[obs_node], src.centers[src_node]) > limit) {
+        return;
+    }
+    bool split2 = ((r1 < r2) && !src.is_leaf(src_node)) || obs.is_leaf(obs_node);
+    size_t n_children = split2 ? src.n_children[src_node] : obs.n_children[obs_node];
+    std::vector<std::vector<std::vector<long>>> child_chunks(n_children);
+    for (size_t i = 0; i < n_children; i++) {
+#pragma omp task default(shared) firstprivate(i)
+        {
+            if (split2) {
+                query_tasks(
+                    child_chunks[i],
+                    obs_node, obs_tree, obs_expanded_r, obs_balls,
+                    src.first_child[src_node] + i, src_tree,
+                    src_expanded_r, src_balls,
+                    threshold
+                );
+            } else {
+                query_tasks(
+                    child_chunks[i],
+                    obs.first_child[obs_node] + i, obs_tree,
+                    obs_expanded_r, obs_balls,
+                    src_node, src_tree, src_expanded_r, src_balls,
+                    threshold
+                );
+            }
+        }
+    }
+#pragma omp taskwait
+
+    for (auto& c: child_chunks) {
+        for (auto& chunk: c) {
+            if (chunk.size() > 0) {
+                chunks.push_back(std::move(chunk));
+            }
+        }
+    }
+}
+
 template <size_t dim>
 std::vector<long> query_ball_points(
     const Octree<dim>& obs_tree, const std::vector<double>& obs_expanded_r,
-    std::array<double,dim>* obs_pt_ptr, double* obs_radius_ptr, size_t n_obs,
+    const BallsSoA<dim>& obs_balls,
     const Octree<dim>& src_tree, const std::vector<double>& src_expanded_r,
-    std::array<double,dim>* src_pt_ptr, double* src_radius_ptr, size_t n_src,
+    const BallsSoA<dim>& src_balls,
     double threshold) 
 {
-
-    std::vector<long> out;
-    constexpr int parallelize_depth = 2;
-    std::atomic<int> n_pairs{0};
+    std::vector<std::vector<long>> chunks;
 #pragma omp parallel
+#pragma omp single
+    query_tasks(
+        chunks,
+        0, obs_tree, obs_expanded_r, obs_balls,
+        0, src_tree, src_expanded_r, src_balls,
+        threshold
+    );
+
+    return concat_chunks(chunks);
+}
+
+// A tree of source balls that is built once and queried against many sets of
+// observation balls. The tree is never modified after construction, so
+// queries can run concurrently from several threads.
+template <size_t dim>
+struct NearfieldIndex {
+    Octree<dim> tree;
+    std::vector<double> expanded_r;
+    BallsSoA<dim> balls;
+    size_t leaf_size;
+
+    NearfieldIndex(std::array<double,dim>* pts, double* radius, size_t n,
+            size_t leaf_size):
+        tree(Octree<dim>::build_fnc(pts, radius, n, leaf_size)),
+        expanded_r(get_expanded_node_r(tree, radius)),
+        // The radii in the tree are in tree order, like the balls.
+        balls(balls_soa(tree)),
+        leaf_size(leaf_size)
+    {}
+
+    std::vector<long> query(std::array<double,dim>* obs_pts, double* obs_radius,
+        size_t n_obs, double threshold) const
     {
+        auto obs_tree = Octree<dim>::build_fnc(obs_pts, obs_radius, n_obs, leaf_size);
+        auto obs_expanded_r = get_expanded_node_r(obs_tree, obs_radius);
+        auto obs_balls = balls_soa(obs_tree);
+        return query_ball_points(
+            obs_tree, obs_expanded_r, obs_balls,
+            tree, expanded_r, balls, threshold
+        );
+    }
+};
 
-        std::vector<long> out_private;
-#pragma omp for
-        for (size_t i = 0; i < obs_tree.nodes.size(); i++) {
-            auto& obs_n = obs_tree.nodes[i];
-            if (obs_n.depth > parallelize_depth) {
-                continue;
-            }
-            if (obs_n.depth != parallelize_depth && !obs_n.is_leaf) {
-                continue;
-            }
-            query_helper(
-                out_private, 
-                obs_n, obs_tree, obs_expanded_r, obs_radius_ptr,
-                src_tree.root(), src_tree, src_expanded_r, src_radius_ptr,
-                threshold
+// The traversal of a tree against itself. A node pair and its mirror image
+// give the same balls pairs, so only the pairs (n1, n2) with n2 after n1 in
+// the child order are visited and each close pair is found once. Distinct
+// nodes never share balls, so those pairs go through the ordinary traversal.
+template <size_t dim>
+void self_query_helper(std::vector<long>& out,
+    size_t n1, size_t n2, const Octree<dim>& tree,
+    const std::vector<double>& expanded_r, const BallsSoA<dim>& balls,
+    double threshold)
+{
+    auto& nodes = tree.nodes;
+    if (n1 != n2) {
+        query_helper(
+            out, n1, tree, expanded_r, balls, n2, tree, expanded_r, balls, threshold
+        );
+        return;
+    }
+    if (nodes.is_leaf(n1)) {
+        auto start = nodes.starts[n1];
+        auto end = nodes.ends[n1];
+        filter_leaf_pairs(out, balls, start, end, balls, start, end, threshold, true);
+        return;
+    }
+    auto first = nodes.first_child[n1];
+    for (size_t i = 0; i < nodes.n_children[n1]; i++) {
+        for (size_t j = i; j < nodes.n_children[n1]; j++) {
+            self_query_helper(
+                out, first + i, first + j, tree, expanded_r, balls, threshold
             );
         }
-        size_t insertion_start_idx = n_pairs.fetch_add(out_private.size());
-#pragma omp barrier
-#pragma omp single
-        {
-            out.resize(n_pairs);
+    }
+}
+
+template <size_t dim>
+void self_query_tasks(std::vector<std::vector<long>>& chunks,
+    size_t n1, size_t n2, const Octree<dim>& tree,
+    const std::vector<double>& expanded_r, const BallsSoA<dim>& balls,
+    double threshold)
+{
+    auto& nodes = tree.nodes;
+    if (n1 != n2) {
+        query_tasks(
+            chunks, n1, tree, expanded_r, balls, n2, tree, expanded_r, balls, threshold
+        );
+        return;
+    }
+    if (nodes.n_balls(n1) < query_task_min_balls || nodes.is_leaf(n1)) {
+        chunks.emplace_back();
+        self_query_helper(chunks.back(), n1, n2, tree, expanded_r, balls, threshold);
+        return;
+    }
+
+    size_t n_children = nodes.n_children[n1];
+    auto first = nodes.first_child[n1];
+    std::vector<std::vector<std::vector<long>>> child_chunks(n_children * n_children);
+    for (size_t i = 0; i < n_children; i++) {
+        for (size_t j = i; j < n_children; j++) {
+#pragma omp task default(shared) firstprivate(i, j)
+            self_query_tasks(
+                child_chunks[i * n_children + j],
+                first + i, first + j, tree, expanded_r, balls, threshold
+            );
         }
+    }
+#pragma omp taskwait
 
-        for (size_t i = 0; i < out_private.size(); i++) {
-            out[insertion_start_idx + i] = out_private[i];
+    for (auto& c: child_chunks) {
+        for (auto& chunk: c) {
+            if (chunk.size() > 0) {
+                chunks.push_back(std::move(chunk));
+            }
         }
     }
+}
+
+// Finds the close pairs of a set of balls with itself. The traversal finds
+// every pair once. The output has both orientations of each pair, like
+// query_ball_points with obs == src, or with canonical, only the orientation
+// with the smaller index first.
+template <size_t dim>
+std::vector<long> self_query_ball_points(const Octree<dim>& tree,
+    const std::vector<double>& expanded_r, double threshold, bool canonical)
+{
+    auto balls = balls_soa(tree);
+
+    std::vector<std::vector<long>> chunks;
+#pragma omp parallel
+#pragma omp single
+    self_query_tasks(
+        chunks, 0, 0, tree, expanded_r, balls, threshold
+    );
+
+    std::vector<size_t> offsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        size_t n_out = chunks[i].size();
+        if (!canonical) {
+            for (size_t k = 0; k < chunks[i].size(); k += 2) {
+                if (chunks[i][k] != chunks[i][k + 1]) {
+                    n_out += 2;
+                }
+            }
+        }
+        offsets[i + 1] = offsets[i] + n_out;
+    }
+    std::vector<long> out(offsets.back());
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < chunks.size(); i++) {
+        auto& chunk = chunks[i];
+        size_t out_idx = offsets[i];
+        for (size_t k = 0; k < chunk.size(); k += 2) {
+            long a = chunk[k];
+            long b = chunk[k + 1];
+            if (canonical) {
+                out[out_idx++] = std::min(a, b);
+                out[out_idx++] = std::max(a, b);
+            } else {
+                out[out_idx++] = a;
+                out[out_idx++] = b;
+                if (a != b) {
+                    out[out_idx++] = b;
+                    out[out_idx++] = a;
+                }
+            }
+        }
+        std::vector<long>().swap(chunk);
+    }
 
     return out;
 }
@@ -214,33 +433,149 @@ std::array<std::vector<long>,2> split_vertex_nearfield(long* close_pairs,
     return out;
 }
 
+// The number of rotations that moves the shared edge of an edge adjacent
+// triangle to vertices (0, 1). Same as edge_adj_orient in nearfield_op.py.
+long edge_adj_orient(long v1, long v2) {
+    long lo = std::min(v1, v2);
+    long hi = std::max(v1, v2);
+    if (lo == 0) {
+        return (hi == 2) ? 2 : 0;
+    }
+    return 1;
+}
+
+// Close pairs are classified in fixed size blocks so that the output order
+// doesn't depend on the number of threads.
+constexpr size_t classify_block_size = 4096;
+
+// Splits the close pairs from a nearfield query, in subset (dof) space, into
+// coincident, edge adjacent, vertex adjacent and the remaining nearfield pairs
+// in one parallel pass. The triangles are tris[obs_subset] and tris[src_subset].
+// The rows of the outputs are:
+//     coincident:      (obs, src)
+//     edge adjacent:   (obs, src, obs_clicks, src_clicks, src_flip)
+//     vertex adjacent: (obs, src, obs vertex, src vertex)
+//     nearfield:       (obs, src)
+// where the edge adjacent orientation is what resolve_ea_rotation computes.
+// Distinct triangles with all three vertices shared are dropped, like in
+// split_adjacent_close.
+std::array<std::vector<long>,4> classify_nearfield(long* close_pairs,
+    size_t n_pairs, long* tris, long* obs_subset, long* src_subset)
+{
+    size_t n_blocks = (n_pairs + classify_block_size - 1) / classify_block_size;
+    std::vector<std::array<std::vector<long>,4>> blocks(n_blocks);
+#pragma omp parallel for schedule(dynamic)
+    for (size_t b = 0; b < n_blocks; b++) {
+        auto& out = blocks[b];
+        size_t end = std::min(n_pairs, (b + 1) * classify_block_size);
+        for (size_t i = b * classify_block_size; i < end; i++) {
+            auto idx1 = close_pairs[i * 2];
+            auto idx2 = close_pairs[i * 2 + 1];
+            auto obs_tri = &tris[obs_subset[idx1] * 3];
+            auto src_tri = &tris[src_subset[idx2] * 3];
+            if (obs_subset[idx1] == src_subset[idx2]) {
+                out[0].insert(out[0].end(), {idx1, idx2});
+                continue;
+            }
+
+            std::pair<long,long> pair1 = {-1,-1};
+            std::pair<long,long> pair2 = {-1,-1};
+            bool coincident = false;
+            for (int d1 = 0; d1 < 3; d1++) {
+                for (int d2 = 0; d2 < 3; d2++) {
+                    if (obs_tri[d1] != src_tri[d2]) {
+                        continue;
+                    }
+                    if (pair1.first == -1) {
+                        pair1 = {d1, d2};
+                    } else if (pair2.first == -1) {
+                        pair2 = {d1, d2};
+                    } else {
+                        coincident = true;
+                    }
+                }
+            }
+            if (coincident) {
+                continue;
+            }
+            if (pair1.first == -1) {
+                out[3].insert(out[3].end(), {idx1, idx2});
+            } else if (pair2.first == -1) {
+                out[2].insert(out[2].end(), {idx1, idx2, pair1.first, pair1.second});
+            } else {
+                long obs_clicks = edge_adj_orient(pair1.first, pair2.first);
+                long src_clicks = edge_adj_orient(pair1.second, pair2.second);
+                bool src_flip =
+                    obs_tri[obs_clicks % 3] != src_tri[(1 + src_clicks) % 3] ||
+                    obs_tri[(1 + obs_clicks) % 3] != src_tri[src_clicks % 3];
+                out[1].insert(
+                    out[1].end(),
+                    {idx1, idx2, obs_clicks, src_clicks, static_cast<long>(src_flip)}
+                );
+            }
+        }
+    }
+
+    std::array<std::vector<long>,4> out;
+    for (size_t k = 0; k < 4; k++) {
+        std::vector<std::vector<long>> chunks(n_blocks);
+        for (size_t b = 0; b < n_blocks; b++) {
+            chunks[b] = std::move(blocks[b][k]);
+        }
+        out[k] = concat_chunks(chunks);
+    }
+    return out;
+}
+
 PYBIND11_MODULE(fast_find_nearfield,m) {
     constexpr static int dim = 3;
 
+    m.attr("leaf_filter_lanes") = leaf_filter_lanes();
+
+    py::class_<NearfieldIndex<dim>>(m, "NearfieldIndex")
+        .def(py::init([] (NPArrayD pts, NPArrayD radius, int leaf_size) {
+            auto pts_ptr = as_ptr<std::array<double,dim>>(pts);
+            auto radius_ptr = as_ptr<double>(radius);
+            size_t n = pts.request().shape[0];
+            py::gil_scoped_release release;
+            return new NearfieldIndex<dim>(pts_ptr, radius_ptr, n, leaf_size);
+        }), py::arg("pts"), py::arg("radius"), py::arg("leaf_size") = 50)
+        .def_property_readonly("n_src", [] (const NearfieldIndex<dim>& index) {
+            return index.balls.R.size();
+        })
+        .def("query",
+            [] (const NearfieldIndex<dim>& index, NPArrayD obs_pts,
+                NPArrayD obs_radius, double threshold)
+            {
+                auto obs_pts_ptr = as_ptr<std::array<double,dim>>(obs_pts);
+                auto obs_radius_ptr = as_ptr<double>(obs_radius);
+                size_t n_obs = obs_pts.request().shape[0];
+                std::vector<long> out_vec;
+                {
+                    // Other Python threads can query the same index meanwhile.
+                    py::gil_scoped_release release;
+                    out_vec = index.query(obs_pts_ptr, obs_radius_ptr, n_obs, threshold);
+                }
+                return array_from_vector(out_vec, {out_vec.size() / 2, 2});
+            },
+            py::arg("obs_pts"), py::arg("obs_radius"), py::arg("threshold"));
+
     m.def("get_nearfield",
         [] (NPArrayD obs_pts, NPArrayD obs_radius,
             NPArrayD src_pts, NPArrayD src_radius,
             double threshold, int leaf_size) 
         {
             Timer t{true};
-            auto obs_pts_ptr = as_ptr<std::array<double,dim>>(obs_pts);
-            auto obs_radius_ptr = as_ptr<double>(obs_radius);
-            auto n_obs = obs_pts.request().shape[0];
-            auto obs_tree = Octree<dim>::build_fnc(obs_pts_ptr, obs_radius_ptr, n_obs, leaf_size);
-            auto obs_expanded_r = get_expanded_node_r(obs_tree, obs_radius_ptr);
-
             auto src_pts_ptr = as_ptr<std::array<double,dim>>(src_pts);
             auto src_radius_ptr = as_ptr<double>(src_radius);
             auto n_src = src_pts.request().shape[0];
-            auto src_tree = Octree<dim>::build_fnc(src_pts_ptr, src_radius_ptr, n_src, leaf_size);
-            auto src_expanded_r = get_expanded_node_r(src_tree, src_radius_ptr);
+            NearfieldIndex<dim> index(src_pts_ptr, src_radius_ptr, n_src, leaf_size);
             t.report("setup");
 
-            auto out_vec = query_ball_points(
-                obs_tree, obs_expanded_r, obs_pts_ptr, obs_radius_ptr, n_obs,
-                src_tree, src_expanded_r, src_pts_ptr, src_radius_ptr, n_src,
-                threshold
-            );
+            auto obs_pts_ptr = as_ptr<std::array<double,dim>>(obs_pts);
+            auto obs_radius_ptr = as_ptr<double>(obs_radius);
+            auto n_obs = obs_pts.request().shape[0];
+            auto out_vec = index.query(obs_pts_ptr, obs_radius_ptr, n_obs, threshold);
             t.report("query");
 
             auto out_arr = array_from_vector(out_vec, {out_vec.size() / 2, 2});
@@ -250,7 +585,9 @@ PYBIND11_MODULE(fast_find_nearfield,m) {
         });
 
     m.def("self_get_nearfield",
-        [] (NPArrayD pts, NPArrayD radius, double threshold, int leaf_size) {
+        [] (NPArrayD pts, NPArrayD radius, double threshold, int leaf_size,
+            bool canonical)
+        {
             Timer t{true};
             auto pts_ptr = as_ptr<std::array<double,dim>>(pts);
             auto radius_ptr = as_ptr<double>(radius);
@@ -259,18 +596,16 @@ PYBIND11_MODULE(fast_find_nearfield,m) {
             auto expanded_r = get_expanded_node_r(tree, radius_ptr);
             t.report("setup");
 
-            auto out_vec = query_ball_points(
-                tree, expanded_r, pts_ptr, radius_ptr, n_obs,
-                tree, expanded_r, pts_ptr, radius_ptr, n_obs,
-                threshold
-            );
+            auto out_vec = self_query_ball_points(tree, expanded_r, threshold, canonical);
             t.report("query");
 
             auto out_arr = array_from_vector(out_vec, {out_vec.size() / 2, 2});
             t.report("make out");
 
             return out_arr;
-        });
+        },
+        py::arg("pts"), py::arg("radius"), py::arg("threshold"),
+        py::arg("leaf_size"), py::arg("canonical") = false);
     
     m.def("split_adjacent_close",
         [] (NPArray<long> close_pairs, NPArray<long> trisA, NPArray<long> trisB) {
@@ -287,6 +622,23 @@ PYBIND11_MODULE(fast_find_nearfield,m) {
             );
         });
 
+    m.def("classify_nearfield",
+        [] (NPArray<long> close_pairs, NPArray<long> tris,
+            NPArray<long> obs_subset, NPArray<long> src_subset)
+        {
+            auto n_pairs = close_pairs.request().shape[0];
+            auto out = classify_nearfield(
+                as_ptr<long>(close_pairs), n_pairs, as_ptr<long>(tris),
+                as_ptr<long>(obs_subset), as_ptr<long>(src_subset)
+            );
+            return py::make_tuple(
+                array_from_vector(out[0], {out[0].size() / 2, 2}),
+                array_from_vector(out[1], {out[1].size() / 5, 5}),
+                array_from_vector(out[2], {out[2].size() / 4, 4}),
+                array_from_vector(out[3], {out[3].size() / 2, 2})
+            );
+        });
+
     m.def("split_vertex_nearfield",
         [] (NPArray<long> close_pairs, NPArrayD obs_pts, NPArrayD src_pts,
             NPArray<long> src_tris) 
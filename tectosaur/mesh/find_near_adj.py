@@ -9,6 +9,7 @@ fast_find_nearfield = imp('tectosaur.mesh.fast_find_nearfield')
 
 split_adjacent_close = fast_find_nearfield.split_adjacent_close
 split_vertex_nearfield = fast_find_nearfield.split_vertex_nearfield
+classify_nearfield = fast_find_nearfield.classify_nearfield
 
 def get_tri_centroids_rs(pts, tris):
     tri_pts = pts[tris]
@@ -19,14 +20,35 @@ def get_tri_centroids_rs(pts, tris):
     ))
     return centroid, r
 
-# TODO: Should I get rid of the self_ stuff?
-# def find_close_or_touching(pts, tris, threshold):
-#     out = fast_find_nearfield.self_get_nearfield(
-#         *get_tri_centroids_rs(pts, tris), threshold, 50
-#     )
-#     return out
+def same_mesh(a_pts, a_tris, b_pts, b_tris):
+    if a_pts is b_pts and a_tris is b_tris:
+        return True
+    return (
+        a_pts.shape == b_pts.shape and a_tris.shape == b_tris.shape
+        and np.array_equal(a_tris, b_tris) and np.array_equal(a_pts, b_pts)
+    )
+
+def build_nearfield_index(pts, tris, leaf_size = 50):
+    """
+    Returns a NearfieldIndex over the triangles of a source mesh. The tree is
+    built once, so repeated queries with different observation points only
+    pay for the observation tree and the traversal. Queries release the GIL,
+    so several can run at once from different threads.
+    """
+    return fast_find_nearfield.NearfieldIndex(
+        *get_tri_centroids_rs(pts, tris), leaf_size
+    )
 
-def find_close_or_touching(a_pts, a_tris, b_pts, b_tris, threshold):
+# When both meshes are the same, the symmetric self query finds each close pair
+# once and mirrors it, which halves the traversal. A prebuilt src_index for
+# (b_pts, b_tris) skips building the source tree.
+def find_close_or_touching(a_pts, a_tris, b_pts, b_tris, threshold, src_index = None):
+    if src_index is not None:
+        return src_index.query(*get_tri_centroids_rs(a_pts, a_tris), threshold)
+    if same_mesh(a_pts, a_tris, b_pts, b_tris):
+        return fast_find_nearfield.self_get_nearfield(
+            *get_tri_centroids_rs(a_pts, a_tris), threshold, 50
+        )
     out = fast_find_nearfield.get_nearfield(
         *get_tri_centroids_rs(a_pts, a_tris),
         *get_tri_centroids_rs(b_pts, b_tris),
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LEAF_FILTER_X86
+#include <immintrin.h>
+#endif
+
+// The leaf-leaf part of the nearfield query. The balls of a tree are copied
+// into structure-of-arrays form in tree order, so the balls of every leaf are
+// contiguous and one obs ball can be tested against a whole src leaf with
+// vector loads. On x86, the AVX-512 and AVX2 loops are compiled for their
+// instruction sets with target attributes and chosen at runtime from what the
+// CPU supports, so the module itself is built for the baseline architecture
+// and can be shared between machines. They test 8 or 4 src balls at once and
+// compact the indices of the accepted balls. Otherwise, and for the remainder
+// of each leaf, the scalar loop is used. All paths must accept the same pairs,
+// including those exactly on the boundary, so the distance is computed with
+// the same roundings everywhere: GCC would otherwise contract the squares and
+// sums into fused multiply-adds wherever the target has them, so contraction
+// is turned off for these functions. Clang only contracts within a single
+// expression, which the separate statements and intrinsic calls avoid.
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define LEAF_FILTER_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define LEAF_FILTER_NO_CONTRACT
+#endif
+
+enum class LeafFilterISA { scalar, avx2, avx512 };
+
+inline bool leaf_filter_isa_supported(LeafFilterISA isa) {
+#ifdef LEAF_FILTER_X86
+    switch (isa) {
+        case LeafFilterISA::avx512: return __builtin_cpu_supports("avx512f");
+        case LeafFilterISA::avx2: return __builtin_cpu_supports("avx2");
+        default: return true;
+    }
+#else
+    return isa == LeafFilterISA::scalar;
+#endif
+}
+
+inline LeafFilterISA leaf_filter_isa() {
+    static const LeafFilterISA isa =
+        leaf_filter_isa_supported(LeafFilterISA::avx512) ? LeafFilterISA::avx512 :
+        leaf_filter_isa_supported(LeafFilterISA::avx2) ? LeafFilterISA::avx2 :
+        LeafFilterISA::scalar;
+    return isa;
+}
+
+// The number of src balls tested at once on this CPU.
+inline int leaf_filter_lanes() {
+    switch (leaf_filter_isa()) {
+        case LeafFilterISA::avx512: return 8;
+        case LeafFilterISA::avx2: return 4;
+        default: return 1;
+    }
+}
+
+template <size_t dim>
+struct BallsSoA {
+    std::array<std::vector<double>,dim> centers;
+    std::vector<double> R;
+    std::vector<long> orig_idxs;
+};
+
+template <typename TreeT>
+BallsSoA<TreeT::dim> balls_soa(const TreeT& tree) {
+    constexpr size_t dim = TreeT::dim;
+    size_t n = tree.balls.size();
+    BallsSoA<dim> out;
+    for (size_t d = 0; d < dim; d++) {
+        out.centers[d].resize(n);
+    }
+    out.R.resize(n);
+    out.orig_idxs.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t d = 0; d < dim; d++) {
+            out.centers[d][i] = tree.balls[i].center[d];
+        }
+        out.R[i] = tree.balls[i].R;
+        out.orig_idxs[i] = tree.orig_idxs[i];
+    }
+    return out;
+}
+
+#ifdef LEAF_FILTER_X86
+
+// Tests the src balls from j in blocks of 8, appending the hits. Returns the
+// first ball that wasn't tested.
+template <size_t dim>
+__attribute__((target("avx512f"))) LEAF_FILTER_NO_CONTRACT
+size_t filter_span_avx512(const BallsSoA<dim>& obs, size_t i,
+    const BallsSoA<dim>& src, size_t j, size_t end,
+    double threshold, long* hits, size_t& n_hits)
+{
+    __m512d thr = _mm512_set1_pd(threshold);
+    __m512d Ri = _mm512_set1_pd(obs.R[i]);
+    __m512d ci[dim];
+    for (size_t d = 0; d < dim; d++) {
+        ci[d] = _mm512_set1_pd(obs.centers[d][i]);
+    }
+    __m512i lanes = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+    for (; j + 8 <= end; j += 8) {
+        __m512d d2 = _mm512_setzero_pd();
+        for (size_t d = 0; d < dim; d++) {
+            __m512d diff = _mm512_sub_pd(ci[d], _mm512_loadu_pd(&src.centers[d][j]));
+            d2 = _mm512_add_pd(d2, _mm512_mul_pd(diff, diff));
+        }
+        __m512d limit = _mm512_mul_pd(_mm512_add_pd(Ri, _mm512_loadu_pd(&src.R[j])), thr);
+        limit = _mm512_mul_pd(limit, limit);
+        __mmask8 mask = _mm512_cmp_pd_mask(d2, limit, _CMP_NGT_UQ);
+        __m512i js = _mm512_add_epi64(_mm512_set1_epi64(static_cast<long>(j)), lanes);
+        _mm512_mask_compressstoreu_epi64(hits + n_hits, mask, js);
+        n_hits += __builtin_popcount(mask);
+    }
+    return j;
+}
+
+// The same in blocks of 4.
+template <size_t dim>
+__attribute__((target("avx2"))) LEAF_FILTER_NO_CONTRACT
+size_t filter_span_avx2(const BallsSoA<dim>& obs, size_t i,
+    const BallsSoA<dim>& src, size_t j, size_t end,
+    double threshold, long* hits, size_t& n_hits)
+{
+    __m256d thr = _mm256_set1_pd(threshold);
+    __m256d Ri = _mm256_set1_pd(obs.R[i]);
+    __m256d ci[dim];
+    for (size_t d = 0; d < dim; d++) {
+        ci[d] = _mm256_set1_pd(obs.centers[d][i]);
+    }
+    for (; j + 4 <= end; j += 4) {
+        __m256d d2 = _mm256_setzero_pd();
+        for (size_t d = 0; d < dim; d++) {
+            __m256d diff = _mm256_sub_pd(ci[d], _mm256_loadu_pd(&src.centers[d][j]));
+            d2 = _mm256_add_pd(d2, _mm256_mul_pd(diff, diff));
+        }
+        __m256d limit = _mm256_mul_pd(_mm256_add_pd(Ri, _mm256_loadu_pd(&src.R[j])), thr);
+        limit = _mm256_mul_pd(limit, limit);
+        int mask = _mm256_movemask_pd(_mm256_cmp_pd(d2, limit, _CMP_NGT_UQ));
+        while (mask != 0) {
+            hits[n_hits++] = j + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return j;
+}
+
+#endif
+
+// Writes the index of every src ball j in [start, end) with
+//     |c_i - c_j|^2 <= ((R_i + R_j) * threshold)^2
+// to hits and returns the number of hits. isa must be supported by the CPU.
+template <size_t dim>
+LEAF_FILTER_NO_CONTRACT
+size_t filter_row(const BallsSoA<dim>& obs, size_t i,
+    const BallsSoA<dim>& src, size_t start, size_t end,
+    double threshold, long* hits, LeafFilterISA isa = leaf_filter_isa())
+{
+    size_t n_hits = 0;
+    size_t j = start;
+
+#ifdef LEAF_FILTER_X86
+    if (isa == LeafFilterISA::avx512) {
+        j = filter_span_avx512(obs, i, src, j, end, threshold, hits, n_hits);
+    } else if (isa == LeafFilterISA::avx2) {
+        j = filter_span_avx2(obs, i, src, j, end, threshold, hits, n_hits);
+    }
+#endif
+
+    for (; j < end; j++) {
+        double d2 = 0.0;
+        for (size_t d = 0; d < dim; d++) {
+            double diff = obs.centers[d][i] - src.centers[d][j];
+            double sq = diff * diff;
+            d2 += sq;
+        }
+        double limit = (obs.R[i] + src.R[j]) * threshold;
+        if (d2 > limit * limit) {
+            continue;
+        }
+        hits[n_hits++] = j;
+    }
+    return n_hits;
+}
+
+// Appends the (obs orig idx, src orig idx) pairs between two leaves to out.
+// With upper_triangle, obs and src are the same leaf and only the pairs with
+// src tree idx >= obs tree idx are tested, so each pair is found once.
+template <size_t dim>
+void filter_leaf_pairs(std::vector<long>& out,
+    const BallsSoA<dim>& obs, size_t obs_start, size_t obs_end,
+    const BallsSoA<dim>& src, size_t src_start, size_t src_end,
+    double threshold, bool upper_triangle = false,
+    LeafFilterISA isa = leaf_filter_isa())
+{
+    thread_local std::vector<long> hits;
+    if (hits.size() < src_end - src_start) {
+        hits.resize(src_end - src_start);
+    }
+    for (size_t i = obs_start; i < obs_end; i++) {
+        size_t row_start = upper_triangle ? i : src_start;
+        size_t n_hits = filter_row(
+            obs, i, src, row_start, src_end, threshold, hits.data(), isa
+        );
+        size_t out_start = out.size();
+        out.resize(out_start + 2 * n_hits);
+        long orig_i = obs.orig_idxs[i];
+        for (size_t k = 0; k < n_hits; k++) {
+            out[out_start + 2 * k] = orig_i;
+            out[out_start + 2 * k + 1] = src.orig_idxs[hits[k]];
+        }
+    }
+}
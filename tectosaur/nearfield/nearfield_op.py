@@ -16,27 +16,11 @@ def any_nearfield(pts, tris, obs_subset, src_subset, near_threshold):
     close_or_touch_pairs = find_near_adj.find_close_or_touching(
         pts, tris[obs_subset], pts, tris[src_subset], near_threshold
     )
-    nearfield_pairs_dofs, va_dofs, ea_dofs = find_near_adj.split_adjacent_close(
-        close_or_touch_pairs, tris[obs_subset], tris[src_subset]
+    co_dofs, ea_dofs, va_dofs, nearfield_pairs_dofs = find_near_adj.classify_nearfield(
+        close_or_touch_pairs, tris, obs_subset, src_subset
     )
     return nearfield_pairs_dofs.shape[0] > 0
 
-def to_dof_space(tri_indices, obs_subset, src_subset):
-    dof_space_indices = []
-    for pair in tri_indices:
-        try:
-            dof_space_indices.append([
-                np.where(obs_subset == pair[0])[0][0],
-                np.where(src_subset == pair[1])[0][0]
-            ])
-        except:
-            import ipdb
-            ipdb.set_trace()
-    dof_space_indices = np.array(dof_space_indices)
-    if dof_space_indices.shape[0] == 0:
-        dof_space_indices = np.empty((0, 2), dtype = np.int)
-    return dof_space_indices
-
 def to_tri_space(dof_indices, obs_subset, src_subset):
     tri_idxs = np.array([obs_subset[dof_indices[:,0]], src_subset[dof_indices[:,1]]]).T
     return np.concatenate((tri_idxs, dof_indices[:,2:]), axis = 1)
@@ -73,6 +57,18 @@ def build_nearfield(shape, *mats):
         out.append(bcoo)
     return out
 
+def sum_dot(mats, v, out = None):
+    if out is None:
+        out = np.zeros(
+            (mats[0].shape[0],) + v.shape[1:],
+            dtype = np.result_type(*[m.dtype for m in mats])
+        )
+    else:
+        out.fill(0)
+    for m in mats:
+        m.dot(v, out = out)
+    return out
+
 class RegularizedNearfieldIntegralOp:
     def __init__(self, pts, tris, obs_subset, src_subset,
             nq_coincident, nq_edge_adj, nq_vert_adjacent,
@@ -92,28 +88,26 @@ class RegularizedNearfieldIntegralOp:
         )
         timer.report('setup pairs integrator')
 
-        co_tris = np.intersect1d(obs_subset, src_subset)
-        co_indices = np.array([co_tris, co_tris]).T.copy()
-        co_dofs = to_dof_space(co_indices, obs_subset, src_subset)
-
-        co_mat = pairs_int.coincident(nq_coincident, co_indices)
-
-        timer.report("Coincident")
-        co_mat_correction = correction_pairs_int.correction(co_indices, True)
-        timer.report("Coincident correction")
-
+        # The close pairs are classified in one pass, in dof space, with the
+        # edge adjacent orientation already resolved.
         close_or_touch_pairs = find_near_adj.find_close_or_touching(
             pts, tris[obs_subset], pts, tris[src_subset], near_threshold
         )
-        nearfield_pairs_dofs, va_dofs, ea_dofs = find_near_adj.split_adjacent_close(
-            close_or_touch_pairs, tris[obs_subset], tris[src_subset]
+        co_dofs, ea_dofs, va_dofs, nearfield_pairs_dofs = find_near_adj.classify_nearfield(
+            close_or_touch_pairs, tris, obs_subset, src_subset
         )
+        co_indices = to_tri_space(co_dofs, obs_subset, src_subset)
         nearfield_pairs = to_tri_space(nearfield_pairs_dofs, obs_subset, src_subset)
         va = to_tri_space(va_dofs, obs_subset, src_subset)
         va = np.hstack((va, np.zeros((va.shape[0], 1))))
-        ea = resolve_ea_rotation(tris, to_tri_space(ea_dofs, obs_subset, src_subset))
+        ea = to_tri_space(ea_dofs, obs_subset, src_subset)
         timer.report("Find nearfield/adjacency")
 
+        co_mat = pairs_int.coincident(nq_coincident, co_indices)
+        timer.report("Coincident")
+        co_mat_correction = correction_pairs_int.correction(co_indices, True)
+        timer.report("Coincident correction")
+
         ea_mat_rot = pairs_int.edge_adj(nq_edge_adj, ea)
         timer.report("Edge adjacent")
         if ea.shape[0] == 0:
@@ -155,11 +149,11 @@ class RegularizedNearfieldIntegralOp:
     def full_scipy_mat_no_correction(self):
         return sum([m.to_bsr().to_scipy() for m in self.mat_no_correction])
 
-    def dot(self, v):
-        return sum(arr.dot(v) for arr in self.mat)
+    def dot(self, v, out = None):
+        return sum_dot(self.mat, v, out)
 
-    def nearfield_no_correction_dot(self, v):
-        return sum(arr.dot(v) for arr in self.mat_no_correction)
+    def nearfield_no_correction_dot(self, v, out = None):
+        return sum_dot(self.mat_no_correction, v, out)
 
     def to_dense(self):
         return sum([mat.to_bsr().to_scipy().todense() for mat in self.mat])
@@ -180,29 +174,26 @@ class NearfieldIntegralOp:
         pairs_int = PairsIntegrator(kernel, params, float_type, nq_far, nq_near, pts, tris)
         timer.report('setup pairs integrator')
 
-        co_tris = np.intersect1d(obs_subset, src_subset)
-        co_indices = np.array([co_tris, co_tris]).T.copy()
-        co_dofs = to_dof_space(co_indices, obs_subset, src_subset)
-
-        co_mat = coincident_table(kernel, params, pts[tris[co_tris]], float_type)
-        timer.report("Coincident")
-        co_mat_correction = pairs_int.correction(co_indices, True)
-        timer.report("Coincident correction")
-
         close_or_touch_pairs = find_near_adj.find_close_or_touching(
             pts, tris[obs_subset], pts, tris[src_subset], near_threshold
         )
-        nearfield_pairs_dofs, va_dofs, ea_dofs = find_near_adj.split_adjacent_close(
-            close_or_touch_pairs, tris[obs_subset], tris[src_subset]
+        co_dofs, ea_dofs, va_dofs, nearfield_pairs_dofs = find_near_adj.classify_nearfield(
+            close_or_touch_pairs, tris, obs_subset, src_subset
         )
+        co_indices = to_tri_space(co_dofs, obs_subset, src_subset)
         nearfield_pairs = to_tri_space(nearfield_pairs_dofs, obs_subset, src_subset)
         va = to_tri_space(va_dofs, obs_subset, src_subset)
         ea = to_tri_space(ea_dofs, obs_subset, src_subset)
         timer.report("Find nearfield/adjacency")
 
+        co_mat = coincident_table(kernel, params, pts[tris[co_indices[:,0]]], float_type)
+        timer.report("Coincident")
+        co_mat_correction = pairs_int.correction(co_indices, True)
+        timer.report("Coincident correction")
+
         ea_mat_rot = adjacent_table(nq_vert_adjacent, kernel, params, pts, tris, ea, float_type)
         timer.report("Edge adjacent")
-        ea_mat_correction = pairs_int.correction(ea, False)
+        ea_mat_correction = pairs_int.correction(ea[:,:2], False)
         timer.report("Edge adjacent correction")
 
         va_mat_rot = pairs_int.vert_adj(nq_vert_adjacent, va)
@@ -232,11 +223,11 @@ class NearfieldIntegralOp:
         )
         timer.report("Assemble uncorrected matrix")
 
-    def dot(self, v):
-        return sum(arr.dot(v) for arr in self.mat)
+    def dot(self, v, out = None):
+        return sum_dot(self.mat, v, out)
 
-    def nearfield_no_correction_dot(self, v):
-        return sum(arr.dot(v) for arr in self.mat_no_correction)
+    def nearfield_no_correction_dot(self, v, out = None):
+        return sum_dot(self.mat_no_correction, v, out)
 
     def to_dense(self):
         return sum([mat.to_bsr().to_scipy().todense() for mat in self.mat])
@@ -0,0 +1,148 @@
+import time
+import itertools
+import attr
+import numpy as np
+
+import tectosaur.util.disk_cache as disk_cache
+from tectosaur.ops.sparse_farfield_op import (
+    TriToTriDirectFarfieldOp, FMMFarfieldOp, FMMFarfieldOpImpl
+)
+
+import logging
+logger = logging.getLogger(__name__)
+
+# Chooses the FMM parameters (mac, pts_per_cell, order) for a mesh instead of
+# guessing them. The error of each trial configuration is measured against
+# direct evaluation on a random sample of the observation triangles, so the
+# estimate costs n_samples rows of the dense farfield operator.
+
+default_macs = [2.0, 2.5, 3.0, 4.0]
+default_pts_per_cells = [50, 100, 200]
+default_orders = [2, 4, 6, 8, 10]
+
+def time_dot(op, v, n_runs):
+    best = np.inf
+    for i in range(n_runs):
+        start = time.time()
+        y = op.dot(v)
+        best = min(best, time.time() - start)
+    return y, best
+
+def tune_fmm(nq_far, K_name, params, pts, tris, float_type,
+        obs_subset, src_subset, tol,
+        macs = default_macs, pts_per_cells = default_pts_per_cells,
+        orders = default_orders, n_samples = 100, n_timing_runs = 2,
+        backend = 'gpu', tree_builder = 'build', use_cache = False,
+        treecode = True, persist = True):
+    """
+    Returns (op_type, op) where op_type is the fastest FMMFarfieldOp that
+    has a sampled relative error below tol and op is its operator for the
+    given mesh. backend, tree_builder, use_cache and treecode are passed on
+    to every trial operator and to op_type. With persist, the choice is
+    stored in the disk cache keyed by the kernel, the quadrature, the
+    tolerance, the mesh size, the backend, the tree builder and treecode, and
+    later calls return it immediately with op = None. Raises ValueError if no configuration meets
+    tol.
+    """
+    params = list(params)
+    key = disk_cache.hash_key(
+        K_name, params, nq_far, np.dtype(float_type).str, tol,
+        obs_subset.shape[0], src_subset.shape[0],
+        macs, pts_per_cells, orders, backend, tree_builder, treecode
+    )
+    if persist:
+        arrays = disk_cache.load_arrays('fmm_tuning', key)
+        if arrays is not None:
+            op_type = FMMFarfieldOp(
+                mac = float(arrays['mac']),
+                pts_per_cell = int(arrays['pts_per_cell']),
+                order = int(arrays['order']),
+                tree_builder = tree_builder, use_cache = use_cache,
+                backend = backend, treecode = treecode
+            )
+            return op_type, None
+
+    rng = np.random.RandomState(0)
+    sample = np.sort(rng.choice(
+        obs_subset.shape[0], min(n_samples, obs_subset.shape[0]), replace = False
+    ))
+    v = rng.rand(src_subset.shape[0] * 9)
+    direct = TriToTriDirectFarfieldOp(
+        nq_far, K_name, params, pts, tris, float_type,
+        obs_subset[sample], src_subset
+    ).dot(v)
+    direct_norm = np.linalg.norm(direct)
+
+    best = None
+    for mac, pts_per_cell in itertools.product(macs, pts_per_cells):
+        # Higher orders are only slower once the tolerance is met.
+        for order in sorted(orders):
+            op = FMMFarfieldOpImpl(
+                nq_far, K_name, params, pts, tris, float_type,
+                obs_subset, src_subset, mac, pts_per_cell, order,
+                tree_builder = tree_builder, use_cache = use_cache,
+                backend = backend, treecode = treecode
+            )
+            y, runtime = time_dot(op, v, n_timing_runs)
+            y_sample = y.reshape((-1, 9))[sample].flatten()
+            err = np.linalg.norm(y_sample - direct) / direct_norm
+            logger.info(
+                'mac = {}, pts_per_cell = {}, order = {}: error = {:.3e}, time = {:.3f}s'
+                .format(mac, pts_per_cell, order, err, runtime)
+            )
+            if err < tol:
+                if best is None or runtime < best[0]:
+                    best = (runtime, (mac, pts_per_cell, order), op)
+                break
+
+    if best is None:
+        raise ValueError(
+            'No FMM configuration has a relative error below ' + str(tol) + '.'
+        )
+
+    mac, pts_per_cell, order = best[1]
+    if persist:
+        disk_cache.save_arrays('fmm_tuning', key, dict(
+            mac = np.array(mac),
+            pts_per_cell = np.array(pts_per_cell),
+            order = np.array(order)
+        ))
+    op_type = FMMFarfieldOp(
+        mac = mac, pts_per_cell = pts_per_cell, order = order,
+        tree_builder = tree_builder, use_cache = use_cache, backend = backend,
+        treecode = treecode
+    )
+    return op_type, best[2]
+
+@attr.s()
+class TunedFMMFarfieldOp:
+    """
+    A farfield_op_type that runs tune_fmm when the operator is built.
+    """
+    tol = attr.ib()
+    macs = attr.ib(default = default_macs)
+    pts_per_cells = attr.ib(default = default_pts_per_cells)
+    orders = attr.ib(default = default_orders)
+    n_samples = attr.ib(default = 100)
+    backend = attr.ib(default = 'gpu')
+    tree_builder = attr.ib(default = 'build')
+    use_cache = attr.ib(default = False)
+    treecode = attr.ib(default = True)
+    persist = attr.ib(default = True)
+    def __call__(self, nq_far, K_name, params, pts, tris, float_type,
+            obs_subset, src_subset):
+        op_type, op = tune_fmm(
+            nq_far, K_name, params, pts, tris, float_type,
+            obs_subset, src_subset, self.tol,
+            macs = self.macs, pts_per_cells = self.pts_per_cells,
+            orders = self.orders, n_samples = self.n_samples,
+            backend = self.backend, tree_builder = self.tree_builder,
+            use_cache = self.use_cache, treecode = self.treecode,
+            persist = self.persist
+        )
+        if op is None:
+            op = op_type(
+                nq_far, K_name, params, pts, tris, float_type,
+                obs_subset, src_subset
+            )
+        return op
@@ -21,11 +21,8 @@ class TriToTriDirectFarfieldOp:
         self.tensor_dim = kernels[K_name].tensor_dim
         self.n_obs = obs_subset.shape[0]
         self.n_src = src_subset.shape[0]
-
-        in_size = self.n_src * self.dim * self.tensor_dim
-        out_size = self.n_obs * self.dim * self.tensor_dim
-        self.gpu_in = gpu.empty_gpu(in_size, float_type)
-        self.gpu_out = gpu.empty_gpu(out_size, float_type)
+        self.K_name = K_name
+        self.float_type = float_type
 
         self.q = gauss2d_tri(nq_far)
 
@@ -36,19 +33,43 @@ class TriToTriDirectFarfieldOp:
         self.block_size = 128
         self.n_blocks = int(np.ceil(self.n_obs / self.block_size))
 
-        self.module = gpu.load_gpu(
-            'matrix_free.cl',
-            tmpl_args = dict(
-                block_size = self.block_size,
-                float_type = gpu.np_to_c_type(float_type),
-                quad_pts = self.q[0],
-                quad_wts = self.q[1]
+        self.n_rhs = None
+        self.rhs_state = dict()
+        self.set_n_rhs(1)
+
+    def set_n_rhs(self, n_rhs):
+        # Each element's geometry and kernel evaluations are shared by all the
+        # right hand sides, so a block of k vectors costs much less than k
+        # separate products. The kernel and the buffers are kept per n_rhs.
+        if n_rhs == self.n_rhs:
+            return
+        self.n_rhs = n_rhs
+        if n_rhs not in self.rhs_state:
+            in_size = self.n_src * self.dim * self.tensor_dim * n_rhs
+            out_size = self.n_obs * self.dim * self.tensor_dim * n_rhs
+            module = gpu.load_gpu(
+                'matrix_free.cl',
+                tmpl_args = dict(
+                    block_size = self.block_size,
+                    float_type = gpu.np_to_c_type(self.float_type),
+                    quad_pts = self.q[0],
+                    quad_wts = self.q[1],
+                    n_rhs = n_rhs
+                )
             )
-        )
-        self.fnc = getattr(self.module, "farfield_tris_to_tris" + K_name)
+            self.rhs_state[n_rhs] = (
+                getattr(module, "farfield_tris_to_tris" + self.K_name),
+                gpu.empty_gpu(in_size, self.float_type),
+                gpu.empty_gpu(out_size, self.float_type)
+            )
+        self.fnc, self.gpu_in, self.gpu_out = self.rhs_state[n_rhs]
 
     def dot(self, v):
-        self.gpu_in[:] = v[:].astype(self.gpu_in.dtype)
+        """
+        v is either a vector or a (shape[1], k) block of k right hand sides.
+        """
+        self.set_n_rhs(1 if v.ndim == 1 else v.shape[1])
+        self.gpu_in[:] = v.reshape(-1).astype(self.gpu_in.dtype)
         self.fnc(
             self.gpu_out, self.gpu_in,
             self.gpu_pts, self.gpu_obs_tris, self.gpu_src_tris,
@@ -56,7 +77,7 @@ class TriToTriDirectFarfieldOp:
             np.int32(self.n_obs), np.int32(self.n_src),
             grid = (self.n_blocks, 1, 1), block = (self.block_size, 1, 1)
         )
-        return self.gpu_out.get()
+        return self.gpu_out.get().reshape((self.shape[0],) + v.shape[1:])
 
     async def async_dot(self, v):
         return self.dot(v)
@@ -70,21 +91,52 @@ class TriToTriDirectFarfieldOp:
     def farfield_dot(self, v):
         return self.dot(v)
 
+# mac_type selects the multipole acceptance criterion, see make_mac in
+# tsfmm.py. mac is the parameter of the 'ball' and 'box' criteria, theta the
+# parameter of 'theta' and mac_tol the tolerance of 'error'.
+#
+# treecode = False runs the full FMM (m2l, l2l and l2p), whose cost grows
+# linearly with the number of triangles, instead of the O(N log N) treecode.
+# The default stays True: the local expansions add a second truncation error,
+# so the mac and order values chosen for existing models and by tune_fmm would
+# give less accurate operators. For meshes with millions of triangles, set
+# treecode = False (fmm_treecode in the model cfg) and check the accuracy, for
+# example with tune_fmm, which then tunes the full FMM.
+#
+# With renumber = True, the operator works in the order of the FMM trees (see
+# TSFMM) and obs_perm and src_perm give the order of the obs and src subsets:
+# entry i of the input belongs to triangle src_subset[src_perm[i]].
+# RegularizedSparseIntegralOp builds its nearfield in the same order.
 @attr.s()
 class FMMFarfieldOp:
     mac = attr.ib()
     pts_per_cell = attr.ib()
     order = attr.ib()
+    tree_builder = attr.ib(default = 'build')
+    use_cache = attr.ib(default = False)
+    backend = attr.ib(default = 'gpu')
+    mac_type = attr.ib(default = 'ball')
+    theta = attr.ib(default = None)
+    mac_tol = attr.ib(default = None)
+    treecode = attr.ib(default = True)
+    renumber = attr.ib(default = False)
     def __call__(self, nq_far, K_name, params, pts, tris, float_type,
             obs_subset, src_subset):
         return FMMFarfieldOpImpl(
             nq_far, K_name, params, pts, tris, float_type,
-            obs_subset, src_subset, self.mac, self.pts_per_cell, self.order
+            obs_subset, src_subset, self.mac, self.pts_per_cell, self.order,
+            tree_builder = self.tree_builder, use_cache = self.use_cache,
+            backend = self.backend, mac_type = self.mac_type,
+            theta = self.theta, mac_tol = self.mac_tol,
+            treecode = self.treecode, renumber = self.renumber
         )
 
 class FMMFarfieldOpImpl:
     def __init__(self, nq_far, K_name, params, pts, tris, float_type,
-            obs_subset, src_subset, mac, pts_per_cell, order):
+            obs_subset, src_subset, mac, pts_per_cell, order,
+            tree_builder = 'build', use_cache = False, backend = 'gpu',
+            mac_type = 'ball', theta = None, mac_tol = None, treecode = True,
+            renumber = False):
 
         L_scale = np.max(pts)
         scaled_pts = pts / L_scale
@@ -98,8 +150,13 @@ class FMMFarfieldOpImpl:
             quad_order = nq_far, float_type = float_type,
             K_name = K_name,
             mac = mac, max_pts_per_cell = pts_per_cell,
-            n_workers_per_block = 128
+            n_workers_per_block = 128, tree_builder = tree_builder,
+            use_cache = use_cache, backend = backend,
+            mac_type = mac_type, theta = theta, mac_tol = mac_tol,
+            treecode = treecode, renumber = renumber
         )
+        self.obs_perm = self.fmm.obs_perm
+        self.src_perm = self.fmm.src_perm
 
     def dot(self, v):
         t = Timer(output_fnc = logger.debug)
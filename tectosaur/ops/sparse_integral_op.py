@@ -1,3 +1,6 @@
+import os
+import threading
+import concurrent.futures
 import numpy as np
 
 from tectosaur.nearfield.nearfield_op import NearfieldIntegralOp, RegularizedNearfieldIntegralOp
@@ -7,6 +10,22 @@ from tectosaur.util.timer import Timer
 import logging
 logger = logging.getLogger(__name__)
 
+# Persistent worker threads for the nearfield products, shared by all the
+# operators so that no threads are created per matvec. The pool only starts a
+# thread when none is idle, so it grows to the number of concurrent dot calls
+# and a product is never queued behind another caller's, up to one thread per
+# core.
+executor = None
+executor_lock = threading.Lock()
+def get_executor():
+    global executor
+    with executor_lock:
+        if executor is None:
+            executor = concurrent.futures.ThreadPoolExecutor(
+                max_workers = os.cpu_count() or 1
+            )
+    return executor
+
 class RegularizedSparseIntegralOp:
     def __init__(self, nq_coincident, nq_edge_adj, nq_vert_adjacent,
             nq_far, nq_near, near_threshold,
@@ -18,6 +37,25 @@ class RegularizedSparseIntegralOp:
         if src_subset is None:
             src_subset = np.arange(tris.shape[0])
 
+        self.farfield = farfield_op_type(
+            nq_far, K_far_name, params, pts, tris,
+            float_type, obs_subset, src_subset
+        )
+
+        # If the farfield renumbered the triangles into its tree order (see
+        # FMMFarfieldOp), the nearfield is built in the same order, so the
+        # whole operator works in it. Build any other operator on the same
+        # mesh, like a MassOp, on tris[self.obs_subset] so that it shares the
+        # numbering.
+        self.obs_perm = getattr(self.farfield, 'obs_perm', None)
+        self.src_perm = getattr(self.farfield, 'src_perm', None)
+        if self.obs_perm is not None:
+            obs_subset = obs_subset[self.obs_perm]
+        if self.src_perm is not None:
+            src_subset = src_subset[self.src_perm]
+        self.obs_subset = obs_subset
+        self.src_subset = src_subset
+
         self.nearfield = RegularizedNearfieldIntegralOp(
             pts, tris, obs_subset, src_subset,
             nq_coincident, nq_edge_adj, nq_vert_adjacent, nq_far, nq_near,
@@ -25,14 +63,11 @@ class RegularizedSparseIntegralOp:
             params, float_type
         )
 
-        self.farfield = farfield_op_type(
-            nq_far, K_far_name, params, pts, tris,
-            float_type, obs_subset, src_subset
-        )
-
         self.shape = self.nearfield.shape
+        self.near_dtype = np.result_type(*[m.dtype for m in self.nearfield.mat])
+        self.buffers = threading.local()
 
-    async def nearfield_dot(self, v):
+    def nearfield_dot(self, v):
         t = Timer(output_fnc = logger.debug)
         logger.debug("start nearfield_dot")
         out = self.nearfield.dot(v)
@@ -42,21 +77,43 @@ class RegularizedSparseIntegralOp:
     def nearfield_no_correction_dot(self, v):
         return self.nearfield.nearfield_no_correction_dot(v)
 
-    def dot(self, v):
-        import asyncio
-        loop = asyncio.new_event_loop()
-        async def dot_helper():
-            yfar = asyncio.ensure_future(self.farfield_dot(v))
-            ynear = asyncio.ensure_future(self.nearfield_dot(v))
-            return (await yfar) + (await ynear)
-        out = loop.run_until_complete(dot_helper())
-        loop.close()
-
+    def near_out(self, v):
+        """
+        The buffer for the nearfield result, reused across calls with the same
+        number of right hand sides. Every calling thread has its own, so
+        concurrent dot calls on one operator don't share it.
+        """
+        near_shape = (self.shape[0],) + v.shape[1:]
+        out = getattr(self.buffers, 'near_out', None)
+        if out is None or out.shape != near_shape:
+            out = np.zeros(near_shape, dtype = self.near_dtype)
+            self.buffers.near_out = out
         return out
 
-    async def farfield_dot(self, v):
+    def dot(self, v):
+        # The nearfield product runs on the executor thread while this thread
+        # drives the farfield. Both release the GIL while they work, so they
+        # overlap. The sparse product and the CPU farfield backend are both
+        # OpenMP parallel and each sizes its thread team to the whole machine,
+        # so with backend = 'cpu' the two teams oversubscribe the cores. Setting
+        # OMP_NUM_THREADS to about half the core count avoids that.
+        near_out = self.near_out(v)
+        near_future = get_executor().submit(self.nearfield.dot, v, near_out)
+        # If the farfield fails, the nearfield product must still finish
+        # before near_out can be reused by this thread's next call.
+        try:
+            out = self.farfield_dot(v)
+        finally:
+            concurrent.futures.wait([near_future])
+        near_future.result()
+        if out.dtype == np.result_type(out, near_out):
+            out += near_out
+            return out
+        return out + near_out
+
+    def farfield_dot(self, v):
         t = Timer(output_fnc = logger.debug)
         logger.debug("start farfield_dot")
-        out = await self.farfield.async_dot(v)
+        out = self.farfield.dot(v)
         t.report('farfield_dot')
         return out
@@ -10,11 +10,30 @@ from .pt_average import pt_averageD
 from . import newton
 
 def get_farfield_op(cfg):
-    if cfg['use_fmm']:
+    # The FMM backend, tree settings and fmm_treecode are optional, with the
+    # same defaults as FMMFarfieldOp.
+    fmm_args = dict(
+        backend = cfg.get('fmm_backend', 'gpu'),
+        tree_builder = cfg.get('fmm_tree_builder', 'build'),
+        use_cache = cfg.get('fmm_use_cache', False),
+        treecode = cfg.get('fmm_treecode', True)
+    )
+    # With fmm_tol, the FMM parameters are tuned for the mesh instead, using
+    # the 'ball' acceptance criterion.
+    if cfg['use_fmm'] and cfg.get('fmm_tol') is not None:
+        return tct.TunedFMMFarfieldOp(tol = cfg['fmm_tol'], **fmm_args)
+    elif cfg['use_fmm']:
+        # fmm_mac_type is 'ball' (the default), 'box', 'theta' or 'error'. The
+        # 'theta' criterion takes fmm_theta and 'error' takes fmm_mac_tol
+        # instead of fmm_mac.
         return tct.FMMFarfieldOp(
-            mac = cfg['fmm_mac'],
+            mac = cfg.get('fmm_mac'),
             pts_per_cell = cfg['pts_per_cell'],
-            order = cfg['fmm_order']
+            order = cfg['fmm_order'],
+            mac_type = cfg.get('fmm_mac_type', 'ball'),
+            theta = cfg.get('fmm_theta'),
+            mac_tol = cfg.get('fmm_mac_tol'),
+            **fmm_args
         )
     else:
         return tct.TriToTriDirectFarfieldOp
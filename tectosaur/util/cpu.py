@@ -0,0 +1,229 @@
+import os
+import re
+import ctypes
+import platform
+import functools
+import tempfile
+import subprocess
+import numpy as np
+
+import tectosaur.util.disk_cache as disk_cache
+from tectosaur.util.timer import Timer
+
+import logging
+logger = logging.getLogger(__name__)
+
+# Runs the cluda kernels natively on the CPU. The rendered kernel code is
+# compiled as C++ with OpenMP and every KERNEL gets an extern "C" launcher
+# that runs the groups of the grid in parallel. Each group has a single
+# worker, so LOCAL_MEM arrays are ordinary local arrays and LOCAL_BARRIER is
+# a no-op. Kernels must be launched with block = (1,1,1). The template
+# arguments (order, kernel, quadrature rule) are compile time constants, just
+# like on the GPU. Compiled modules are stored in the disk cache keyed by the
+# code, the compiler flags and the host CPU, since -march=native builds code
+# that may not run on a different machine sharing the same cache directory.
+
+cluda_preamble = """
+#include <cmath>
+#define CPU
+#define LOCAL_BARRIER
+#define WITHIN_KERNEL static inline
+#define KERNEL static
+#define GLOBAL_MEM /* empty */
+#define LOCAL_MEM /* empty */
+#define LOCAL_MEM_ARG /* empty */
+#define CONSTANT static const
+#define INLINE inline
+#define SIZE_T int
+#define VSIZE_T int
+#define ALIGN(bytes) __attribute__ ((aligned(bytes)))
+
+static thread_local int cpu_group_id;
+static inline int get_local_id(int) { return 0; }
+static inline int get_group_id(int) { return cpu_group_id; }
+static inline int get_local_size(int) { return 1; }
+static inline int get_global_id(int) { return cpu_group_id; }
+
+template <typename T>
+static inline void atomicAdd(T* addr, T val) {
+    #pragma omp atomic
+    *addr += val;
+}
+"""
+
+compiler_args = [
+    '-std=c++14', '-O3', '-march=native', '-fopenmp', '-fPIC', '-shared'
+]
+
+@functools.lru_cache(maxsize = None)
+def host_cpu_id(cxx):
+    """
+    Identifies the instruction set that -march=native selects on this machine:
+    the architecture plus the target options the compiler resolves it to.
+    gcc lists those with -Q --help=target, other compilers show them in the
+    driver's command line with -###.
+    """
+    for args in [['-Q', '--help=target'], ['-###', '-x', 'c++', '-c', os.devnull]]:
+        try:
+            result = subprocess.run(
+                [cxx, '-march=native'] + args,
+                stdout = subprocess.PIPE, stderr = subprocess.STDOUT,
+                universal_newlines = True
+            )
+        except OSError:
+            break
+        if result.returncode == 0:
+            return platform.machine(), result.stdout
+    return platform.machine(), platform.processor()
+
+class CPUArray(np.ndarray):
+    """
+    A numpy array with the get() method of the pycuda and pyopencl arrays so
+    that code written against the GPU backends works unchanged.
+    """
+    def get(self):
+        return np.array(self)
+
+def to_gpu(arr, float_type):
+    if type(arr) is CPUArray:
+        return arr
+    return np.ascontiguousarray(arr, dtype = float_type).view(CPUArray)
+
+def empty_gpu(shape, float_type):
+    return np.empty(shape, float_type).view(CPUArray)
+
+def zeros_gpu(shape, float_type):
+    return np.zeros(shape, float_type).view(CPUArray)
+
+def threaded_get(arr):
+    return arr.get()
+
+async def async_get(arr):
+    return threaded_get(arr)
+
+kernel_re = re.compile(r'KERNEL\s+void\s+(\w+)\s*\(([^)]*)\)')
+
+def parse_kernels(code):
+    """
+    Returns (name, [(param type, param name)]) for every KERNEL in the code.
+    """
+    out = []
+    for name, params in kernel_re.findall(code):
+        parsed = []
+        for p in params.split(','):
+            p = p.strip()
+            match = re.match(r'(.*?)(\w+)$', p, re.DOTALL)
+            parsed.append((match.group(1).strip(), match.group(2)))
+        out.append((name, parsed))
+    return out
+
+def launcher_code(name, params):
+    param_list = ', '.join(t + ' ' + n for t, n in params)
+    arg_list = ', '.join(n for t, n in params)
+    return """
+extern "C" void launch_{name}(int n_groups, {param_list}) {{
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int g = 0; g < n_groups; g++) {{
+        cpu_group_id = g;
+        {name}({arg_list});
+    }}
+}}
+""".format(name = name, param_list = param_list, arg_list = arg_list)
+
+def scalar_ctype(type_str, real_type):
+    type_str = type_str.replace('const', '').strip()
+    if type_str == 'Real':
+        type_str = real_type
+    return dict(int = ctypes.c_int, float = ctypes.c_float, double = ctypes.c_double)[type_str]
+
+class ModuleWrapper:
+    def __init__(self, lib, kernels, real_type):
+        self.lib = lib
+        self.kernels = dict()
+        for name, params in kernels:
+            f = getattr(lib, 'launch_' + name)
+            arg_types = [
+                ctypes.c_void_p if '*' in t else scalar_ctype(t, real_type)
+                for t, n in params
+            ]
+            f.argtypes = [ctypes.c_int] + arg_types
+            f.restype = None
+            self.kernels[name] = (f, arg_types)
+
+    def __getattr__(self, name):
+        if name not in self.kernels:
+            raise AttributeError(name)
+        f, arg_types = self.kernels[name]
+        def wrapper(*args, grid = None, block = None):
+            if block is not None and np.prod(block) != 1:
+                raise ValueError(
+                    'The CPU backend runs one worker per group, use block = (1,1,1).'
+                )
+            n_groups = int(np.prod(grid))
+            c_args = []
+            for a, t in zip(args, arg_types):
+                if t is ctypes.c_void_p:
+                    assert(a.flags['C_CONTIGUOUS'])
+                    c_args.append(ctypes.c_void_p(a.ctypes.data))
+                else:
+                    c_args.append(t(a))
+            # ctypes releases the GIL for the duration of the call.
+            f(n_groups, *c_args)
+        return wrapper
+
+def compile(code):
+    kernels = parse_kernels(code)
+    real_match = re.search(r'#define\s+Real\s+(\w+)', code)
+    real_type = real_match.group(1) if real_match else 'double'
+    full_code = code + ''.join(launcher_code(n, p) for n, p in kernels)
+
+    cxx = os.environ.get('CXX', 'g++')
+    key = disk_cache.hash_key(full_code, cxx, compiler_args, host_cpu_id(cxx))
+    path = disk_cache.entry_path('cpu_kernels', key) + '.so'
+    if not os.path.exists(path):
+        parent = os.path.dirname(path)
+        os.makedirs(parent, exist_ok = True)
+        t = Timer(output_fnc = logger.debug)
+        with tempfile.TemporaryDirectory(dir = parent) as tmp_dir:
+            src_path = os.path.join(tmp_dir, 'module.cpp')
+            lib_path = os.path.join(tmp_dir, 'module.so')
+            with open(src_path, 'w') as f:
+                f.write(full_code)
+            subprocess.check_call(
+                [cxx] + compiler_args + [src_path, '-o', lib_path]
+            )
+            os.rename(lib_path, path)
+        t.report('compile cpu module')
+    return ModuleWrapper(ctypes.CDLL(path), kernels, real_type)
+
+cpu_module = dict()
+
+def load_cpu(tmpl_name, tmpl_dir = None, tmpl_args = None):
+    """
+    The CPU counterpart of gpu.load_gpu. The template is rendered with
+    cuda_backend and ocl_backend both False.
+    """
+    from tectosaur.util.gpu import get_template, compare
+    if tmpl_args is None:
+        tmpl_args = dict()
+
+    for module_info in cpu_module.get(tmpl_name, []):
+        if all(compare(v, tmpl_args[k]) for k, v in module_info['tmpl_args'].items()):
+            return module_info['module']
+
+    tmpl = get_template(tmpl_name, tmpl_dir)
+    try:
+        code = tmpl.render(
+            **tmpl_args, cluda_preamble = cluda_preamble,
+            cuda_backend = False, ocl_backend = False
+        )
+    except:
+        import mako.exceptions
+        logger.error(mako.exceptions.text_error_template().render())
+        raise
+
+    module = compile(code)
+    cpu_module[tmpl_name] = cpu_module.get(tmpl_name, []) + [
+        dict(tmpl_args = tmpl_args, module = module)
+    ]
+    return module
@@ -27,7 +27,7 @@ def to_gpu(arr, float_type):
     ensure_initialized()
     if type(arr) is pycuda.gpuarray.GPUArray:
         return arr
-    to_type = arr.astype(float_type)
+    to_type = arr.astype(float_type, copy = False)
     return pycuda.gpuarray.to_gpu(to_type)
 
 def empty_gpu(shape, float_type):
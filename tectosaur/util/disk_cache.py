@@ -0,0 +1,66 @@
+import os
+import shutil
+import hashlib
+import tempfile
+import numpy as np
+
+import logging
+logger = logging.getLogger(__name__)
+
+# Entries are stored as a directory of .npy files so that they can be loaded
+# with np.load(mmap_mode = 'r') instead of being read into memory up front.
+def cache_dir():
+    return os.environ.get(
+        'TECTOSAUR_CACHE_DIR',
+        os.path.join(os.path.expanduser('~'), '.cache', 'tectosaur')
+    )
+
+def hash_key(*args):
+    h = hashlib.sha1()
+    for a in args:
+        if isinstance(a, np.ndarray):
+            a = np.ascontiguousarray(a)
+            h.update(str((a.dtype.str, a.shape)).encode())
+            h.update(a.data)
+        elif isinstance(a, (tuple, list)):
+            h.update(b'(')
+            h.update(hash_key(*a).encode())
+            h.update(b')')
+        else:
+            h.update(repr(a).encode())
+        h.update(b',')
+    return h.hexdigest()
+
+def entry_path(namespace, key):
+    return os.path.join(cache_dir(), namespace, key)
+
+def save_arrays(namespace, key, arrays):
+    path = entry_path(namespace, key)
+    if os.path.exists(path):
+        return
+    parent = os.path.dirname(path)
+    os.makedirs(parent, exist_ok = True)
+    # Write to a temporary directory first and rename it so that a crashed or
+    # concurrent writer can't leave a partial entry behind.
+    tmp_path = tempfile.mkdtemp(dir = parent)
+    try:
+        for name, arr in arrays.items():
+            np.save(os.path.join(tmp_path, name + '.npy'), arr)
+        os.rename(tmp_path, path)
+    except OSError:
+        shutil.rmtree(tmp_path, ignore_errors = True)
+        if not os.path.exists(path):
+            raise
+
+def load_arrays(namespace, key):
+    path = entry_path(namespace, key)
+    if not os.path.exists(path):
+        return None
+    out = dict()
+    for f in os.listdir(path):
+        name, ext = os.path.splitext(f)
+        if ext != '.npy':
+            continue
+        out[name] = np.load(os.path.join(path, f), mmap_mode = 'r')
+    logger.debug('loaded cache entry ' + path)
+    return out
@@ -81,6 +81,9 @@ void bsrmv${blocksize}(NPArray<long> indptr, NPArray<long> indices,
     auto* x_ptr = as_ptr<F>(x);
     auto* y_ptr = as_ptr<F>(y);
 
+    // Let other Python threads (the farfield) run during the product.
+    py::gil_scoped_release release;
+
 #pragma omp parallel for
     for (size_t block_row_idx = 0; block_row_idx < mb; block_row_idx++) {
         auto* y_start = y_ptr + ${blocksize} * block_row_idx;
@@ -138,6 +141,9 @@ void bcoomv${blocksize}(NPArray<long> rows, NPArray<long> cols,
     auto* x_ptr = as_ptr<F>(x);
     auto* y_ptr = as_ptr<F>(y);
 
+    // Let other Python threads (the farfield) run during the product.
+    py::gil_scoped_release release;
+
 #pragma omp parallel for
     for (size_t block_idx = 0; block_idx < n_blocks; block_idx++) {
         auto* x_start = x_ptr + ${blocksize} * cols_ptr[block_idx];
@@ -162,9 +168,58 @@ void bcoomv${blocksize}(NPArray<long> rows, NPArray<long> cols,
 }
 </%def>
 
+// x and y are row major (n, k) blocks of k right hand sides. Each matrix
+// block is loaded once for all of them.
+<%def name="bcoomm(blocksize)">
+template <typename F>
+void bcoomm${blocksize}(NPArray<long> rows, NPArray<long> cols,
+        NPArray<F> data, NPArray<F> x, NPArray<F> y) 
+{
+    size_t n_blocks = rows.request().shape[0];
+    size_t n_rhs = x.request().shape[1];
+
+    auto* rows_ptr = as_ptr<long>(rows);
+    auto* cols_ptr = as_ptr<long>(cols);
+    auto* A_ptr = as_ptr<F>(data);
+    auto* x_ptr = as_ptr<F>(x);
+    auto* y_ptr = as_ptr<F>(y);
+
+    py::gil_scoped_release release;
+
+#pragma omp parallel for
+    for (size_t block_idx = 0; block_idx < n_blocks; block_idx++) {
+        auto* x_start = x_ptr + ${blocksize} * n_rhs * cols_ptr[block_idx];
+        auto* y_start = y_ptr + ${blocksize} * n_rhs * rows_ptr[block_idx];
+        auto* A_start = A_ptr + ${blocksize ** 2} * block_idx;
+
+        % for un_i in range(blocksize):
+            % for un_j in range(blocksize):
+            auto A${un_i}_${un_j} = A_start[${un_i * blocksize + un_j}];
+            % endfor
+        % endfor
+
+        for (size_t r = 0; r < n_rhs; r++) {
+            % for un_j in range(blocksize):
+                auto x${un_j} = x_start[${un_j} * n_rhs + r];
+            % endfor
+
+            % for un_i in range(blocksize):
+#pragma omp atomic
+                y_start[${un_i} * n_rhs + r] += 
+                % for un_j in range(blocksize):
+                    + A${un_i}_${un_j} * x${un_j}
+                % endfor
+                ;
+            % endfor
+        }
+    }
+}
+</%def>
+
 % for blocksize in range(1, 10):
     ${bsrmv(blocksize)}
     ${bcoomv(blocksize)}
+    ${bcoomm(blocksize)}
 % endfor 
 
 PYBIND11_MODULE(fast_sparse,m) {
@@ -174,6 +229,8 @@ PYBIND11_MODULE(fast_sparse,m) {
         m.def("dbsrmv${blocksize}", &bsrmv${blocksize}<double>);
         m.def("sbcoomv${blocksize}", &bcoomv${blocksize}<float>);
         m.def("dbcoomv${blocksize}", &bcoomv${blocksize}<double>);
+        m.def("sbcoomm${blocksize}", &bcoomm${blocksize}<float>);
+        m.def("dbcoomm${blocksize}", &bcoomm${blocksize}<double>);
     % endfor
 }
 
@@ -40,7 +40,7 @@ def to_gpu(arr, float_type):
     ensure_initialized()
     if type(arr) is pyopencl.array.Array:
         return arr
-    to_type = arr.astype(float_type)
+    to_type = arr.astype(float_type, copy = False)
     return pyopencl.array.to_device(gpu_queue, to_type)
 
 def zeros_gpu(shape, float_type):
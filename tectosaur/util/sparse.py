@@ -26,10 +26,20 @@ class BCOOMatrix:
     def blocksize(self):
         return self.data.shape[1]
 
-    def dot(self, v):
-        out = np.zeros(self.shape[0], dtype = self.dtype)
-        fnc = get_mv_fnc('bcoomv', self.dtype, self.blocksize)
-        fnc(self.rows, self.cols, self.data, v.astype(self.dtype), out)
+    def dot(self, v, out = None):
+        """
+        v is either a vector or a (shape[1], k) block of k right hand sides.
+        If out is provided, the product is added to it instead of to a new
+        zeroed array.
+        """
+        if out is None:
+            out = np.zeros((self.shape[0],) + v.shape[1:], dtype = self.dtype)
+        elif out.dtype != self.dtype:
+            out += self.dot(v)
+            return out
+        fnc = get_mv_fnc('bcoomv' if v.ndim == 1 else 'bcoomm', self.dtype, self.blocksize)
+        v = np.ascontiguousarray(v, dtype = self.dtype)
+        fnc(self.rows, self.cols, self.data, v, out)
         return out
 
     def to_bsr(self):
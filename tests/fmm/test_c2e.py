@@ -0,0 +1,39 @@
+import pytest
+import numpy as np
+
+from tectosaur.fmm.c2e import truncated_svd, reg_lstsq_inverse
+
+def test_truncated_svd():
+    np.random.seed(13)
+    n = 300
+    Q1, _ = np.linalg.qr(np.random.rand(n, n))
+    Q2, _ = np.linalg.qr(np.random.rand(n, n))
+    eig = 10.0 ** -np.linspace(0, 40, n)
+    M = (Q1 * eig).dot(Q2.T)
+
+    U, E, VT = truncated_svd(M, 1e-13)
+    assert(E.shape[0] < n // 2)
+    np.testing.assert_allclose(E, eig[:E.shape[0]], rtol = 1e-6, atol = 1e-15)
+
+    alpha = 1e-5
+    inv_E = E / (E ** 2 + alpha ** 2)
+    correct = reg_lstsq_inverse(M, alpha)
+    np.testing.assert_allclose(
+        (VT.T * inv_E).dot(U.T), correct, atol = 1e-6 * np.max(np.abs(correct))
+    )
+
+@pytest.mark.parametrize('decades', [40, 20])
+def test_truncated_svd_matches_full_svd(decades):
+    np.random.seed(14)
+    n = 300
+    rtol = 1e-13
+    Q1, _ = np.linalg.qr(np.random.rand(n, n))
+    Q2, _ = np.linalg.qr(np.random.rand(n, n))
+    M = (Q1 * 10.0 ** -np.linspace(0, decades, n)).dot(Q2.T)
+
+    _, E_full, _ = np.linalg.svd(M)
+    n_keep = np.sum(E_full >= rtol * E_full[0])
+    U, E, VT = truncated_svd(M, rtol)
+    assert(E.shape[0] == n_keep)
+    np.testing.assert_allclose(E, E_full[:n_keep], rtol = 0, atol = 1e-14 * E_full[0])
+    assert(np.linalg.norm((U * E).dot(VT) - M, 2) < 10 * rtol * E_full[0])
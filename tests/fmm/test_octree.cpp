@@ -1,8 +1,13 @@
 #include "include/doctest.h"
 #include "include/test_helpers.hpp"
 #include "octree.hpp"
+#include "kdtree.hpp"
+#include "traversal.hpp"
+#include "mesh/leaf_filter.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <omp.h>
 
 TEST_CASE("containing subcell ball 2d") {
     Ball<2> b{{0, 0}, 1.0};
@@ -104,5 +109,517 @@ TEST_CASE("many level octree")
         centers.size(), 999
     ); 
     REQUIRE(oct.orig_idxs.size() == 1000);
-    REQUIRE(oct.nodes[oct.root().children[0]].depth == 1);
+    REQUIRE(oct.node(oct.root().child(0)).depth == 1);
+}
+
+template <size_t dim>
+void check_parallel_octree_matches_serial(std::vector<std::array<double,dim>> centers,
+    size_t n_per_cell)
+{
+    auto Rs = random_pts<1>(centers.size(), 0.0, 0.01);
+    auto* R_ptr = reinterpret_cast<double*>(Rs.data());
+    auto serial = build_octree(centers.data(), R_ptr, centers.size(), n_per_cell);
+    auto parallel = build_octree_parallel(centers.data(), R_ptr, centers.size(), n_per_cell);
+
+    REQUIRE(parallel.max_height == serial.max_height);
+    REQUIRE(parallel.orig_idxs == serial.orig_idxs);
+    REQUIRE(parallel.nodes.size() == serial.nodes.size());
+    for (size_t i = 0; i < serial.nodes.size(); i++) {
+        auto s = serial.node(i);
+        auto p = parallel.node(i);
+        REQUIRE(p.start == s.start);
+        REQUIRE(p.end == s.end);
+        REQUIRE(p.is_leaf == s.is_leaf);
+        REQUIRE(p.height == s.height);
+        REQUIRE(p.depth == s.depth);
+        REQUIRE(p.idx == s.idx);
+        REQUIRE(p.first_child == s.first_child);
+        REQUIRE(p.n_children == s.n_children);
+        REQUIRE(p.bounds.center == s.bounds.center);
+        REQUIRE(p.bounds.R == s.bounds.R);
+    }
+}
+
+TEST_CASE("parallel octree matches serial octree") 
+{
+    check_parallel_octree_matches_serial(random_pts<3>(20000), 10);
+    check_parallel_octree_matches_serial(random_pts<2>(20000), 10);
+
+    // A dense cluster inside a sparse background gives an unbalanced tree.
+    auto centers = random_pts<3>(20000, 0.0, 0.001);
+    auto background = random_pts<3>(5000);
+    centers.insert(centers.end(), background.begin(), background.end());
+    check_parallel_octree_matches_serial(centers, 20);
+}
+
+TEST_CASE("morton octree") 
+{
+    size_t n = 5000;
+    auto centers = random_pts<3>(n);
+    auto Rs = random_pts<1>(n, 0.0, 0.01);
+    auto oct = build_octree_morton(
+        centers.data(), reinterpret_cast<double*>(Rs.data()), n, 20
+    );
+
+    std::vector<size_t> sorted_orig_idxs = oct.orig_idxs;
+    std::sort(sorted_orig_idxs.begin(), sorted_orig_idxs.end());
+    for (size_t i = 0; i < n; i++) {
+        REQUIRE(sorted_orig_idxs[i] == i);
+        REQUIRE(oct.balls[i].center == centers[oct.orig_idxs[i]]);
+    }
+
+    for (size_t i = 0; i < oct.nodes.size(); i++) {
+        auto node = oct.node(i);
+        REQUIRE(node.idx == i);
+        for (size_t j = node.start; j < node.end; j++) {
+            REQUIRE(ball_in_ball(node.bounds, oct.balls[j]));
+        }
+        if (node.is_leaf) {
+            REQUIRE(node.end - node.start <= 20);
+            continue;
+        }
+        size_t next_start = node.start;
+        for (size_t c = 0; c < node.n_children; c++) {
+            auto child = oct.node(node.child(c));
+            REQUIRE(child.start == next_start);
+            REQUIRE(child.depth == node.depth + 1);
+            next_start = child.end;
+        }
+        REQUIRE(next_start == node.end);
+    }
+}
+
+template <typename TreeT>
+void check_node_arrays(const TreeT& tree) {
+    auto& arrs = tree.nodes;
+    REQUIRE(arrs.centers.size() == arrs.size());
+    REQUIRE(arrs.heights.size() == arrs.size());
+    REQUIRE(arrs.heights[0] == tree.max_height);
+    for (size_t i = 0; i < arrs.size(); i++) {
+        auto n = tree.node(i);
+        for (size_t j = n.start; j < n.end; j++) {
+            REQUIRE(ball_in_ball(n.bounds, tree.balls[j]));
+        }
+        if (n.is_leaf) {
+            REQUIRE(n.height == 0);
+            continue;
+        }
+        REQUIRE(n.first_child > i);
+        auto next_start = n.start;
+        int height = 0;
+        for (size_t c = 0; c < n.n_children; c++) {
+            auto child = tree.node(n.child(c));
+            REQUIRE(child.start == next_start);
+            REQUIRE(child.depth == n.depth + 1);
+            next_start = child.end;
+            height = std::max(height, child.height + 1);
+        }
+        REQUIRE(next_start == n.end);
+        REQUIRE(n.height == height);
+    }
+}
+
+TEST_CASE("node arrays with contiguous children")
+{
+    auto centers = random_pts<3>(3000);
+    auto Rs = random_pts<1>(3000, 0.0, 0.01);
+    auto* R_ptr = reinterpret_cast<double*>(Rs.data());
+    check_node_arrays(build_octree(centers.data(), R_ptr, centers.size(), 10));
+    check_node_arrays(build_octree_parallel(centers.data(), R_ptr, centers.size(), 10));
+    check_node_arrays(build_octree_morton(centers.data(), R_ptr, centers.size(), 10));
+    check_node_arrays(build_octree_compact(centers.data(), R_ptr, centers.size(), 10));
+    check_node_arrays(build_kdtree(centers.data(), R_ptr, centers.size(), 10));
+}
+
+TEST_CASE("compact octree")
+{
+    // Points on a plane leave half of the octants of every node empty.
+    auto centers = random_pts<3>(5000);
+    for (auto& c: centers) {
+        c[2] = 0.5;
+    }
+    std::vector<double> Rs(centers.size(), 0.001);
+    auto full = build_octree_parallel(centers.data(), Rs.data(), centers.size(), 10);
+    auto compact = build_octree_compact(centers.data(), Rs.data(), centers.size(), 10);
+    REQUIRE(compact.nodes.size() < full.nodes.size());
+    REQUIRE(compact.orig_idxs == full.orig_idxs);
+    size_t split = Octree<3>::split;
+    for (size_t i = 0; i < compact.nodes.size(); i++) {
+        auto n = compact.node(i);
+        REQUIRE(n.end > n.start);
+        if (n.is_leaf) {
+            REQUIRE(n.n_children == 0);
+            continue;
+        }
+        REQUIRE(n.n_children >= 1);
+        REQUIRE(n.n_children <= split);
+        auto next_start = n.start;
+        for (size_t c = 0; c < n.n_children; c++) {
+            auto child = compact.node(n.child(c));
+            REQUIRE(child.start == next_start);
+            next_start = child.end;
+        }
+        REQUIRE(next_start == n.end);
+    }
+
+    // Every obs/src pair must be covered exactly once by the treecode
+    // interactions.
+    auto n_pairs = centers.size() * centers.size();
+    for (auto* tree: {&full, &compact}) {
+        auto interactions = fmmmm_interactions(*tree, *tree, 1.0, 3.0, 2, true);
+        auto n_p2p = count_interactions(interactions.p2p, *tree, *tree, false, false, 0);
+        auto n_m2p = count_interactions(interactions.m2p, *tree, *tree, false, false, 0);
+        REQUIRE(n_p2p + n_m2p == n_pairs);
+    }
+}
+
+template <typename TreeT>
+void check_refit(TreeT tree, std::vector<std::array<double,TreeT::dim>> centers,
+    std::vector<double> Rs) 
+{
+    auto interactions = fmmmm_interactions(tree, tree, 1.0, 3.0, 2, true);
+    REQUIRE(interactions_valid(interactions, tree, tree, 1.0, 3.0));
+
+    auto n_nodes = tree.nodes.size();
+    auto orig_idxs = tree.orig_idxs;
+    auto moved = random_pts<TreeT::dim>(centers.size(), -1e-5, 1e-5);
+    for (size_t i = 0; i < centers.size(); i++) {
+        for (size_t d = 0; d < TreeT::dim; d++) {
+            moved[i][d] += centers[i][d];
+        }
+    }
+    refit(tree, moved.data(), Rs.data());
+    REQUIRE(tree.nodes.size() == n_nodes);
+    REQUIRE(tree.orig_idxs == orig_idxs);
+    for (size_t j = 0; j < tree.nodes.size(); j++) {
+        auto n = tree.node(j);
+        for (size_t i = n.start; i < n.end; i++) {
+            REQUIRE(tree.balls[i].center == moved[tree.orig_idxs[i]]);
+            REQUIRE(ball_in_ball(n.bounds, tree.balls[i]));
+        }
+    }
+    REQUIRE(interactions_valid(interactions, tree, tree, 1.0, 3.0));
+
+    // Reversing the balls scrambles the geometry relative to the topology.
+    std::reverse(moved.begin(), moved.end());
+    refit(tree, moved.data(), Rs.data());
+    for (size_t j = 0; j < tree.nodes.size(); j++) {
+        auto n = tree.node(j);
+        for (size_t i = n.start; i < n.end; i++) {
+            REQUIRE(ball_in_ball(n.bounds, tree.balls[i]));
+        }
+    }
+    REQUIRE(!interactions_valid(interactions, tree, tree, 1.0, 3.0));
+}
+
+TEST_CASE("refit")
+{
+    auto centers = random_pts<3>(3000);
+    std::vector<double> Rs(centers.size(), 0.001);
+    check_refit(build_octree(centers.data(), Rs.data(), centers.size(), 10), centers, Rs);
+    check_refit(build_octree_compact(centers.data(), Rs.data(), centers.size(), 10), centers, Rs);
+    check_refit(build_kdtree(centers.data(), Rs.data(), centers.size(), 10), centers, Rs);
+}
+
+TEST_CASE("kdtree split policies")
+{
+    // An elongated cloud, like a long, narrow fault.
+    auto centers = random_pts<3>(4000);
+    for (auto& c: centers) {
+        c[0] *= 100.0;
+    }
+    std::vector<double> Rs(centers.size(), 0.001);
+    size_t n_per_cell = 10;
+    for (auto split: {KDSplit::center_of_mass, KDSplit::median,
+            KDSplit::widest, KDSplit::cost}) 
+    {
+        auto tree = build_kdtree_split(
+            centers.data(), Rs.data(), centers.size(), n_per_cell, split
+        );
+        check_node_arrays(tree);
+        auto sorted_idxs = tree.orig_idxs;
+        std::sort(sorted_idxs.begin(), sorted_idxs.end());
+        for (size_t i = 0; i < sorted_idxs.size(); i++) {
+            REQUIRE(sorted_idxs[i] == i);
+        }
+        for (size_t j = 0; j < tree.nodes.size(); j++) {
+            auto n = tree.node(j);
+            if (n.is_leaf) {
+                REQUIRE(n.end - n.start <= n_per_cell);
+                continue;
+            }
+            REQUIRE(n.n_children == 2);
+            if (split == KDSplit::median || split == KDSplit::widest) {
+                auto n_left = tree.node(n.child(0)).end - n.start;
+                REQUIRE(n_left == (n.end - n.start) / 2);
+            }
+        }
+        if (split == KDSplit::median || split == KDSplit::widest) {
+            // 4000 / 2^9 < 10
+            REQUIRE(tree.max_height == 9);
+        }
+    }
+}
+
+template <typename TreeT>
+void check_tree_from_arrays(const TreeT& tree) {
+    auto copy = tree_from_arrays<TreeT>(tree.balls, tree.orig_idxs, tree.nodes);
+    REQUIRE(copy.max_height == tree.max_height);
+    REQUIRE(copy.orig_idxs == tree.orig_idxs);
+    REQUIRE(copy.nodes.size() == tree.nodes.size());
+    for (size_t i = 0; i < tree.nodes.size(); i++) {
+        auto a = tree.node(i);
+        auto b = copy.node(i);
+        REQUIRE(a.start == b.start);
+        REQUIRE(a.end == b.end);
+        REQUIRE(a.bounds.center == b.bounds.center);
+        REQUIRE(a.bounds.R == b.bounds.R);
+        REQUIRE(a.is_leaf == b.is_leaf);
+        REQUIRE(a.height == b.height);
+        REQUIRE(a.depth == b.depth);
+        REQUIRE(a.idx == b.idx);
+        REQUIRE(a.first_child == b.first_child);
+        REQUIRE(a.n_children == b.n_children);
+    }
+}
+
+TEST_CASE("tree from arrays")
+{
+    auto centers = random_pts<3>(3000);
+    std::vector<double> Rs(centers.size(), 0.001);
+    check_tree_from_arrays(build_octree(centers.data(), Rs.data(), centers.size(), 10));
+    check_tree_from_arrays(build_octree_compact(centers.data(), Rs.data(), centers.size(), 10));
+    check_tree_from_arrays(build_kdtree(centers.data(), Rs.data(), centers.size(), 10));
+}
+
+template <typename IA, typename IB>
+void check_lists_equal(const CompressedInteractionListT<IA>& a,
+    const CompressedInteractionListT<IB>& b) 
+{
+    REQUIRE(std::vector<size_t>(a.obs_n_idxs.begin(), a.obs_n_idxs.end()) ==
+        std::vector<size_t>(b.obs_n_idxs.begin(), b.obs_n_idxs.end()));
+    REQUIRE(std::vector<size_t>(a.obs_src_starts.begin(), a.obs_src_starts.end()) ==
+        std::vector<size_t>(b.obs_src_starts.begin(), b.obs_src_starts.end()));
+    REQUIRE(std::vector<size_t>(a.src_n_idxs.begin(), a.src_n_idxs.end()) ==
+        std::vector<size_t>(b.src_n_idxs.begin(), b.src_n_idxs.end()));
+}
+
+template <typename IA, typename IB>
+void check_interactions_equal(const InteractionsT<IA>& a, const InteractionsT<IB>& b) {
+    check_lists_equal(a.p2p, b.p2p);
+    check_lists_equal(a.m2p, b.m2p);
+    check_lists_equal(a.p2l, b.p2l);
+    check_lists_equal(a.m2l, b.m2l);
+    check_lists_equal(a.p2m, b.p2m);
+    check_lists_equal(a.l2p, b.l2p);
+    REQUIRE(a.m2m.size() == b.m2m.size());
+    for (size_t i = 0; i < a.m2m.size(); i++) {
+        check_lists_equal(a.m2m[i], b.m2m[i]);
+        check_lists_equal(a.u2e[i], b.u2e[i]);
+    }
+    REQUIRE(a.l2l.size() == b.l2l.size());
+    for (size_t i = 0; i < a.l2l.size(); i++) {
+        check_lists_equal(a.l2l[i], b.l2l[i]);
+        check_lists_equal(a.d2e[i], b.d2e[i]);
+    }
+}
+
+TEST_CASE("parallel traversal matches serial traversal")
+{
+    auto centers = random_pts<3>(30000);
+    std::vector<double> Rs(centers.size(), 0.001);
+    auto tree = build_octree_compact(centers.data(), Rs.data(), centers.size(), 20);
+
+    auto n_threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    auto serial = fmmmm_interactions(tree, tree, 1.0, 3.0, 20, false);
+    omp_set_num_threads(std::max(n_threads, 4));
+    auto parallel = fmmmm_interactions(tree, tree, 1.0, 3.0, 20, false);
+    omp_set_num_threads(n_threads);
+
+    check_interactions_equal(serial, parallel);
+}
+
+TEST_CASE("32 bit interaction lists")
+{
+    auto centers = random_pts<3>(5000);
+    std::vector<double> Rs(centers.size(), 0.001);
+    auto tree = build_octree_compact(centers.data(), Rs.data(), centers.size(), 20);
+    auto lists64 = fmmmm_interactions(tree, tree, 1.0, 3.0, 20, false);
+    auto lists32 = fmmmm_interactions<Octree<3>,int32_t>(tree, tree, 1.0, 3.0, 20, false);
+    check_interactions_equal(lists64, lists32);
+}
+
+// The number of obs/src ball pairs covered by symmetric interactions. Blocks
+// between distinct nodes in the p2p list stand for both directions.
+template <typename TreeT>
+size_t symmetric_coverage(const TreeT& tree, const Interactions& sym) {
+    size_t n_p2p = 0;
+    auto& p2p = sym.p2p;
+    for (size_t i = 0; i < p2p.obs_n_idxs.size(); i++) {
+        auto obs_n = tree.node(p2p.obs_n_idxs[i]);
+        for (size_t j = p2p.obs_src_starts[i]; j < p2p.obs_src_starts[i + 1]; j++) {
+            auto src_n = tree.node(p2p.src_n_idxs[j]);
+            size_t n = (obs_n.end - obs_n.start) * (src_n.end - src_n.start);
+            n_p2p += (obs_n.idx == src_n.idx) ? n : 2 * n;
+        }
+    }
+    return n_p2p
+        + count_interactions(sym.m2p, tree, tree, false, false, 0)
+        + count_interactions(sym.p2l, tree, tree, false, false, 0)
+        + count_interactions(sym.m2l, tree, tree, false, false, 0);
+}
+
+TEST_CASE("symmetric traversal")
+{
+    auto centers = random_pts<3>(5000);
+    std::vector<double> Rs(centers.size(), 0.001);
+    auto tree = build_octree_compact(centers.data(), Rs.data(), centers.size(), 20);
+    auto full = fmmmm_interactions(tree, tree, 1.0, 3.0, 2, true);
+    auto sym = fmmmm_interactions_symmetric(tree, 1.0, 3.0, 2, true);
+    REQUIRE(interactions_valid(sym, tree, tree, 1.0, 3.0));
+    REQUIRE(sym.p2p.src_n_idxs.size() < full.p2p.src_n_idxs.size());
+    REQUIRE(symmetric_coverage(tree, sym) == centers.size() * centers.size());
+}
+
+TEST_CASE("symmetric traversal at high order")
+{
+    // With order above the leaf size, many accepted pairs are both too small
+    // for the expansions and fall back to p2p.
+    auto centers = random_pts<3>(5000);
+    std::vector<double> Rs(centers.size(), 0.001);
+    auto tree = build_octree_compact(centers.data(), Rs.data(), centers.size(), 10);
+    auto n_pairs = centers.size() * centers.size();
+    for (bool treecode: {true, false}) {
+        auto full = fmmmm_interactions(tree, tree, 1.0, 3.0, 20, treecode);
+        auto sym = fmmmm_interactions_symmetric(tree, 1.0, 3.0, 20, treecode);
+        size_t n_full = 0;
+        for (auto* l: {&full.p2p, &full.m2p, &full.p2l, &full.m2l}) {
+            n_full += count_interactions(*l, tree, tree, false, false, 0);
+        }
+        REQUIRE(n_full == n_pairs);
+        REQUIRE(symmetric_coverage(tree, sym) == n_pairs);
+    }
+}
+
+template <typename TreeT, typename MAC>
+size_t check_mac(const TreeT& tree, const MAC& mac) {
+    auto interactions = fmmmm_interactions(tree, tree, mac, 2, true);
+    REQUIRE(interactions_valid(interactions, tree, tree, mac));
+    auto n_p2p = count_interactions(interactions.p2p, tree, tree, false, false, 0);
+    auto n_m2p = count_interactions(interactions.m2p, tree, tree, false, false, 0);
+    REQUIRE(n_p2p + n_m2p == tree.balls.size() * tree.balls.size());
+    return n_p2p;
+}
+
+TEST_CASE("acceptance criteria")
+{
+    auto centers = random_pts<3>(5000);
+    for (auto& c: centers) {
+        c[2] *= 0.01;
+    }
+    std::vector<double> Rs(centers.size(), 0.001);
+    auto tree = build_octree_compact(centers.data(), Rs.data(), centers.size(), 20);
+    using TreeT = decltype(tree);
+
+    auto n_ball = check_mac(tree, BallMAC<TreeT>(1.0, 3.0));
+    auto ball = fmmmm_interactions(tree, tree, 1.0, 3.0, 2, true);
+    REQUIRE(count_interactions(ball.p2p, tree, tree, false, false, 0) == n_ball);
+
+    check_mac(tree, BoxMAC<TreeT>(tree, tree, 1.0, 3.0));
+    auto n_theta_loose = check_mac(tree, ThetaMAC<TreeT>(0.7));
+    auto n_theta_tight = check_mac(tree, ThetaMAC<TreeT>(0.3));
+    REQUIRE(n_theta_loose < n_theta_tight);
+    auto n_error_loose = check_mac(tree, ErrorMAC<TreeT>(tree, tree, 2, 1e-2));
+    auto n_error_tight = check_mac(tree, ErrorMAC<TreeT>(tree, tree, 2, 1e-5));
+    REQUIRE(n_error_loose < n_error_tight);
+}
+
+TEST_CASE("leaf filter matches brute force")
+{
+    auto centers = random_pts<3>(3000);
+    auto Rs = random_pts<1>(centers.size(), 0.0, 0.02);
+    auto* R_ptr = reinterpret_cast<double*>(Rs.data());
+    auto tree = build_octree_compact(centers.data(), R_ptr, centers.size(), 30);
+    auto balls = balls_soa(tree);
+
+    double threshold = 1.5;
+    auto src_n = tree.node(tree.nodes.size() / 2);
+    for (size_t k = 0; k < tree.nodes.size(); k++) {
+        auto obs_n = tree.node(k);
+        if (!obs_n.is_leaf) {
+            continue;
+        }
+        std::vector<long> correct;
+        for (size_t i = obs_n.start; i < obs_n.end; i++) {
+            for (size_t j = src_n.start; j < src_n.end; j++) {
+                auto& bi = tree.balls[i];
+                auto& bj = tree.balls[j];
+                auto limit = std::pow((bi.R + bj.R) * threshold, 2);
+                if (dist2(bi.center, bj.center) > limit) {
+                    continue;
+                }
+                correct.push_back(tree.orig_idxs[i]);
+                correct.push_back(tree.orig_idxs[j]);
+            }
+        }
+        for (auto isa: {LeafFilterISA::scalar, LeafFilterISA::avx2, LeafFilterISA::avx512}) {
+            if (!leaf_filter_isa_supported(isa)) {
+                continue;
+            }
+            std::vector<long> out;
+            filter_leaf_pairs(
+                out, balls, obs_n.start, obs_n.end,
+                balls, src_n.start, src_n.end, threshold, false, isa
+            );
+            REQUIRE(out == correct);
+        }
+    }
+}
+
+TEST_CASE("leaf filter paths agree on the boundary")
+{
+    // Each src radius is chosen so that the pair sits within a few ulps of
+    // (R_i + R_j) * threshold, where fusing the multiply-adds in the distance
+    // would change which pairs are accepted.
+    size_t n = 4096;
+    auto obs_c = random_pts<3>(1, -1, 1)[0];
+    auto src_c = random_pts<3>(n, -1, 1);
+    double threshold = 1.5;
+    double obs_R = 0.01;
+
+    BallsSoA<3> obs;
+    BallsSoA<3> src;
+    for (size_t d = 0; d < 3; d++) {
+        obs.centers[d] = {obs_c[d]};
+        src.centers[d].resize(n);
+    }
+    obs.R = {obs_R};
+    src.R.resize(n);
+    for (size_t j = 0; j < n; j++) {
+        for (size_t d = 0; d < 3; d++) {
+            src.centers[d][j] = src_c[j][d];
+        }
+        double R = std::sqrt(dist2(obs_c, src_c[j])) / threshold - obs_R;
+        for (int k = 0; k < static_cast<int>(j % 9) - 4; k++) {
+            R = std::nextafter(R, 10.0);
+        }
+        for (int k = 0; k > static_cast<int>(j % 9) - 4; k--) {
+            R = std::nextafter(R, -10.0);
+        }
+        src.R[j] = R;
+    }
+
+    std::vector<long> hits(n);
+    auto n_scalar = filter_row(obs, 0, src, 0, n, threshold, hits.data(), LeafFilterISA::scalar);
+    std::vector<long> scalar(hits.begin(), hits.begin() + n_scalar);
+    REQUIRE(n_scalar > 0);
+    REQUIRE(n_scalar < n);
+    for (auto isa: {LeafFilterISA::avx2, LeafFilterISA::avx512}) {
+        if (!leaf_filter_isa_supported(isa)) {
+            continue;
+        }
+        auto n_hits = filter_row(obs, 0, src, 0, n, threshold, hits.data(), isa);
+        REQUIRE(std::vector<long>(hits.begin(), hits.begin() + n_hits) == scalar);
+    }
 }
@@ -1,4 +1,5 @@
 import time
+import pytest
 from math import factorial
 import scipy.special
 import scipy.spatial
@@ -9,7 +10,8 @@ from tectosaur.mesh.modify import concat
 from tectosaur.fmm.tsfmm import *
 import tectosaur.util.gpu as gpu
 
-def fmm_tester(K_name, far_only = False, one_cell = False):
+def fmm_tester(K_name, far_only = False, one_cell = False, treecode = True,
+        backend = 'gpu'):
     np.random.seed(123987)
     for order in [8]:#range(2, 13):
         float_type = np.float64
@@ -46,7 +48,7 @@ def fmm_tester(K_name, far_only = False, one_cell = False):
             quad_order = quad_order, float_type = float_type,
             K_name = K_name,
             mac = 2.5, max_pts_per_cell = max_pts_per_cell,
-            n_workers_per_block = 128
+            n_workers_per_block = 128, treecode = treecode, backend = backend
         )
         if far_only:
             assert(fmm.interactions.p2p.src_n_idxs.shape[0] == 0)
@@ -57,17 +59,167 @@ def fmm_tester(K_name, far_only = False, one_cell = False):
     print(y1, y2)
     np.testing.assert_almost_equal(y1, y2, 5)
 
-def test_fmmU():
-    fmm_tester('elasticU3')
+@pytest.mark.parametrize('treecode', [True, False])
+def test_fmmU(treecode):
+    fmm_tester('elasticU3', treecode = treecode)
 
-def test_fmmT():
-    fmm_tester('elasticRT3')
+@pytest.mark.parametrize('treecode', [True, False])
+def test_fmmT(treecode):
+    fmm_tester('elasticRT3', treecode = treecode)
 
-def test_fmmA():
-    fmm_tester('elasticRA3')
+@pytest.mark.parametrize('treecode', [True, False])
+def test_fmmA(treecode):
+    fmm_tester('elasticRA3', treecode = treecode)
 
-def test_fmmH():
-    fmm_tester('elasticRH3')
+@pytest.mark.parametrize('treecode', [True, False])
+def test_fmmH(treecode):
+    fmm_tester('elasticRH3', treecode = treecode)
+
+@pytest.mark.parametrize('K_name', ['elasticU3', 'elasticRT3', 'elasticRA3', 'elasticRH3'])
+@pytest.mark.parametrize('treecode', [True, False])
+def test_fmm_cpu(K_name, treecode):
+    fmm_tester(K_name, treecode = treecode, backend = 'cpu')
+
+def test_tree_order():
+    corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+    m = tct.make_rect(20, 20, corners)
+    perm = tree_order(m, 10)
+    m_tree = (m[0], m[1][perm])
+    v = np.random.rand(m[1].shape[0] * 9)
+    v_tree = v.reshape((-1, 9))[perm].flatten()
+
+    args = dict(
+        params = [1.0, 0.25], order = 4, quad_order = 2, float_type = np.float64,
+        K_name = 'elasticRT3', mac = 2.5, max_pts_per_cell = 10,
+        n_workers_per_block = 128
+    )
+    fmm = TSFMM(m, m, **args)
+    fmm_tree = TSFMM(m_tree, m_tree, **args)
+    assert(not fmm.src_in_order)
+    assert(fmm_tree.src_in_order and fmm_tree.obs_in_order)
+
+    y = fmm.dot(v).reshape((-1, 9))[perm].flatten()
+    y_tree = fmm_tree.dot(v_tree)
+    np.testing.assert_almost_equal(y, y_tree)
+
+@pytest.mark.parametrize('tree_type', ['octree', 'kdtree'])
+def test_tree_order_shuffled(tree_type):
+    # A jittered mesh with the triangles in random order, so the renumbering
+    # is far from the identity.
+    np.random.seed(17)
+    corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+    pts, tris = tct.make_rect(25, 25, corners)
+    pts = pts + np.random.uniform(-0.02, 0.02, pts.shape)
+    m = (pts, tris[np.random.permutation(tris.shape[0])])
+    perm = tree_order(m, 10, tree_type = tree_type)
+    np.testing.assert_equal(np.sort(perm), np.arange(tris.shape[0]))
+    assert(not np.array_equal(perm, np.arange(tris.shape[0])))
+
+    m_tree = (m[0], m[1][perm])
+    v = np.random.rand(m[1].shape[0] * 9)
+    v_tree = v.reshape((-1, 9))[perm].flatten()
+    args = dict(
+        params = [1.0, 0.25], order = 4, quad_order = 2, float_type = np.float64,
+        K_name = 'elasticRT3', mac = 2.5, max_pts_per_cell = 10,
+        n_workers_per_block = 128, tree_type = tree_type
+    )
+    y = TSFMM(m, m, **args).dot(v).reshape((-1, 9))[perm].flatten()
+    y_tree = TSFMM(m_tree, m_tree, **args).dot(v_tree)
+    np.testing.assert_almost_equal(y, y_tree)
+
+@pytest.mark.parametrize('tree_type', ['octree', 'kdtree'])
+@pytest.mark.parametrize('K_name', ['elasticU3', 'elasticRT3'])
+def test_renumber(tree_type, K_name):
+    np.random.seed(17)
+    corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+    pts, tris = tct.make_rect(25, 25, corners)
+    pts = pts + np.random.uniform(-0.02, 0.02, pts.shape)
+    m = (pts, tris[np.random.permutation(tris.shape[0])])
+    v = np.random.rand(m[1].shape[0] * 9)
+
+    args = dict(
+        params = [1.0, 0.25], order = 4, quad_order = 2, float_type = np.float64,
+        K_name = K_name, mac = 2.5, max_pts_per_cell = 10,
+        n_workers_per_block = 128, tree_type = tree_type, backend = 'cpu'
+    )
+    fmm = TSFMM(m, m, **args)
+    renumbered = TSFMM(m, m, renumber = True, **args)
+    assert(fmm.obs_perm is None and fmm.src_perm is None)
+
+    # One tree and one permutation are shared by the obs and src meshes and
+    # the matvecs never permute.
+    perm = renumbered.src_perm
+    assert(renumbered.obs_tree is renumbered.src_tree)
+    np.testing.assert_equal(renumbered.obs_perm, perm)
+    np.testing.assert_equal(perm, np.array(fmm.src_tree.orig_idxs))
+    np.testing.assert_equal(renumbered.src_m[1], m[1][perm])
+    assert(renumbered.src_in_order and renumbered.obs_in_order)
+
+    y = fmm.dot(v).reshape((-1, 9))[perm].flatten()
+    y_renumbered = renumbered.dot(v.reshape((-1, 9))[perm].flatten())
+    np.testing.assert_almost_equal(y, y_renumbered)
+
+@pytest.mark.parametrize('treecode', [True, False])
+def test_symmetric_high_order(treecode):
+    # With order above the leaf size, many far pairs fall back to p2p blocks,
+    # which the symmetric evaluation applies in both directions.
+    corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+    m = tct.make_rect(15, 15, corners)
+    v = np.random.rand(m[1].shape[0] * 9)
+
+    args = dict(
+        params = [1.0, 0.25], order = 20, quad_order = 2, float_type = np.float64,
+        K_name = 'elasticU3', mac = 2.5, max_pts_per_cell = 10,
+        n_workers_per_block = 128, treecode = treecode, backend = 'cpu'
+    )
+    sym = TSFMM(m, m, **args)
+    full = TSFMM(m, m, symmetric = False, **args)
+    assert(sym.symmetric and not full.symmetric)
+    np.testing.assert_almost_equal(sym.dot(v), full.dot(v))
+
+def test_symmetric_refit_rejects_different_meshes():
+    corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+    m = tct.make_rect(10, 10, corners)
+    v = np.random.rand(m[1].shape[0] * 9)
+    fmm = TSFMM(
+        m, m, params = [1.0, 0.25], order = 4, quad_order = 2,
+        float_type = np.float64, K_name = 'elasticU3', mac = 2.5,
+        max_pts_per_cell = 10, n_workers_per_block = 128, backend = 'cpu'
+    )
+    assert(fmm.symmetric)
+    y = fmm.dot(v)
+
+    moved = (m[0] + 0.01, m[1])
+    with pytest.raises(ValueError):
+        fmm.refit(moved, m)
+    assert(fmm.obs_m is m and fmm.src_m is m)
+    np.testing.assert_almost_equal(fmm.dot(v), y)
+
+@pytest.mark.parametrize('treecode', [True, False])
+def test_multiple_rhs(treecode):
+    corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+    m = tct.make_rect(10, 10, corners)
+    V = np.random.rand(m[1].shape[0] * 9, 3)
+
+    fmm = TSFMM(
+        m, m, params = [1.0, 0.25], order = 4, quad_order = 2,
+        float_type = np.float64, K_name = 'elasticU3', mac = 2.5,
+        max_pts_per_cell = 10, n_workers_per_block = 32, treecode = treecode
+    )
+    Y = fmm.dot(V)
+    assert(Y.shape == V.shape)
+    for i in range(V.shape[1]):
+        np.testing.assert_almost_equal(Y[:, i], fmm.dot(V[:, i]))
+    np.testing.assert_almost_equal(fmm.dot(V), Y)
+
+    op = tct.TriToTriDirectFarfieldOp(
+        2, 'elasticU3', [1.0, 0.25], m[0], m[1], np.float64,
+        np.arange(m[1].shape[0]), np.arange(m[1].shape[0])
+    )
+    Y = op.dot(V)
+    for i in range(V.shape[1]):
+        np.testing.assert_almost_equal(Y[:, i], op.dot(V[:, i]))
+    np.testing.assert_almost_equal(op.dot(V), Y)
 
 def benchmark():
     compare = False
@@ -4,7 +4,7 @@ from tectosaur.fmm.cfg import get_dim_module
 from tectosaur.util.test_decorators import slow
 import pytest
 
-@pytest.fixture(params = ['kd', 'oct'])
+@pytest.fixture(params = ['kd', 'kd_median', 'kd_widest', 'kd_cost', 'oct', 'morton', 'compact'])
 def tree_type(request):
     return request.param
 
@@ -12,8 +12,15 @@ def make_tree(tree_type, pts, Rs, n_per_cell):
     dim = pts.shape[1]
     if tree_type == 'kd':
         return get_dim_module(dim).kdtree.Tree.build(pts, Rs, n_per_cell)
+    elif tree_type.startswith('kd_'):
+        builder = 'build_' + tree_type[3:]
+        return getattr(get_dim_module(dim).kdtree.Tree, builder)(pts, Rs, n_per_cell)
     elif tree_type == 'oct':
         return get_dim_module(dim).octree.Tree.build(pts, Rs, n_per_cell)
+    elif tree_type == 'morton':
+        return get_dim_module(dim).octree.Tree.build_morton(pts, Rs, n_per_cell)
+    elif tree_type == 'compact':
+        return get_dim_module(dim).octree.Tree.build_compact(pts, Rs, n_per_cell)
 
 def simple_setup(n, tree_type, dim):
     pts = np.random.rand(n, dim)
@@ -28,7 +35,7 @@ def test_bisects(tree_type, dim):
         if n.is_leaf:
             continue
         idx_list = set(range(n.start, n.end))
-        for child_i in range(t.split):
+        for child_i in range(n.n_children):
             child_n = t.nodes[n.children[child_i]]
             child_idx_list = set(range(child_n.start, child_n.end))
             assert(child_idx_list.issubset(idx_list))
@@ -48,10 +55,10 @@ def test_height_depth(tree_type, dim):
     for n in t.nodes:
         if n.is_leaf:
             continue
-        for c in range(t.split):
+        for c in range(n.n_children):
             assert(n.depth == t.nodes[n.children[c]].depth - 1)
         assert(n.height ==
-            max([t.nodes[n.children[c]].height for c in range(t.split)]) + 1)
+            max([t.nodes[n.children[c]].height for c in range(n.n_children)]) + 1)
 
 def test_one_level(tree_type, dim):
     pts = np.random.rand(dim, dim)
@@ -85,3 +92,113 @@ def test_law_of_large_numbers():
         n_pts = child.end - child.start
         diff = np.abs(n_pts - (n / 8));
         assert(diff < (n / 16));
+
+def test_node_arrays(tree_type, dim):
+    pts, Rs, t = simple_setup(200, tree_type, dim)
+    assert(t.node_centers.shape == (t.n_nodes, dim))
+    for i, n in enumerate(t.nodes):
+        np.testing.assert_equal(t.node_centers[i], n.bounds.center)
+        assert(t.node_Rs[i] == n.bounds.R)
+        assert(t.node_starts[i] == n.start)
+        assert(t.node_ends[i] == n.end)
+        assert(t.node_depths[i] == n.depth)
+        assert(t.node_n_children[i] == n.n_children)
+        if not n.is_leaf:
+            for c in range(n.n_children):
+                assert(n.children[c] == t.node_first_child[i] + c)
+
+def test_compact_has_no_empty_children(dim):
+    pts = np.random.rand(1000, dim)
+    pts[:, -1] = 0.5
+    Rs = np.full(pts.shape[0], 0.001)
+    full = make_tree('oct', pts, Rs, 10)
+    compact = make_tree('compact', pts, Rs, 10)
+    for n in compact.nodes:
+        assert(n.end > n.start)
+        if not n.is_leaf:
+            assert(1 <= n.n_children <= compact.split)
+    assert(compact.n_nodes < full.n_nodes)
+
+def test_refit(tree_type, dim):
+    pts, Rs, t = simple_setup(300, tree_type, dim)
+    n_nodes = t.n_nodes
+    moved = pts + np.random.rand(*pts.shape) * 1e-3
+    t.refit(moved, Rs)
+    assert(t.n_nodes == n_nodes)
+    np.testing.assert_equal(np.array([b.center for b in t.balls]), moved[t.orig_idxs])
+    for n in t.nodes:
+        for i in range(n.start, n.end):
+            dist = np.sqrt(np.sum((n.bounds.center - moved[t.orig_idxs[i]]) ** 2))
+            assert(dist <= n.bounds.R)
+
+def test_traversal_cache(tmpdir, monkeypatch):
+    from tectosaur.fmm.traversal_cache import cached_traversal
+    import tectosaur.util.disk_cache as disk_cache
+    monkeypatch.setenv('TECTOSAUR_CACHE_DIR', str(tmpdir))
+
+    module = get_dim_module(3).octree
+    pts = np.random.rand(500, 3)
+    Rs = np.random.rand(500) * 0.01
+    def build():
+        t = module.Tree.build_compact(pts, Rs, 10)
+        return t, t, module.fmmmm_interactions(t, t, 1.0, 3.0, 2, False)
+    key = disk_cache.hash_key(pts, Rs, 10, 3.0, 2)
+
+    t1, _, i1 = cached_traversal(module, key, build)
+    def fail():
+        assert(False)
+    t2, _, i2 = cached_traversal(module, key, fail)
+
+    assert(t1.max_height == t2.max_height)
+    for name in ['ball_centers', 'ball_Rs', 'orig_idxs', 'node_centers',
+            'node_Rs', 'node_starts', 'node_ends', 'node_n_children']:
+        np.testing.assert_equal(getattr(t1, name), getattr(t2, name))
+    for n1, n2 in zip(t1.nodes, t2.nodes):
+        assert(n1.height == n2.height and n1.is_leaf == n2.is_leaf)
+    for name in ['p2p', 'm2p', 'm2l', 'p2l']:
+        np.testing.assert_equal(getattr(i1, name).src_n_idxs, getattr(i2, name).src_n_idxs)
+    assert(len(i1.m2m) == len(i2.m2m))
+    for l1, l2 in zip(i1.l2l, i2.l2l):
+        np.testing.assert_equal(l1.obs_n_idxs, l2.obs_n_idxs)
+
+def test_interactions32():
+    module = get_dim_module(3).octree
+    pts = np.random.rand(2000, 3)
+    t = module.Tree.build_compact(pts, np.full(2000, 0.001), 20)
+    i64 = module.fmmmm_interactions(t, t, 1.0, 3.0, 20, False)
+    i32 = module.fmmmm_interactions32(t, t, 1.0, 3.0, 20, False)
+    for name in ['p2p', 'm2p', 'p2l', 'm2l', 'p2m', 'l2p']:
+        l64, l32 = getattr(i64, name), getattr(i32, name)
+        assert(l32.src_n_idxs.dtype == np.int32)
+        np.testing.assert_equal(l32.obs_n_idxs, l64.obs_n_idxs)
+        np.testing.assert_equal(l32.obs_src_starts, l64.obs_src_starts)
+        np.testing.assert_equal(l32.src_n_idxs, l64.src_n_idxs)
+
+def test_symmetric_interactions():
+    module = get_dim_module(3).octree
+    pts = np.random.rand(2000, 3)
+    t = module.Tree.build_compact(pts, np.full(2000, 0.001), 20)
+    sym = module.fmmmm_interactions_symmetric32(t, 1.0, 3.0, 2, True)
+    assert(module.interactions_valid(sym, t, t, 1.0, 3.0))
+    starts, ends = t.node_starts, t.node_ends
+    n_p2p = 0
+    p2p = sym.p2p
+    for i, obs_idx in enumerate(p2p.obs_n_idxs):
+        for src_idx in p2p.src_n_idxs[p2p.obs_src_starts[i]:p2p.obs_src_starts[i + 1]]:
+            n = (ends[obs_idx] - starts[obs_idx]) * (ends[src_idx] - starts[src_idx])
+            n_p2p += n if obs_idx == src_idx else 2 * n
+    n_m2p = module.count_interactions(sym.m2p, t, t, False, False, 0)
+    assert(n_p2p + n_m2p == 2000 * 2000)
+
+def test_mac_policies():
+    module = get_dim_module(3).octree
+    pts = np.random.rand(2000, 3)
+    t = module.Tree.build_compact(pts, np.full(2000, 0.001), 20)
+    for mac in [
+            module.BallMAC(1.0, 3.0), module.BoxMAC(t, t, 1.0, 3.0),
+            module.ThetaMAC(0.5), module.ErrorMAC(t, t, 2, 1e-3)]:
+        interactions = module.fmmmm_interactions32(t, t, mac, 2, True)
+        assert(module.interactions_valid(interactions, t, t, mac))
+        n_p2p = module.count_interactions(interactions.p2p, t, t, False, False, 0)
+        n_m2p = module.count_interactions(interactions.m2p, t, t, False, False, 0)
+        assert(n_p2p + n_m2p == 2000 * 2000)
@@ -1,8 +1,10 @@
 import time
+import pytest
 import numpy as np
 
 from tectosaur.farfield import farfield_pts_direct, get_gpu_module
-from tectosaur.ops.sparse_farfield_op import TriToTriDirectFarfieldOp
+from tectosaur.ops.sparse_farfield_op import TriToTriDirectFarfieldOp, \
+    FMMFarfieldOp
 from tectosaur.util.geometry import normalize
 from tectosaur.mesh.mesh_gen import make_rect
 from tectosaur.mesh.modify import concat
@@ -38,6 +40,46 @@ def test_tri_tri_farfield():
     out2 = T2.dot(in_vals)
     np.testing.assert_almost_equal(out1, out2)
 
+@pytest.mark.parametrize('mac_args', [
+    dict(mac_type = 'ball', mac = 2.5),
+    dict(mac_type = 'box', mac = 2.5),
+    dict(mac_type = 'theta', mac = None, theta = 0.5),
+    dict(mac_type = 'error', mac = None, mac_tol = 1e-6),
+])
+def test_fmm_farfield_op_mac_type(mac_args):
+    m, surf1_idxs, surf2_idxs = make_meshes(n_m = 12, sep = 0.5)
+    args = (
+        2, 'elasticU3', [1.0, 0.25], m[0], m[1], np.float64,
+        surf1_idxs, surf2_idxs
+    )
+    fmm = FMMFarfieldOp(
+        pts_per_cell = 20, order = 8, backend = 'cpu', **mac_args
+    )(*args)
+    assert(fmm.fmm.cfg['mac_type'] == mac_args['mac_type'])
+    v = np.random.rand(fmm.fmm.n_input)
+    correct = TriToTriDirectFarfieldOp(*args).dot(v)
+    err = np.linalg.norm(fmm.dot(v) - correct) / np.linalg.norm(correct)
+    assert(err < 1e-3)
+
+@pytest.mark.parametrize('treecode', [True, False])
+def test_fmm_farfield_op_treecode(treecode):
+    m, surf1_idxs, surf2_idxs = make_meshes(n_m = 12, sep = 0.5)
+    args = (
+        2, 'elasticU3', [1.0, 0.25], m[0], m[1], np.float64,
+        surf1_idxs, surf2_idxs
+    )
+    fmm = FMMFarfieldOp(
+        mac = 2.5, pts_per_cell = 20, order = 8, backend = 'cpu',
+        treecode = treecode
+    )(*args)
+    assert(fmm.fmm.treecode == treecode)
+    n_m2l = fmm.fmm.interactions.m2l.src_n_idxs.shape[0]
+    assert((n_m2l == 0) == treecode)
+    v = np.random.rand(fmm.fmm.n_input)
+    correct = TriToTriDirectFarfieldOp(*args).dot(v)
+    err = np.linalg.norm(fmm.dot(v) - correct) / np.linalg.norm(correct)
+    assert(err < 1e-3)
+
 def timing(n, runtime, name, flops):
     print("for " + name)
     cycles = runtime * 5e12
@@ -91,6 +133,22 @@ def test_A():
 def test_H():
     run_kernel(1000, 'elasticH3', 102, testit = True)
 
+def test_tune_fmm(tmpdir, monkeypatch):
+    from tectosaur.ops.fmm_tuning import tune_fmm
+    monkeypatch.setenv('TECTOSAUR_CACHE_DIR', str(tmpdir))
+    corners = [[-1.0, -1.0, 0], [-1.0, 1.0, 0], [1.0, 1.0, 0], [1.0, -1.0, 0]]
+    m = make_rect(10, 10, corners)
+    all_tris = np.arange(m[1].shape[0])
+    args = (2, 'elasticRT3', [1.0, 0.25], m[0], m[1], np.float64, all_tris, all_tris, 1e-3)
+    kwargs = dict(macs = [2.5, 4.0], pts_per_cells = [20], orders = [2, 6, 10])
+    op_type, op = tune_fmm(*args, **kwargs)
+    assert(op is not None)
+
+    # The second call loads the choice from the cache.
+    op_type2, op2 = tune_fmm(*args, **kwargs)
+    assert(op2 is None)
+    assert(op_type == op_type2)
+
 if __name__ == '__main__':
     n = 32 * 512
     run_kernel(n, 'elasticU3', 28, timeit = True)
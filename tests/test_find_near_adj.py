@@ -1,4 +1,5 @@
 import numpy as np
+import scipy.spatial
 
 import tectosaur.mesh.mesh_gen as mesh_gen
 from tectosaur.mesh.find_near_adj import *
@@ -78,6 +79,87 @@ def test_find_adjacency(request):
     all_sorted = all[sorted_idxs,:]
     return all_sorted
 
+def test_nearfield_clustered():
+    np.random.seed(10)
+    n = 20000
+    pts = np.random.rand(n, 3)
+    pts[:, 2] = 0
+    pts[:15000] *= 0.05
+    rs = np.full(n, 0.002)
+    rs[:15000] *= 0.05
+    out = fast_find_nearfield.get_nearfield(pts, rs, pts, rs, 1.5, 50)
+    out2 = fast_find_nearfield.get_nearfield(pts, rs, pts, rs, 1.5, 50)
+    np.testing.assert_equal(out, out2)
+
+    tree = scipy.spatial.cKDTree(pts)
+    correct = set()
+    for i, js in enumerate(tree.query_ball_point(pts, 1.5 * (rs + np.max(rs)))):
+        for j in js:
+            if np.linalg.norm(pts[i] - pts[j]) <= 1.5 * (rs[i] + rs[j]):
+                correct.add((i, j))
+    assert(set(map(tuple, out)) == correct)
+
+def test_self_nearfield():
+    corners = [[-1, -1, 0], [1, -1, 0], [1, 1, 0], [-1, 1, 0]]
+    pts, tris = mesh_gen.make_rect(30, 30, corners)
+    centroids, rs = get_tri_centroids_rs(pts, tris)
+    correct = set(map(tuple, fast_find_nearfield.get_nearfield(
+        centroids, rs, centroids, rs, 1.25, 20
+    )))
+    both = fast_find_nearfield.self_get_nearfield(centroids, rs, 1.25, 20)
+    assert(both.shape[0] == len(correct))
+    assert(set(map(tuple, both)) == correct)
+    canonical = fast_find_nearfield.self_get_nearfield(
+        centroids, rs, 1.25, 20, canonical = True
+    )
+    assert(set(map(tuple, canonical)) == set(p for p in correct if p[0] <= p[1]))
+
+def test_classify_nearfield():
+    from tectosaur.nearfield.nearfield_op import to_tri_space, resolve_ea_rotation
+    m = mesh_gen.make_sphere([0,0,0], 1.0, 3)
+    obs_subset = np.arange(0, m[1].shape[0], 2)
+    src_subset = np.arange(m[1].shape[0] // 3, m[1].shape[0])
+    close_pairs = find_close_or_touching(
+        m[0], m[1][obs_subset], m[0], m[1][src_subset], 1.25
+    )
+    close, va, ea = split_adjacent_close(
+        close_pairs, m[1][obs_subset], m[1][src_subset]
+    )
+    co2, ea2, va2, close2 = classify_nearfield(close_pairs, m[1], obs_subset, src_subset)
+
+    co_tris = to_tri_space(co2, obs_subset, src_subset)
+    np.testing.assert_equal(co_tris[:,0], co_tris[:,1])
+    np.testing.assert_equal(np.sort(co_tris[:,0]), np.intersect1d(obs_subset, src_subset))
+    np.testing.assert_equal(close2, close)
+    np.testing.assert_equal(va2, va)
+    np.testing.assert_equal(
+        to_tri_space(ea2, obs_subset, src_subset),
+        resolve_ea_rotation(m[1], to_tri_space(ea, obs_subset, src_subset))
+    )
+
+def test_nearfield_index():
+    from concurrent.futures import ThreadPoolExecutor
+    corners = [[-1, -1, 0], [1, -1, 0], [1, 1, 0], [-1, 1, 0]]
+    pts, tris = mesh_gen.make_rect(30, 30, corners)
+    index = build_nearfield_index(pts, tris)
+    assert(index.n_src == tris.shape[0])
+
+    np.random.seed(11)
+    batches = [np.random.rand(200, 3) * 2 - 1 for i in range(4)]
+    correct = [
+        fast_find_nearfield.get_nearfield(
+            obs_pts, np.zeros(obs_pts.shape[0]),
+            *get_tri_centroids_rs(pts, tris), 2.0, 50
+        ) for obs_pts in batches
+    ]
+    with ThreadPoolExecutor(4) as executor:
+        results = list(executor.map(
+            lambda obs_pts: index.query(obs_pts, np.zeros(obs_pts.shape[0]), 2.0),
+            batches
+        ))
+    for out, c in zip(results, correct):
+        np.testing.assert_equal(out, c)
+
 def benchmark_find_nearfield():
     corners = [[-1, -1, 0], [1, -1, 0], [1, 1, 0], [-1, 1, 0]]
     nx = ny = 707
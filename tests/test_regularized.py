@@ -1,10 +1,12 @@
 import time
+import pytest
 import numpy as np
 import matplotlib.pyplot as plt
 from test_farfield import make_meshes
 from tectosaur.ops.sparse_integral_op import RegularizedSparseIntegralOp
 from tectosaur.ops.dense_integral_op import RegularizedDenseIntegralOp
-from tectosaur.ops.sparse_farfield_op import TriToTriDirectFarfieldOp
+from tectosaur.ops.sparse_farfield_op import TriToTriDirectFarfieldOp, \
+    FMMFarfieldOp
 from tectosaur.ops.mass_op import MassOp
 from tectosaur.ops.neg_op import MultOp
 from tectosaur.ops.sum_op import SumOp
@@ -214,6 +216,83 @@ def test_regularized_H_self():
         which = ['dense_regularized', 'sparse_regularized']
     )
 
+def test_concurrent_dot():
+    import concurrent.futures
+    m, surf1_idxs, surf2_idxs = make_meshes(n_m = 6, sep = 0.5)
+    op = RegularizedSparseIntegralOp(
+        6, 6, 6, 2, 5, 2.5, 'elasticRT3', 'elasticRT3', [1.0, 0.25],
+        m[0], m[1], np.float64, TriToTriDirectFarfieldOp,
+        obs_subset = surf1_idxs, src_subset = surf2_idxs
+    )
+    xs = [np.random.rand(op.shape[1]) for i in range(8)]
+    correct = [op.dot(x) for x in xs]
+    with concurrent.futures.ThreadPoolExecutor(max_workers = 4) as pool:
+        results = list(pool.map(op.dot, xs))
+    for y, y_correct in zip(results, correct):
+        np.testing.assert_almost_equal(y, y_correct)
+
+def test_dot_after_farfield_failure():
+    class FailingFarfieldOp(TriToTriDirectFarfieldOp):
+        fail = False
+        def dot(self, v):
+            if self.fail:
+                raise RuntimeError('farfield failed')
+            return super().dot(v)
+
+    m, surf1_idxs, surf2_idxs = make_meshes(n_m = 6, sep = 0.5)
+    op = RegularizedSparseIntegralOp(
+        6, 6, 6, 2, 5, 2.5, 'elasticRT3', 'elasticRT3', [1.0, 0.25],
+        m[0], m[1], np.float64, FailingFarfieldOp,
+        obs_subset = surf1_idxs, src_subset = surf2_idxs
+    )
+    x = np.random.rand(op.shape[1])
+    correct = op.dot(x).copy()
+    op.farfield.fail = True
+    with pytest.raises(RuntimeError):
+        op.dot(x)
+    op.farfield.fail = False
+    np.testing.assert_almost_equal(op.dot(x), correct)
+
+def test_multiple_rhs():
+    m, surf1_idxs, surf2_idxs = make_meshes(n_m = 6, sep = 0.5)
+    op = RegularizedSparseIntegralOp(
+        6, 6, 6, 2, 5, 2.5, 'elasticRT3', 'elasticRT3', [1.0, 0.25],
+        m[0], m[1], np.float64, TriToTriDirectFarfieldOp,
+        obs_subset = surf1_idxs, src_subset = surf2_idxs
+    )
+    V = np.random.rand(op.shape[1], 3)
+
+    # The block product first, then the single vector products, then the
+    # block again with the cached block size buffers.
+    Y = op.dot(V)
+    assert(Y.shape == (op.shape[0], 3))
+    for i in range(V.shape[1]):
+        np.testing.assert_almost_equal(Y[:, i], op.dot(V[:, i]))
+    np.testing.assert_almost_equal(op.dot(V), Y)
+
+def test_renumber():
+    m, surf1_idxs, surf2_idxs = make_meshes(n_m = 8, sep = 0.5)
+    def build(renumber):
+        return RegularizedSparseIntegralOp(
+            6, 6, 6, 2, 5, 2.5, 'elasticRT3', 'elasticRT3', [1.0, 0.25],
+            m[0], m[1], np.float64,
+            FMMFarfieldOp(
+                mac = 2.5, pts_per_cell = 10, order = 6, backend = 'cpu',
+                renumber = renumber
+            ),
+            obs_subset = surf1_idxs, src_subset = surf2_idxs
+        )
+    op = build(False)
+    renumbered = build(True)
+    assert(op.obs_perm is None and op.src_perm is None)
+    np.testing.assert_equal(renumbered.obs_subset, surf1_idxs[renumbered.obs_perm])
+    np.testing.assert_equal(renumbered.src_subset, surf2_idxs[renumbered.src_perm])
+
+    x = np.random.rand(op.shape[1])
+    y = op.dot(x).reshape((-1, 9))[renumbered.obs_perm].flatten()
+    x_renumbered = x.reshape((-1, 9))[renumbered.src_perm].flatten()
+    np.testing.assert_almost_equal(renumbered.dot(x_renumbered), y)
+
 def test_benchmark_far_tris():
     n = 100
     m, surf1_idxs, surf2_idxs = make_meshes(n_m = n, sep = 4.0)
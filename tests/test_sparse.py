@@ -63,6 +63,31 @@ def test_dense_bcoomv():
     dense_bcoomv_tester((60, 100))
     dense_bcoomv_tester((100, 60))
 
+def test_bcoomm():
+    # Random blocks with repeated rows and columns, like a nearfield matrix.
+    bs = 9
+    n_block_rows, n_block_cols, n_blocks = 30, 20, 200
+    rows = np.random.randint(n_block_rows, size = n_blocks)
+    cols = np.random.randint(n_block_cols, size = n_blocks)
+    data = np.random.rand(n_blocks, bs, bs)
+    A_bcoo = sparse.BCOOMatrix(rows, cols, data, (n_block_rows * bs, n_block_cols * bs))
+    A = np.zeros(A_bcoo.shape)
+    for r, c, block in zip(rows, cols, data):
+        A[(bs * r):(bs * r + bs), (bs * c):(bs * c + bs)] += block
+    V = np.random.rand(A.shape[1], 4)
+
+    # The block product first, so that it doesn't depend on anything left
+    # behind by the single vector products.
+    Y = A_bcoo.dot(V)
+    assert(Y.shape == (A.shape[0], 4))
+    np.testing.assert_almost_equal(Y, A.dot(V))
+    for i in range(V.shape[1]):
+        np.testing.assert_almost_equal(Y[:, i], A_bcoo.dot(V[:, i]))
+
+    out = np.ones_like(Y)
+    A_bcoo.dot(V, out = out)
+    np.testing.assert_almost_equal(out, Y + 1)
+
 def test_to_bsr():
     A = np.random.rand(100,100)
     x = np.random.rand(A.shape[1])